@@ -0,0 +1,735 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <math.h>
+#include <linux/input.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../libs/logger.h"
+#include "../libs/easy_args.h"
+
+#include "../common/network.h"
+#include "../common/protocol.h"
+#include "input-bench.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+#define DEFAULT_CLIENTS 1
+#define DEFAULT_DURATION 10
+#define DEFAULT_PING_INTERVAL 100
+
+volatile sig_atomic_t quit_signal = 0;
+
+typedef struct {
+	uint64_t* samples;
+	size_t length;
+	size_t allocated;
+} sample_set;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static size_t frame_mouse(bench_client* client, struct input_event* events) {
+	size_t n = 0;
+	double angle = client->sequence * 0.05;
+
+	events[n].type = EV_REL;
+	events[n].code = REL_X;
+	events[n++].value = (int) (10 * cos(angle));
+	events[n].type = EV_REL;
+	events[n].code = REL_Y;
+	events[n++].value = (int) (10 * sin(angle));
+
+	// click every 250 frames
+	if (client->sequence % 250 < 2) {
+		events[n].type = EV_KEY;
+		events[n].code = BTN_LEFT;
+		events[n++].value = (client->sequence % 250) ? 0 : 1;
+	}
+	return n;
+}
+
+static size_t frame_keyboard(bench_client* client, struct input_event* events) {
+	size_t n = 0;
+	unsigned key = KEY_A + (client->sequence / 2) % 26;
+
+	events[n].type = EV_MSC;
+	events[n].code = MSC_SCAN;
+	events[n++].value = 0x70004 + key - KEY_A;
+	events[n].type = EV_KEY;
+	events[n].code = key;
+	events[n++].value = (client->sequence % 2) ? 0 : 1;
+	return n;
+}
+
+static size_t frame_stick(bench_client* client, struct input_event* events) {
+	size_t n = 0;
+	// triangle sweep over the whole axis range
+	int32_t position = (client->sequence * 512) % 131072;
+	position = (position < 65536) ? position : 131071 - position;
+
+	events[n].type = EV_ABS;
+	events[n].code = ABS_X;
+	events[n++].value = position - 32768;
+	events[n].type = EV_ABS;
+	events[n].code = ABS_Y;
+	events[n++].value = 32767 - position;
+	return n;
+}
+
+bench_capability mouse_capabilities[] = {
+	{EV_REL, REL_X},
+	{EV_REL, REL_Y},
+	{EV_KEY, BTN_LEFT},
+	{EV_KEY, BTN_RIGHT},
+	{0}
+};
+
+bench_capability keyboard_capabilities[] = {
+	{EV_MSC, MSC_SCAN},
+	{EV_KEY, KEY_A}, {EV_KEY, KEY_B}, {EV_KEY, KEY_C}, {EV_KEY, KEY_D}, {EV_KEY, KEY_E},
+	{EV_KEY, KEY_F}, {EV_KEY, KEY_G}, {EV_KEY, KEY_H}, {EV_KEY, KEY_I}, {EV_KEY, KEY_J},
+	{EV_KEY, KEY_K}, {EV_KEY, KEY_L}, {EV_KEY, KEY_M}, {EV_KEY, KEY_N}, {EV_KEY, KEY_O},
+	{EV_KEY, KEY_P}, {EV_KEY, KEY_Q}, {EV_KEY, KEY_R}, {EV_KEY, KEY_S}, {EV_KEY, KEY_T},
+	{EV_KEY, KEY_U}, {EV_KEY, KEY_V}, {EV_KEY, KEY_W}, {EV_KEY, KEY_X}, {EV_KEY, KEY_Y},
+	{EV_KEY, KEY_Z},
+	{0}
+};
+
+bench_capability stick_capabilities[] = {
+	{EV_ABS, ABS_X, -32768, 32767},
+	{EV_ABS, ABS_Y, -32768, 32767},
+	{EV_KEY, BTN_A},
+	{0}
+};
+
+bench_profile profiles[] = {
+	{"mouse", "InputBench Mouse", 1000, mouse_capabilities, frame_mouse},
+	{"keyboard", "InputBench Keyboard", 100, keyboard_capabilities, frame_keyboard},
+	{"stick", "InputBench Stick", 250, stick_capabilities, frame_stick},
+	{NULL}
+};
+
+static bool samples_add(sample_set* set, uint64_t value) {
+	if (set->length == set->allocated) {
+		set->allocated = set->allocated ? set->allocated * 2 : 1024;
+		set->samples = realloc(set->samples, set->allocated * sizeof(uint64_t));
+		if (!set->samples) {
+			set->length = set->allocated = 0;
+			return false;
+		}
+	}
+	set->samples[set->length++] = value;
+	return true;
+}
+
+static int compare_samples(const void* a, const void* b) {
+	uint64_t x = *(uint64_t*) a, y = *(uint64_t*) b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(sample_set* set, double p) {
+	if (!set->length) {
+		return 0;
+	}
+	return set->samples[(size_t) ((set->length - 1) * p)] / 1000.0;
+}
+
+// sends a handshake message, wrapped into an envelope for slots opened on another connection
+static bool bench_send(Config* config, bench_client* client, void* data, size_t len) {
+	uint8_t buf[sizeof(SlotMessage) + UINT8_MAX];
+	SlotMessage* envelope = (SlotMessage*) buf;
+
+	if (!client->owner) {
+		return send_message(config->log, client->fd, data, len);
+	}
+
+	if (len > UINT8_MAX) {
+		logprintf(config->log, LOG_ERROR, "Message 0x%.2x does not fit an envelope\n", ((uint8_t*) data)[0]);
+		return false;
+	}
+	envelope->msg_type = MESSAGE_SLOT;
+	envelope->length = len;
+	envelope->slot = client->slot;
+	memcpy(envelope->messages, data, len);
+	return send_message(config->log, client->owner->fd, buf, sizeof(SlotMessage) + len);
+}
+
+/**
+ * Receives a handshake reply like recv_reply. Replies to a slot opened on another
+ * connection arrive in envelopes, which are unwrapped, the bytes following them are
+ * kept in the input buffer of the connection. Only an OPEN that failed is answered
+ * without envelope.
+ */
+static ssize_t bench_reply(Config* config, bench_client* client, uint8_t* buf, size_t len) {
+	bench_client* connection = client->owner;
+	SlotMessage* envelope;
+	ssize_t bytes;
+	int size;
+
+	if (!connection) {
+		return recv_reply(config->log, client->fd, buf, len, NULL, 0);
+	}
+	envelope = (SlotMessage*) connection->input_buffer;
+
+	do {
+		bytes = recv_message(config->log, connection->fd, connection->input_buffer, sizeof(connection->input_buffer),
+				connection->input_buffer, connection->input_bytes);
+		if (bytes < 0) {
+			return -1;
+		}
+		size = get_size_from_command(connection->input_buffer, bytes);
+
+		if (envelope->msg_type == MESSAGE_SLOT) {
+			client->slot = envelope->slot;
+			memcpy(buf, envelope->messages, (envelope->length < len) ? envelope->length : len);
+		} else {
+			memcpy(buf, connection->input_buffer, ((size_t) size < len) ? (size_t) size : len);
+		}
+
+		connection->input_bytes = bytes - size;
+		memmove(connection->input_buffer, connection->input_buffer + size, connection->input_bytes);
+	} while (buf[0] == MESSAGE_EVENT_MASK);
+	return size;
+}
+
+static bool send_capabilities(Config* config, bench_client* client) {
+	bench_capability* cap;
+	RequestEventMessage request = {
+		.msg_type = MESSAGE_REQUEST_EVENT
+	};
+	ABSInfoMessage abs = {
+		.msg_type = MESSAGE_ABSINFO
+	};
+
+	for (cap = config->profile->capabilities; cap->type || cap->code; cap++) {
+		request.type = cap->type;
+		request.code = cap->code;
+		if (!bench_send(config, client, &request, sizeof(request))) {
+			return false;
+		}
+
+		if (cap->type == EV_ABS) {
+			memset(&abs.info, 0, sizeof(abs.info));
+			abs.axis = cap->code;
+			abs.info.minimum = cap->minimum;
+			abs.info.maximum = cap->maximum;
+			if (!bench_send(config, client, &abs, sizeof(abs))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Runs the full protocol handshake for one simulated client (blocking).
+ */
+bool bench_handshake(Config* config, bench_client* client) {
+	uint8_t buf[INPUT_BUFFER_SIZE];
+	uint64_t start = now_ns();
+	size_t name_length = strlen(config->profile->device_name) + 1;
+	size_t password_length = strlen(config->password) + 1;
+	int nodelay = 1;
+	HelloMessage hello = {
+		.msg_type = MESSAGE_HELLO,
+		.version = PROTOCOL_VERSION,
+		.slot = 0
+	};
+	OpenMessage open = {
+		.msg_type = MESSAGE_OPEN,
+		.slot = 0
+	};
+
+	if (client->owner) {
+		// the slot is opened on the authenticated connection of its owner
+		if (!send_message(config->log, client->owner->fd, &open, sizeof(open))
+				|| bench_reply(config, client, buf, sizeof(buf)) < 0) {
+			return false;
+		}
+	} else {
+		client->fd = server_connect(config->host, config->port);
+		if (client->fd < 0) {
+			return false;
+		}
+
+		// frames are written as soon as they are due, do not let nagle hold them back
+		if (config->host[0] != '/' && setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0) {
+			logprintf(config->log, LOG_WARNING, "Failed to set TCP_NODELAY: %s\n", strerror(errno));
+		}
+
+		if (!send_message(config->log, client->fd, &hello, sizeof(hello))
+				|| recv_reply(config->log, client->fd, buf, sizeof(buf), NULL, 0) < 0) {
+			return false;
+		}
+	}
+
+	if (buf[0] == MESSAGE_PASSWORD_REQUIRED) {
+		PasswordMessage* password = calloc(sizeof(PasswordMessage) + password_length, 1);
+		if (!password) {
+			return false;
+		}
+		password->msg_type = MESSAGE_PASSWORD;
+		password->length = password_length;
+		memcpy(password->password, config->password, password_length);
+		if (!bench_send(config, client, password, sizeof(PasswordMessage) + password_length)) {
+			free(password);
+			return false;
+		}
+		free(password);
+
+		if (bench_reply(config, client, buf, sizeof(buf)) < 0) {
+			return false;
+		}
+	}
+
+	if (buf[0] == MESSAGE_SETUP_REQUIRED) {
+		DeviceMessage* device = calloc(sizeof(DeviceMessage) + name_length, 1);
+		uint8_t setup_end = MESSAGE_SETUP_END;
+		if (!device) {
+			return false;
+		}
+		device->msg_type = MESSAGE_DEVICE;
+		device->length = name_length;
+		memcpy(device->name, config->profile->device_name, name_length);
+		if (!bench_send(config, client, device, sizeof(DeviceMessage) + name_length)) {
+			free(device);
+			return false;
+		}
+		free(device);
+
+		if (!send_capabilities(config, client)
+				|| !bench_send(config, client, &setup_end, sizeof(setup_end))
+				|| bench_reply(config, client, buf, sizeof(buf)) < 0) {
+			return false;
+		}
+	}
+
+	if (buf[0] != MESSAGE_SUCCESS) {
+		logprintf(config->log, LOG_ERROR, "Handshake failed, last message: %s\n", get_message_name(buf[0]));
+		return false;
+	}
+
+	client->slot = buf[1];
+	if (config->ring) {
+		if (!ring_create(config->log, &client->ring, RING_DEFAULT_SIZE)
+				|| !ring_offer(config->log, client->owner ? client->owner->fd : client->fd, &client->ring,
+						client->owner ? client->slot : 0)
+				|| bench_reply(config, client, buf, sizeof(buf)) < 0) {
+			return false;
+		}
+		if (buf[0] != MESSAGE_SUCCESS) {
+			logprintf(config->log, LOG_ERROR, "Server refused the event ring\n");
+			return false;
+		}
+	}
+	client->handshake_ns = now_ns() - start;
+	return true;
+}
+
+// encodes the next frame into the output buffer of the connection of the client
+static bool queue_frame(Config* config, bench_client* client) {
+	bench_client* connection = client->owner ? client->owner : client;
+	size_t header = client->owner ? sizeof(SlotMessage) : 0;
+	struct input_event events[MAX_FRAME_EVENTS];
+	SlotMessage* envelope;
+	DataMessage* data;
+	size_t n, u;
+
+	n = config->profile->frame(client, events);
+	events[n].type = EV_SYN;
+	events[n].code = SYN_REPORT;
+	events[n++].value = 0;
+
+	if (client->ring.shared) {
+		if (!ring_write(&client->ring, events, n)) {
+			return false;
+		}
+	} else {
+		if (connection->output_bytes + header + n * sizeof(DataMessage) > BENCH_BUFFER_SIZE) {
+			return false;
+		}
+
+		if (client->owner) {
+			envelope = (SlotMessage*) (connection->output_buffer + connection->output_bytes);
+			envelope->msg_type = MESSAGE_SLOT;
+			envelope->length = n * sizeof(DataMessage);
+			envelope->slot = client->slot;
+			connection->output_bytes += sizeof(SlotMessage);
+		}
+
+		for (u = 0; u < n; u++) {
+			data = (DataMessage*) (connection->output_buffer + connection->output_bytes);
+			data->msg_type = MESSAGE_DATA;
+			data->type = htobe16(events[u].type);
+			data->code = htobe16(events[u].code);
+			data->value = htobe32(events[u].value);
+			connection->output_bytes += sizeof(DataMessage);
+		}
+	}
+
+	client->sequence++;
+	client->frames_sent++;
+	client->events_sent += n;
+	return true;
+}
+
+static bool queue_ping(bench_client* client, uint64_t now) {
+	PingMessage ping = {
+		.msg_type = MESSAGE_PING,
+		.cookie = ++client->ping_cookie
+	};
+
+	if (client->output_bytes + sizeof(ping) > BENCH_BUFFER_SIZE) {
+		return false;
+	}
+	memcpy(client->output_buffer + client->output_bytes, &ping, sizeof(ping));
+	client->output_bytes += sizeof(ping);
+	client->ping_sent = now;
+	client->ping_outstanding = true;
+	return true;
+}
+
+static bool flush_client(Config* config, bench_client* client) {
+	ssize_t bytes;
+
+	while (client->output_bytes) {
+		bytes = send(client->fd, client->output_buffer, message_span(client->output_buffer, client->output_bytes),
+				MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (bytes < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				return true;
+			}
+			logprintf(config->log, LOG_ERROR, "[%d] Failed to send: %s\n", client->slot, strerror(errno));
+			return false;
+		}
+		client->output_bytes -= bytes;
+		memmove(client->output_buffer, client->output_buffer + bytes, client->output_bytes);
+	}
+	return true;
+}
+
+// reads and handles server messages, PONG answers are recorded as round trip samples
+static bool read_client(Config* config, bench_client* client, sample_set* rtt) {
+	ssize_t bytes;
+	int length;
+	PingMessage* pong;
+
+	bytes = recv(client->fd, client->input_buffer + client->input_bytes, sizeof(client->input_buffer) - client->input_bytes, 0);
+	if (bytes <= 0) {
+		if (bytes < 0 && (errno == EAGAIN || errno == EINTR)) {
+			return true;
+		}
+		logprintf(config->log, LOG_ERROR, "[%d] Connection lost\n", client->slot);
+		return false;
+	}
+	client->input_bytes += bytes;
+
+	while (client->input_bytes) {
+		length = get_size_from_command(client->input_buffer, client->input_bytes);
+		if (length < 0) {
+			logprintf(config->log, LOG_ERROR, "[%d] Invalid message 0x%.2x\n", client->slot, client->input_buffer[0]);
+			return false;
+		}
+		if (length == 0 || length > client->input_bytes) {
+			break;
+		}
+
+		if (client->input_buffer[0] == MESSAGE_PONG) {
+			pong = (PingMessage*) client->input_buffer;
+			if (client->ping_outstanding && pong->cookie == client->ping_cookie) {
+				samples_add(rtt, now_ns() - client->ping_sent);
+				client->ping_outstanding = false;
+			}
+		} else {
+			logprintf(config->log, LOG_WARNING, "[%d] Unexpected message %s\n", client->slot, get_message_name(client->input_buffer[0]));
+		}
+
+		client->input_bytes -= length;
+		memmove(client->input_buffer, client->input_buffer + length, client->input_bytes);
+	}
+	return true;
+}
+
+void report(Config* config, bench_client* clients, size_t connected, sample_set* handshakes, sample_set* rtt, uint64_t elapsed) {
+	uint64_t frames = 0, events = 0, skipped = 0;
+	double seconds = elapsed / (double) NSEC_PER_SEC;
+	double handshake_sum = 0;
+	size_t u;
+
+	for (u = 0; u < connected; u++) {
+		frames += clients[u].frames_sent;
+		events += clients[u].events_sent;
+		skipped += clients[u].frames_skipped;
+	}
+	for (u = 0; u < handshakes->length; u++) {
+		handshake_sum += handshakes->samples[u];
+	}
+
+	qsort(handshakes->samples, handshakes->length, sizeof(uint64_t), compare_samples);
+	qsort(rtt->samples, rtt->length, sizeof(uint64_t), compare_samples);
+
+	printf("Profile:     %s, %u clients connected of %u requested\n", config->profile->name, (unsigned) connected, config->clients);
+	printf("Duration:    %.2f s\n", seconds);
+	printf("Handshake:   min %.3f ms, avg %.3f ms, max %.3f ms\n",
+			percentile(handshakes, 0) / 1000.0,
+			handshakes->length ? handshake_sum / handshakes->length / 1000000.0 : 0,
+			percentile(handshakes, 1) / 1000.0);
+	printf("Target:      %u frames/s per client, %.0f frames/s total\n", config->rate, (double) config->rate * connected);
+	printf("Throughput:  %.0f frames/s, %.0f events/s, %.1f%% of target, %llu frames skipped\n",
+			frames / seconds, events / seconds,
+			connected ? 100.0 * frames / (seconds * config->rate * connected) : 0,
+			(unsigned long long) skipped);
+	printf("Round trip:  %zu samples, p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+			rtt->length, percentile(rtt, 0.5), percentile(rtt, 0.9), percentile(rtt, 0.99), percentile(rtt, 1));
+}
+
+int run(Config* config) {
+	bench_client* clients = calloc(config->clients, sizeof(bench_client));
+	struct pollfd* fds = calloc(config->clients, sizeof(struct pollfd));
+	sample_set handshakes = {0}, rtt = {0};
+	bench_client* connection;
+	size_t connected, u;
+	uint64_t start, end, now, next_wakeup, last_ping = 0;
+	uint64_t period = NSEC_PER_SEC / config->rate;
+	uint64_t ping_period = config->ping_interval * 1000000ULL;
+	struct timespec timeout;
+	int status = 0;
+
+	if (!clients || !fds) {
+		logprintf(config->log, LOG_ERROR, "Failed to allocate memory\n");
+		free(clients);
+		free(fds);
+		return 1;
+	}
+
+	for (connected = 0; connected < config->clients && !quit_signal; connected++) {
+		// multiplexed slots are all opened on the connection of the first client
+		clients[connected].fd = -1;
+		clients[connected].owner = (config->multiplex && connected) ? clients : NULL;
+		if (!bench_handshake(config, clients + connected)) {
+			logprintf(config->log, LOG_ERROR, "Client %zu failed to connect\n", connected);
+			if (clients[connected].fd >= 0) {
+				close(clients[connected].fd);
+			}
+			break;
+		}
+		samples_add(&handshakes, clients[connected].handshake_ns);
+		logprintf(config->log, LOG_INFO, "Client %zu connected to slot %d\n", connected, clients[connected].slot);
+	}
+
+	if (!connected) {
+		free(clients);
+		free(fds);
+		return 2;
+	}
+
+	for (u = 0; u < connected; u++) {
+		if (clients[u].fd >= 0 && !set_nonblocking(clients[u].fd)) {
+			logprintf(config->log, LOG_ERROR, "Failed to set client %zu non-blocking\n", u);
+			close(clients[u].fd);
+			clients[u].fd = -1;
+		}
+	}
+
+	start = now_ns();
+	end = start + config->duration * NSEC_PER_SEC;
+	for (u = 0; u < connected; u++) {
+		// spread the clients over one frame period
+		clients[u].next_frame = start + u * period / connected;
+		fds[u].fd = clients[u].fd;
+	}
+
+	for (now = start; now < end && !quit_signal; now = now_ns()) {
+		next_wakeup = end;
+
+		for (u = 0; u < connected; u++) {
+			connection = clients[u].owner ? clients[u].owner : clients + u;
+			if (connection->fd < 0) {
+				continue;
+			}
+
+			// skip frames the client can not catch up with
+			if (now > clients[u].next_frame && now - clients[u].next_frame > MAX_FRAME_BACKLOG * period) {
+				clients[u].frames_skipped += (now - clients[u].next_frame) / period;
+				clients[u].next_frame += ((now - clients[u].next_frame) / period) * period;
+			}
+
+			while (clients[u].next_frame <= now) {
+				if (!queue_frame(config, clients + u)) {
+					clients[u].frames_skipped++;
+				}
+				clients[u].next_frame += period;
+			}
+			next_wakeup = (clients[u].next_frame < next_wakeup) ? clients[u].next_frame : next_wakeup;
+
+			if (ping_period && !clients[u].owner && !clients[u].ping_outstanding && now - last_ping >= ping_period) {
+				queue_ping(clients + u, now);
+			}
+
+			if (!flush_client(config, connection)) {
+				close(connection->fd);
+				connection->fd = -1;
+			}
+		}
+
+		// multiplexed slots queue to their connection, poll it once all of them are done
+		for (u = 0; u < connected; u++) {
+			fds[u].fd = clients[u].fd;
+			fds[u].events = POLLIN | (clients[u].output_bytes ? POLLOUT : 0);
+			fds[u].revents = 0;
+		}
+		if (ping_period && now - last_ping >= ping_period) {
+			last_ping = now;
+		}
+
+		now = now_ns();
+		timeout.tv_sec = (next_wakeup > now) ? (next_wakeup - now) / NSEC_PER_SEC : 0;
+		timeout.tv_nsec = (next_wakeup > now) ? (next_wakeup - now) % NSEC_PER_SEC : 0;
+		if (ppoll(fds, connected, &timeout, NULL) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			logprintf(config->log, LOG_ERROR, "poll() failed: %s\n", strerror(errno));
+			status = 3;
+			break;
+		}
+
+		for (u = 0; u < connected; u++) {
+			if (clients[u].fd >= 0 && (fds[u].revents & (POLLIN | POLLHUP | POLLERR))) {
+				if (!read_client(config, clients + u, &rtt)) {
+					close(clients[u].fd);
+					clients[u].fd = -1;
+				}
+			}
+		}
+	}
+
+	report(config, clients, connected, &handshakes, &rtt, now_ns() - start);
+
+	for (u = 0; u < connected; u++) {
+		if (clients[u].fd >= 0) {
+			uint8_t quit_msg = MESSAGE_QUIT;
+			flush_client(config, clients + u);
+			send(clients[u].fd, &quit_msg, sizeof(quit_msg), MSG_NOSIGNAL | MSG_DONTWAIT);
+			close(clients[u].fd);
+		}
+		if (clients[u].ring.shared) {
+			ring_close(&clients[u].ring);
+		}
+	}
+
+	free(handshakes.samples);
+	free(rtt.samples);
+	free(clients);
+	free(fds);
+	return status;
+}
+
+void quit() {
+	quit_signal = 1;
+}
+
+int usage(int argc, char** argv, Config* config) {
+	printf("%s usage:\n"
+			"%s [<options>]\n"
+			"    -h, --host <host>            - Specify host to connect to\n"
+			"    -p, --port <port>            - Specify InputServer port\n"
+			"    -pw,--password <pw>          - Set a connection password\n"
+			"    -n, --clients <n>            - Number of simulated clients (default %d)\n"
+			"    -P, --profile <profile>      - Device profile: mouse, keyboard or stick\n"
+			"    -r, --rate <frames>          - Frames per second and client (default depends on profile)\n"
+			"    -d, --duration <seconds>     - Streaming duration (default %d)\n"
+			"    -i, --ping-interval <ms>     - Round trip probe interval, 0 disables (default %d)\n"
+			"    -R, --ring                   - Send frames through a shared memory ring (UNIX socket only)\n"
+			"    -m, --multiplex              - Open all clients as slots on one connection\n"
+			"    -?, --help                   - Display this help text\n"
+			"    -v, --verbosity <level>      - Debug verbosity (0: ERROR to 5: DEBUG)\n"
+			, config->program_name, config->program_name, DEFAULT_CLIENTS, DEFAULT_DURATION, DEFAULT_PING_INTERVAL);
+	return -1;
+}
+
+void add_arguments(Config* config) {
+	eargs_addArgument("-?", "--help", usage, 0);
+	eargs_addArgumentString("-h", "--host", &config->host);
+	eargs_addArgumentString("-p", "--port", &config->port);
+	eargs_addArgumentString("-pw", "--password", &config->password);
+	eargs_addArgumentUInt("-n", "--clients", &config->clients);
+	eargs_addArgumentString("-P", "--profile", &config->profile_name);
+	eargs_addArgumentUInt("-r", "--rate", &config->rate);
+	eargs_addArgumentUInt("-d", "--duration", &config->duration);
+	eargs_addArgumentUInt("-i", "--ping-interval", &config->ping_interval);
+	eargs_addArgumentFlag("-R", "--ring", &config->ring);
+	eargs_addArgumentFlag("-m", "--multiplex", &config->multiplex);
+	eargs_addArgumentUInt("-v", "--verbosity", &config->log.verbosity);
+}
+
+int main(int argc, char** argv) {
+	size_t u;
+	Config config = {
+		.log = {
+			.stream = stderr,
+			.verbosity = 0
+		},
+		.program_name = argv[0],
+		.host = getenv("SERVER_HOST") ? getenv("SERVER_HOST"):DEFAULT_HOST,
+		.password = getenv("SERVER_PW") ? getenv("SERVER_PW"):DEFAULT_PASSWORD,
+		.port = getenv("SERVER_PORT") ? getenv("SERVER_PORT"):DEFAULT_PORT,
+		.profile_name = "mouse",
+		.clients = DEFAULT_CLIENTS,
+		.duration = DEFAULT_DURATION,
+		.ping_interval = DEFAULT_PING_INTERVAL
+	};
+	struct sigaction act = {
+		.sa_handler = &quit
+	};
+
+	add_arguments(&config);
+	if (eargs_parse(argc, argv, NULL, &config) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	for (u = 0; profiles[u].name; u++) {
+		if (!strcmp(profiles[u].name, config.profile_name)) {
+			config.profile = profiles + u;
+		}
+	}
+
+	if (!config.profile) {
+		logprintf(config.log, LOG_ERROR, "Unknown profile %s\n", config.profile_name);
+		return usage(argc, argv, &config) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	if (!config.rate) {
+		config.rate = config.profile->default_rate;
+	}
+
+	// the frame period is counted in nanoseconds
+	if (config.rate > NSEC_PER_SEC) {
+		logprintf(config.log, LOG_ERROR, "Rate of %u frames/s is too high\n", config.rate);
+		return EXIT_FAILURE;
+	}
+
+	if (!config.clients || config.clients > MAX_BENCH_CLIENTS || strlen(config.password) > 254) {
+		logprintf(config.log, LOG_ERROR, "Invalid client count or password\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sigaction(SIGINT, &act, NULL) < 0) {
+		logprintf(config.log, LOG_ERROR, "Failed to set signal mask\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%s, starting up\n", VERSION);
+	return run(&config);
+}
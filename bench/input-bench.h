@@ -0,0 +1,75 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "../common/protocol.h"
+#include "../common/ring.h"
+#include "../libs/logger.h"
+
+#define VERSION "InputBench 1.0"
+// maximum number of simulated clients
+#define MAX_BENCH_CLIENTS 256
+// events per generated frame, including the closing SYN_REPORT
+#define MAX_FRAME_EVENTS 8
+// pending output per simulated client
+#define BENCH_BUFFER_SIZE 4096
+// frames a client may fall behind its schedule before they are skipped
+#define MAX_FRAME_BACKLOG 64
+
+struct bench_client;
+
+typedef struct {
+	uint16_t type;
+	uint16_t code;
+	int32_t minimum;
+	int32_t maximum;
+} bench_capability;
+
+typedef struct /*_BENCH_PROFILE*/ {
+	char* name;
+	char* device_name;
+	// frames per second generated by default
+	unsigned default_rate;
+	bench_capability* capabilities;
+	// fills one frame into events, returns the number of events
+	size_t (*frame)(struct bench_client* client, struct input_event* events);
+} bench_profile;
+
+typedef struct bench_client {
+	int fd;
+	// slot opened on the connection of another client, which carries its messages in envelopes
+	struct bench_client* owner;
+	uint8_t slot;
+	uint64_t sequence;
+	uint64_t next_frame;
+	uint64_t frames_sent;
+	uint64_t events_sent;
+	uint64_t frames_skipped;
+	uint64_t handshake_ns;
+	uint32_t ping_cookie;
+	uint64_t ping_sent;
+	bool ping_outstanding;
+	uint8_t output_buffer[BENCH_BUFFER_SIZE];
+	size_t output_bytes;
+	uint8_t input_buffer[INPUT_BUFFER_SIZE];
+	size_t input_bytes;
+	// frames go through the shared memory ring once the server accepted it
+	input_ring ring;
+} bench_client;
+
+typedef struct {
+	LOGGER log;
+	char* program_name;
+	char* host;
+	char* port;
+	char* password;
+	char* profile_name;
+	bench_profile* profile;
+	unsigned clients;
+	unsigned rate;
+	unsigned duration;
+	unsigned ping_interval;
+	bool ring;
+	bool multiplex;
+} Config;
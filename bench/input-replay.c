@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../libs/logger.h"
+#include "../libs/easy_args.h"
+
+#include "../common/network.h"
+#include "../common/protocol.h"
+#include "../common/recording.h"
+#include "../server/uinput.h"
+#include "input-replay.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+volatile sig_atomic_t quit_signal = 0;
+
+typedef struct {
+	int fd;
+	gamepad_client device;
+	uint64_t events;
+	uint64_t max_lag;
+	uint64_t total_lag;
+	uint64_t batches;
+} replay_target;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static recording_header* recording_open(ReplayConfig* config, char* path, size_t* length) {
+	struct stat info;
+	recording_header* header;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		logprintf(config->log, LOG_ERROR, "Failed to open %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &info) < 0 || info.st_size < sizeof(recording_header)) {
+		logprintf(config->log, LOG_ERROR, "%s is not a recording\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	header = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		logprintf(config->log, LOG_ERROR, "Failed to map %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	if (memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic))
+			|| header->version != RECORDING_VERSION
+			|| header->header_length > info.st_size
+			|| header->header_length < recording_header_length(header->num_capabilities)) {
+		logprintf(config->log, LOG_ERROR, "%s is not a compatible recording\n", path);
+		munmap(header, info.st_size);
+		return NULL;
+	}
+
+	*length = info.st_size;
+	return header;
+}
+
+// connects to the server and sets up a device as described by the recording
+static int replay_connect(ReplayConfig* config, recording_header* header) {
+	recording_capability* caps = (recording_capability*) (header + 1);
+	size_t u, name_length = strnlen(header->name, UINPUT_MAX_NAME_SIZE - 1) + 1;
+	size_t password_length = strlen(config->password) + 1;
+	uint8_t buf[INPUT_BUFFER_SIZE];
+	uint8_t setup_end = MESSAGE_SETUP_END;
+	HelloMessage hello = {
+		.msg_type = MESSAGE_HELLO,
+		.version = PROTOCOL_VERSION,
+		.slot = 0
+	};
+	RequestEventMessage request = {
+		.msg_type = MESSAGE_REQUEST_EVENT
+	};
+	ABSInfoMessage abs = {
+		.msg_type = MESSAGE_ABSINFO
+	};
+	PasswordMessage* password;
+	DeviceMessage* device;
+	int fd = server_connect(config->host, config->port);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (!send_message(config->log, fd, &hello, sizeof(hello))
+			|| recv_reply(config->log, fd, buf, sizeof(buf), NULL, 0) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (buf[0] == MESSAGE_PASSWORD_REQUIRED) {
+		password = calloc(sizeof(PasswordMessage) + password_length, 1);
+		if (!password) {
+			close(fd);
+			return -1;
+		}
+		password->msg_type = MESSAGE_PASSWORD;
+		password->length = password_length;
+		memcpy(password->password, config->password, password_length);
+		if (!send_message(config->log, fd, password, sizeof(PasswordMessage) + password_length)
+				|| recv_reply(config->log, fd, buf, sizeof(buf), NULL, 0) < 0) {
+			free(password);
+			close(fd);
+			return -1;
+		}
+		free(password);
+	}
+
+	if (buf[0] == MESSAGE_SETUP_REQUIRED) {
+		device = calloc(sizeof(DeviceMessage) + name_length, 1);
+		if (!device) {
+			close(fd);
+			return -1;
+		}
+		device->msg_type = MESSAGE_DEVICE;
+		device->length = name_length;
+		device->id = header->id;
+		memcpy(device->name, header->name, name_length - 1);
+		if (!send_message(config->log, fd, device, sizeof(DeviceMessage) + name_length)) {
+			free(device);
+			close(fd);
+			return -1;
+		}
+		free(device);
+
+		for (u = 0; u < header->num_capabilities; u++) {
+			request.type = caps[u].type;
+			request.code = caps[u].code;
+			if (!send_message(config->log, fd, &request, sizeof(request))) {
+				close(fd);
+				return -1;
+			}
+			if (caps[u].type == EV_ABS && caps[u].code < ABS_CNT) {
+				abs.axis = caps[u].code;
+				abs.info = header->absinfo[caps[u].code];
+				if (!send_message(config->log, fd, &abs, sizeof(abs))) {
+					close(fd);
+					return -1;
+				}
+			}
+		}
+
+		if (!send_message(config->log, fd, &setup_end, sizeof(setup_end))
+				|| recv_reply(config->log, fd, buf, sizeof(buf), NULL, 0) < 0) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	if (buf[0] != MESSAGE_SUCCESS) {
+		logprintf(config->log, LOG_ERROR, "Connection failed, last message: %s\n", get_message_name(buf[0]));
+		close(fd);
+		return -1;
+	}
+
+	logprintf(config->log, LOG_INFO, "Replaying into slot %d\n", buf[1]);
+	return fd;
+}
+
+// creates a device in the local output backend as described by the recording
+static bool replay_device(ReplayConfig* config, recording_header* header, gamepad_client* device) {
+	recording_capability* caps = (recording_capability*) (header + 1);
+	size_t u;
+
+	device->fd = -1;
+	device->ev_fd = -1;
+	device->record_fd = -1;
+	device->meta.id = header->id;
+	memcpy(device->meta.absinfo, header->absinfo, sizeof(device->meta.absinfo));
+	device->meta.name = strndup(header->name, UINPUT_MAX_NAME_SIZE - 1);
+	device->meta.enabled_events = calloc(header->num_capabilities, sizeof(struct enabled_event));
+	if (!device->meta.name || (header->num_capabilities && !device->meta.enabled_events)) {
+		logprintf(config->log, LOG_ERROR, "Failed to allocate memory\n");
+		return false;
+	}
+
+	for (u = 0; u < header->num_capabilities; u++) {
+		device->meta.enabled_events[u].type = caps[u].type;
+		device->meta.enabled_events[u].code = caps[u].code;
+	}
+	device->meta.enabled_events_length = header->num_capabilities;
+
+	return create_device(config->log, device, &device->meta, 0);
+}
+
+static bool replay_batch(ReplayConfig* config, replay_target* target, recording_event* events, size_t count) {
+	DataMessage data[REPLAY_BATCH];
+	struct input_event input[REPLAY_BATCH];
+	size_t u;
+
+	target->events += count;
+	if (target->fd >= 0) {
+		for (u = 0; u < count; u++) {
+			data[u].msg_type = MESSAGE_DATA;
+			data[u].type = htobe16(events[u].type);
+			data[u].code = htobe16(events[u].code);
+			data[u].value = htobe32(events[u].value);
+		}
+		return send_message(config->log, target->fd, data, count * sizeof(DataMessage));
+	}
+
+	memset(input, 0, count * sizeof(struct input_event));
+	for (u = 0; u < count; u++) {
+		input[u].type = events[u].type;
+		input[u].code = events[u].code;
+		input[u].value = events[u].value;
+	}
+	return write_events(config->log, &target->device, input, count, 0);
+}
+
+/**
+ * Plays back all events at their recorded time, each frame (up to and including
+ * the closing EV_SYN) is sent as one batch.
+ */
+static bool replay(ReplayConfig* config, replay_target* target, recording_event* events, size_t count) {
+	uint64_t start = now_ns(), due, now;
+	struct timespec deadline;
+	size_t u, batch;
+
+	for (u = 0; u < count && !quit_signal; u += batch) {
+		for (batch = 1; u + batch < count && batch < REPLAY_BATCH && events[u + batch - 1].type != EV_SYN; batch++) {
+		}
+
+		if (config->speed_factor > 0) {
+			due = start + (uint64_t) ((events[u].time - events[0].time) / config->speed_factor);
+			deadline.tv_sec = due / NSEC_PER_SEC;
+			deadline.tv_nsec = due % NSEC_PER_SEC;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && !quit_signal) {
+			}
+
+			now = now_ns();
+			if (now > due) {
+				target->total_lag += now - due;
+				target->max_lag = (now - due > target->max_lag) ? now - due : target->max_lag;
+			}
+		}
+
+		if (!replay_batch(config, target, events + u, batch)) {
+			return false;
+		}
+		target->batches++;
+	}
+	return true;
+}
+
+void quit() {
+	quit_signal = 1;
+}
+
+int usage(int argc, char** argv, ReplayConfig* config) {
+	printf("%s usage:\n"
+			"%s [<options>] <recording>\n"
+			"    -h, --host <host>        - Specify host to connect to\n"
+			"    -p, --port <port>        - Specify InputServer port\n"
+			"    -pw,--password <pw>      - Set a connection password\n"
+			"    -o, --output <backend>   - Replay into a local output backend (uinput, null, file:<path>) instead of a server\n"
+			"    -s, --speed <factor>     - Playback speed, 0 replays as fast as possible (default 1)\n"
+			"    -l, --loop <n>           - Replay the recording n times (default 1)\n"
+			"    -?, --help               - Display this help text\n"
+			"    -v, --verbosity <level>  - Debug verbosity (0: ERROR to 5: DEBUG)\n"
+			, config->program_name, config->program_name);
+	return -1;
+}
+
+int set_output(int argc, char** argv, ReplayConfig* config) {
+	if (!output_select(config->log, argv[1])) {
+		return -1;
+	}
+	config->output = argv[1];
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	ReplayConfig config = {
+		.log = {
+			.stream = stderr,
+			.verbosity = 0
+		},
+		.program_name = argv[0],
+		.host = getenv("SERVER_HOST") ? getenv("SERVER_HOST"):DEFAULT_HOST,
+		.password = getenv("SERVER_PW") ? getenv("SERVER_PW"):DEFAULT_PASSWORD,
+		.port = getenv("SERVER_PORT") ? getenv("SERVER_PORT"):DEFAULT_PORT,
+		.speed = "1",
+		.loops = 1
+	};
+	replay_target target = {
+		.fd = -1
+	};
+	struct sigaction act = {
+		.sa_handler = &quit
+	};
+	char* output[argc];
+	recording_header* header;
+	recording_event* events;
+	size_t length, count;
+	uint64_t start, elapsed;
+	unsigned loop;
+	int status = EXIT_SUCCESS;
+
+	eargs_addArgument("-?", "--help", usage, 0);
+	eargs_addArgumentString("-h", "--host", &config.host);
+	eargs_addArgumentString("-p", "--port", &config.port);
+	eargs_addArgumentString("-pw", "--password", &config.password);
+	eargs_addArgument("-o", "--output", set_output, 1);
+	eargs_addArgumentString("-s", "--speed", &config.speed);
+	eargs_addArgumentUInt("-l", "--loop", &config.loops);
+	eargs_addArgumentUInt("-v", "--verbosity", &config.log.verbosity);
+
+	if (eargs_parse(argc, argv, output, &config) != 1) {
+		usage(argc, argv, &config);
+		return EXIT_FAILURE;
+	}
+
+	config.speed_factor = strtod(config.speed, NULL);
+	if (config.speed_factor < 0 || strlen(config.password) > 254) {
+		logprintf(config.log, LOG_ERROR, "Invalid speed or password\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sigaction(SIGINT, &act, NULL) < 0) {
+		logprintf(config.log, LOG_ERROR, "Failed to set signal mask\n");
+		return EXIT_FAILURE;
+	}
+
+	header = recording_open(&config, output[0], &length);
+	if (!header) {
+		return EXIT_FAILURE;
+	}
+	events = (recording_event*) ((uint8_t*) header + header->header_length);
+	count = (length - header->header_length) / sizeof(recording_event);
+	printf("%s, replaying %zu events of %.*s\n", REPLAY_VERSION, count, UINPUT_MAX_NAME_SIZE, header->name);
+
+	if (config.output) {
+		if (!replay_device(&config, header, &target.device)) {
+			munmap(header, length);
+			return EXIT_FAILURE;
+		}
+	} else {
+		target.fd = replay_connect(&config, header);
+		if (target.fd < 0) {
+			munmap(header, length);
+			return EXIT_FAILURE;
+		}
+	}
+
+	start = now_ns();
+	for (loop = 0; loop < config.loops && !quit_signal; loop++) {
+		if (!replay(&config, &target, events, count)) {
+			status = EXIT_FAILURE;
+			break;
+		}
+	}
+	elapsed = now_ns() - start;
+
+	printf("Replayed %llu events in %llu batches, %.3f s, %.0f events/s\n",
+			(unsigned long long) target.events, (unsigned long long) target.batches,
+			elapsed / (double) NSEC_PER_SEC, target.events / (elapsed / (double) NSEC_PER_SEC));
+	if (config.speed_factor > 0) {
+		printf("Schedule lag: avg %.1f us, max %.1f us\n",
+				target.batches ? target.total_lag / (double) target.batches / 1000.0 : 0,
+				target.max_lag / 1000.0);
+	}
+
+	if (target.fd >= 0) {
+		uint8_t quit_msg = MESSAGE_QUIT;
+		send_message(config.log, target.fd, &quit_msg, sizeof(quit_msg));
+		close(target.fd);
+	} else {
+		cleanup_device(config.log, &target.device);
+	}
+	munmap(header, length);
+	return status;
+}
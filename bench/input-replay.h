@@ -0,0 +1,20 @@
+#pragma once
+#include <stdbool.h>
+
+#include "../libs/logger.h"
+
+#define REPLAY_VERSION "InputReplay 1.0"
+// maximum number of events sent as one batch
+#define REPLAY_BATCH 64
+
+typedef struct {
+	LOGGER log;
+	char* program_name;
+	char* host;
+	char* port;
+	char* password;
+	char* output;
+	char* speed;
+	double speed_factor;
+	unsigned loops;
+} ReplayConfig;
@@ -0,0 +1,414 @@
+/*
+ * Micro benchmarks for the hot paths of the server. The server is compiled
+ * into this program so its internal functions can be driven directly.
+ */
+#define main input_server_main
+#include "../server/input-server.c"
+#undef main
+
+#include <time.h>
+#include <endian.h>
+
+#include "microbench.h"
+
+static Config server;
+static gamepad_client client;
+static uint8_t messages[INPUT_BUFFER_SIZE];
+static size_t message_offsets[MICROBENCH_EVENTS];
+static size_t message_count;
+static uint8_t data_stream[INPUT_BUFFER_SIZE];
+static size_t data_stream_length;
+static struct input_event events[MICROBENCH_EVENTS];
+static DataMessage data_messages[MICROBENCH_EVENTS];
+static uint16_t lookups[MICROBENCH_LOOKUPS][2];
+static remap_table* remap;
+static remap_rule remap_rules[] = {
+	{.type = EV_REL, .code = REL_X, .target_type = EV_REL, .target_code = REL_X, .scale = 2.0, .curve = 1.5},
+	{.type = EV_REL, .code = REL_Y, .target_type = EV_REL, .target_code = REL_WHEEL, .invert = true, .scale = 1.0, .curve = 1.0}
+};
+static remap_profile remap_profiles[] = {
+	{.slot = -1, .rules = remap_rules, .num_rules = sizeof(remap_rules) / sizeof(remap_rule)}
+};
+
+// results are accumulated here so the compiler can not drop the measured work
+static volatile uint64_t sink;
+
+static uint64_t clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t bench_message_size(uint64_t n) {
+	uint64_t u, total = 0;
+	size_t m;
+
+	for (u = 0; u < n; u++) {
+		for (m = 0; m < message_count; m++) {
+			total += get_size_from_command(messages + message_offsets[m], sizeof(messages) - message_offsets[m]);
+		}
+	}
+	sink = total;
+	return n * message_count;
+}
+
+static uint64_t bench_dispatch(uint64_t n) {
+	uint64_t u;
+
+	for (u = 0; u < n; u++) {
+		memcpy(client.input_buffer, data_stream, data_stream_length);
+		client.scan_offset = 0;
+		client.bytes_available = data_stream_length;
+		while (client.bytes_available > 0) {
+			if (!client_data(&server, &client, 0)) {
+				fprintf(stderr, "Dispatch benchmark failed\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	return n * (data_stream_length / sizeof(DataMessage));
+}
+
+static uint64_t bench_data_encode(uint64_t n) {
+	uint64_t u;
+	size_t e;
+
+	for (u = 0; u < n; u++) {
+		for (e = 0; e < MICROBENCH_EVENTS; e++) {
+			data_messages[e].msg_type = MESSAGE_DATA;
+			data_messages[e].type = htobe16(events[e].type);
+			data_messages[e].code = htobe16(events[e].code);
+			data_messages[e].value = htobe32(events[e].value);
+		}
+		sink += data_messages[u % MICROBENCH_EVENTS].value;
+	}
+	return n * MICROBENCH_EVENTS;
+}
+
+static uint64_t bench_data_decode(uint64_t n) {
+	uint64_t u;
+	size_t e;
+
+	for (u = 0; u < n; u++) {
+		for (e = 0; e < MICROBENCH_EVENTS; e++) {
+			events[e].type = be16toh(data_messages[e].type);
+			events[e].code = be16toh(data_messages[e].code);
+			events[e].value = be32toh(data_messages[e].value);
+		}
+		sink += events[u % MICROBENCH_EVENTS].value;
+	}
+	return n * MICROBENCH_EVENTS;
+}
+
+static uint64_t bench_data_decode_batch(uint64_t n) {
+	struct input_event decoded[DATA_BATCH_EVENTS];
+	uint64_t u, count = 0;
+
+	for (u = 0; u < n; u++) {
+		count += decode_data_messages(data_stream, data_stream_length, decoded, DATA_BATCH_EVENTS);
+		sink += decoded[u % DATA_BATCH_EVENTS].value;
+	}
+	return count;
+}
+
+static uint64_t bench_acl_lookup(uint64_t n) {
+	uint64_t u, allowed = 0;
+	size_t l;
+
+	for (u = 0; u < n; u++) {
+		for (l = 0; l < MICROBENCH_LOOKUPS; l++) {
+			allowed += acl_allowed(server.acl_active, lookups[l][0], lookups[l][1]);
+		}
+	}
+	sink = allowed;
+	return n * MICROBENCH_LOOKUPS;
+}
+
+static uint64_t bench_event_map(uint64_t n) {
+	struct input_event event = {
+		.time = {0}
+	};
+	uint64_t u, allowed = 0;
+	size_t l;
+
+	for (u = 0; u < n; u++) {
+		for (l = 0; l < MICROBENCH_LOOKUPS; l++) {
+			event.type = lookups[l][0];
+			event.code = lookups[l][1];
+			allowed += client_event_allowed(&client, &event);
+		}
+	}
+	sink = allowed;
+	return n * MICROBENCH_LOOKUPS;
+}
+
+static uint64_t bench_remap_apply(uint64_t n) {
+	struct input_event remapped[MICROBENCH_EVENTS];
+	uint64_t u;
+	size_t e;
+
+	for (u = 0; u < n; u++) {
+		memcpy(remapped, events, sizeof(remapped));
+		for (e = 0; e < MICROBENCH_EVENTS; e++) {
+			remap_event(remap, remapped + e);
+		}
+		sink += remapped[u % MICROBENCH_EVENTS].value;
+	}
+	return n * MICROBENCH_EVENTS;
+}
+
+static uint64_t bench_log_disabled(uint64_t n) {
+	uint64_t u;
+
+	for (u = 0; u < n; u++) {
+		logprintf(server.log, LOG_DEBUG, "[%d] Type: 0x%.2x Code: 0x%.2x Value: 0x%.2x\n",
+				0, events[u % MICROBENCH_EVENTS].type, events[u % MICROBENCH_EVENTS].code, events[u % MICROBENCH_EVENTS].value);
+	}
+	return n;
+}
+
+static micro_benchmark benchmarks[] = {
+	{"message_size", "get_size_from_command() over a mix of message types", bench_message_size},
+	{"dispatch_data", "client_data() over a buffer of DATA messages (null output)", bench_dispatch},
+	{"data_encode", "input_event to DataMessage including byte swapping", bench_data_encode},
+	{"data_decode", "DataMessage to input_event including byte swapping", bench_data_decode},
+	{"data_decode_batch", "decode_data_messages() over a buffer of DATA messages", bench_data_decode_batch},
+	{"acl_lookup", "compiled ACL table lookups with pseudo-random type/code pairs", bench_acl_lookup},
+	{"event_map", "per-slot event bitmap checks on the DATA path", bench_event_map},
+	{"remap_apply", "compiled remapping profile (scale, curve, invert) on the DATA path", bench_remap_apply},
+	{"log_disabled", "logprintf() below the configured verbosity", bench_log_disabled},
+	{NULL}
+};
+
+static size_t append_message(uint8_t* buffer, size_t offset, void* message, size_t length) {
+	if (offset + length <= INPUT_BUFFER_SIZE) {
+		memcpy(buffer + offset, message, length);
+	}
+	return offset + length;
+}
+
+static bool setup(MicroConfig* config) {
+	DataMessage data = {
+		.msg_type = MESSAGE_DATA
+	};
+	PingMessage ping = {
+		.msg_type = MESSAGE_PING
+	};
+	RequestEventMessage request = {
+		.msg_type = MESSAGE_REQUEST_EVENT,
+		.type = EV_KEY,
+		.code = BTN_LEFT
+	};
+	uint8_t password[sizeof(PasswordMessage) + 7] = {MESSAGE_PASSWORD, 7, 'f', 'o', 'o', 'b', 'a', 'r', 0};
+	uint32_t random = 0x2545F491;
+	size_t u, offset = 0;
+
+	server.log.stream = stderr;
+	server.log.verbosity = config->verbosity;
+	server.acl_active = acl_compile(server.log, &server.acl);
+	if (!server.acl_active) {
+		return false;
+	}
+	// a few holes so the lookups are not entirely uniform
+	memset(server.acl_active->allowed[EV_KEY], 0, BTN_MISC / 8);
+
+	for (u = 0; u < MICROBENCH_EVENTS; u++) {
+		switch (u % 3) {
+			case 0:
+				events[u].type = EV_REL;
+				events[u].code = REL_X;
+				break;
+			case 1:
+				events[u].type = EV_REL;
+				events[u].code = REL_Y;
+				break;
+			default:
+				events[u].type = EV_SYN;
+				events[u].code = SYN_REPORT;
+				break;
+		}
+		events[u].value = (events[u].type == EV_SYN) ? 0 : (int32_t) (u * 7) - 64;
+	}
+
+	for (u = 0; u < MICROBENCH_LOOKUPS; u++) {
+		random = random * 1103515245 + 12345;
+		lookups[u][0] = (random >> 16) % EV_MAX;
+		random = random * 1103515245 + 12345;
+		lookups[u][1] = (random >> 16) % KEY_MAX;
+	}
+
+	// mixed message stream, mostly DATA as in a running session
+	for (u = 0; u < MICROBENCH_EVENTS && offset < INPUT_BUFFER_SIZE - sizeof(password); u++) {
+		message_offsets[message_count++] = offset;
+		switch (u % 8) {
+			case 5:
+				offset = append_message(messages, offset, &ping, sizeof(ping));
+				break;
+			case 6:
+				offset = append_message(messages, offset, &request, sizeof(request));
+				break;
+			case 7:
+				offset = append_message(messages, offset, password, sizeof(password));
+				break;
+			default:
+				offset = append_message(messages, offset, &data, sizeof(data));
+				break;
+		}
+	}
+
+	for (u = 0; (u + 1) * sizeof(DataMessage) <= INPUT_BUFFER_SIZE; u++) {
+		data.type = htobe16(events[u % MICROBENCH_EVENTS].type);
+		data.code = htobe16(events[u % MICROBENCH_EVENTS].code);
+		data.value = htobe32(events[u % MICROBENCH_EVENTS].value);
+		data_stream_length = append_message(data_stream, data_stream_length, &data, sizeof(data));
+	}
+
+	init_client(&client);
+	client.fd = -1;
+	client.status = MESSAGE_SUCCESS;
+	client.meta.name = strdup("MicroBench device");
+	client.meta.enabled_events = calloc(2, sizeof(struct enabled_event));
+	if (!client.meta.name || !client.meta.enabled_events || !output_select(server.log, "null")
+			|| !create_device(server.log, &client, &client.meta, 0)) {
+		return false;
+	}
+	client.meta.enabled_events[0].type = EV_REL;
+	client.meta.enabled_events[0].code = REL_X;
+	client.meta.enabled_events[1].type = EV_REL;
+	client.meta.enabled_events[1].code = REL_Y;
+	client.meta.enabled_events_length = 2;
+	client_event_map(&client, server.acl_active);
+
+	struct device_meta remapped = {
+		0
+	};
+	server.remap.profiles = remap_profiles;
+	server.remap.num_profiles = sizeof(remap_profiles) / sizeof(remap_profile);
+	remap = remap_compile(server.log, &server.remap, &client.meta, 0, &remapped);
+	free(remapped.enabled_events);
+	return remap != NULL;
+}
+
+static int compare_double(const void* a, const void* b) {
+	double x = *(double*) a, y = *(double*) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Calibrates the iteration count so a single run takes at least MICROBENCH_MIN_RUNTIME,
+ * then measures config->repeats runs and reports the best and the median time per operation.
+ */
+static void measure(MicroConfig* config, micro_benchmark* benchmark, micro_result* result) {
+	uint64_t n = 1, start, elapsed, operations = 0;
+	double samples[config->repeats];
+	unsigned u;
+
+	for (;;) {
+		start = clock_ns();
+		operations = benchmark->run(n);
+		elapsed = clock_ns() - start;
+		if (elapsed >= MICROBENCH_MIN_RUNTIME || n >= (1ULL << 40)) {
+			break;
+		}
+		n *= (elapsed < MICROBENCH_MIN_RUNTIME / 16) ? 8 : 2;
+	}
+
+	for (u = 0; u < config->repeats; u++) {
+		start = clock_ns();
+		operations = benchmark->run(n);
+		elapsed = clock_ns() - start;
+		samples[u] = (double) elapsed / operations;
+	}
+
+	qsort(samples, config->repeats, sizeof(double), compare_double);
+	result->benchmark = benchmark;
+	result->operations = operations;
+	result->ns_best = samples[0];
+	result->ns_median = samples[config->repeats / 2];
+}
+
+static bool write_json(MicroConfig* config, micro_result* results, size_t count) {
+	FILE* output = stdout;
+	size_t u;
+
+	if (strcmp(config->json, "-")) {
+		output = fopen(config->json, "w");
+		if (!output) {
+			fprintf(stderr, "Failed to open %s: %s\n", config->json, strerror(errno));
+			return false;
+		}
+	}
+
+	fprintf(output, "{\n\t\"version\": \"%s\",\n\t\"repeats\": %u,\n\t\"benchmarks\": [\n", MICROBENCH_VERSION, config->repeats);
+	for (u = 0; u < count; u++) {
+		fprintf(output, "\t\t{\"name\": \"%s\", \"operations\": %llu, \"ns_per_op\": %.3f, \"ns_per_op_median\": %.3f}%s\n",
+				results[u].benchmark->name, (unsigned long long) results[u].operations,
+				results[u].ns_best, results[u].ns_median, (u + 1 < count) ? "," : "");
+	}
+	fprintf(output, "\t]\n}\n");
+
+	if (output != stdout) {
+		fclose(output);
+	}
+	return true;
+}
+
+int micro_usage(int argc, char** argv, MicroConfig* config) {
+	printf("%s usage:\n"
+			"microbench [<options>]\n"
+			"    -j, --json <file>        - Write the results as JSON to a file (- for stdout)\n"
+			"    -f, --filter <name>      - Only run benchmarks whose name contains the given string\n"
+			"    -r, --repeat <n>         - Measured runs per benchmark (default: %d)\n"
+			"    -?, --help               - Display this help text\n"
+			"    -v, --verbosity <level>  - Server log verbosity during the benchmarks (default: 0)\n"
+			, MICROBENCH_VERSION, MICROBENCH_DEFAULT_REPEATS);
+	return -1;
+}
+
+int main(int argc, char** argv) {
+	MicroConfig config = {
+		.repeats = MICROBENCH_DEFAULT_REPEATS
+	};
+	micro_result results[sizeof(benchmarks) / sizeof(micro_benchmark)];
+	char* output[argc];
+	size_t u, count = 0;
+
+	eargs_addArgument("-?", "--help", micro_usage, 0);
+	eargs_addArgumentString("-j", "--json", &config.json);
+	eargs_addArgumentString("-f", "--filter", &config.filter);
+	eargs_addArgumentUInt("-r", "--repeat", &config.repeats);
+	eargs_addArgumentUInt("-v", "--verbosity", &config.verbosity);
+
+	if (eargs_parse(argc, argv, output, &config) < 0) {
+		return EXIT_FAILURE;
+	}
+	if (!config.repeats) {
+		config.repeats = 1;
+	}
+
+	if (!setup(&config)) {
+		fprintf(stderr, "Failed to set up the benchmarks\n");
+		return EXIT_FAILURE;
+	}
+
+	// with JSON on stdout, the table goes to stderr
+	FILE* table = (config.json && !strcmp(config.json, "-")) ? stderr : stdout;
+	fprintf(table, "%-16s %12s %12s  %s\n", "benchmark", "ns/op", "median", "description");
+	for (u = 0; benchmarks[u].name; u++) {
+		if (config.filter && !strstr(benchmarks[u].name, config.filter)) {
+			continue;
+		}
+		measure(&config, benchmarks + u, results + count);
+		fprintf(table, "%-16s %12.3f %12.3f  %s\n", benchmarks[u].name,
+				results[count].ns_best, results[count].ns_median, benchmarks[u].description);
+		count++;
+	}
+
+	cleanup_device(server.log, &client);
+	remap_free(remap);
+
+	if (config.json && !write_json(&config, results, count)) {
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
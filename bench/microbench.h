@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MICROBENCH_VERSION "MicroBench 1.0"
+// a measurement is repeated until a single run takes at least this long
+#define MICROBENCH_MIN_RUNTIME 50000000ULL
+#define MICROBENCH_DEFAULT_REPEATS 5
+// synthetic messages and events per benchmark iteration
+#define MICROBENCH_EVENTS 128
+// pseudo-random lookups in the ACL benchmark
+#define MICROBENCH_LOOKUPS 4096
+
+typedef struct {
+	char* json;
+	char* filter;
+	unsigned repeats;
+	unsigned verbosity;
+} MicroConfig;
+
+typedef struct /*_MICRO_BENCHMARK*/ {
+	char* name;
+	char* description;
+	// runs the benchmark n times, returns the number of operations performed
+	uint64_t (*run)(uint64_t n);
+} micro_benchmark;
+
+typedef struct {
+	micro_benchmark* benchmark;
+	uint64_t operations;
+	double ns_best;
+	double ns_median;
+} micro_result;
@@ -0,0 +1,94 @@
+#include "coalesce.h"
+
+// writes the summed motion, optionally followed by the other events of the buffered frame, and a SYN_REPORT
+static size_t coalesce_emit(coalesce_state* state, uint64_t now, struct input_event* out, bool frame) {
+	size_t u, count = 0;
+
+	for (u = 0; state->rel_mask; u++) {
+		if (state->rel_mask & (1U << u)) {
+			out[count].type = EV_REL;
+			out[count].code = u;
+			out[count++].value = state->rel[u];
+			state->rel[u] = 0;
+			state->rel_mask &= ~(1U << u);
+		}
+	}
+
+	for (u = 0; frame && u < state->frame_length; u++) {
+		if (state->frame[u].type != EV_REL) {
+			out[count++] = state->frame[u];
+		}
+	}
+	state->frame_length = 0;
+
+	out[count].type = EV_SYN;
+	out[count].code = SYN_REPORT;
+	out[count++].value = 0;
+
+	state->pending = false;
+	state->last_sent = now;
+	state->frames_out++;
+	return count;
+}
+
+static void coalesce_add_motion(coalesce_state* state) {
+	size_t u;
+
+	for (u = 0; u < state->frame_length; u++) {
+		if (state->frame[u].type == EV_REL && state->frame[u].code < REL_CNT) {
+			state->rel[state->frame[u].code] += state->frame[u].value;
+			state->rel_mask |= 1U << state->frame[u].code;
+		}
+	}
+}
+
+/**
+ * Buffers an event read from the device. Returns the number of events to be sent now,
+ * which are stored in out (COALESCE_OUTPUT_MAX entries).
+ */
+size_t coalesce_event(coalesce_state* state, struct input_event* event, uint64_t now, struct input_event* out) {
+	bool motion = true;
+	size_t u;
+
+	if (event->type != EV_SYN || event->code != SYN_REPORT) {
+		state->frame[state->frame_length++] = *event;
+		if (state->frame_length == COALESCE_FRAME_MAX) {
+			//overlong frame, sent in parts
+			coalesce_add_motion(state);
+			return coalesce_emit(state, now, out, true);
+		}
+		return 0;
+	}
+
+	state->frames_in++;
+	for (u = 0; u < state->frame_length; u++) {
+		if (state->frame[u].type != EV_REL || state->frame[u].code >= REL_CNT) {
+			motion = false;
+		}
+	}
+
+	coalesce_add_motion(state);
+	if (!motion || (!state->pending && now - state->last_sent >= state->window)) {
+		return coalesce_emit(state, now, out, true);
+	}
+
+	state->frame_length = 0;
+	state->pending = true;
+	return 0;
+}
+
+// sends the summed motion once the window has passed
+size_t coalesce_flush(coalesce_state* state, uint64_t now, struct input_event* out) {
+	if (!state->pending) {
+		return 0;
+	}
+	return coalesce_emit(state, now, out, false);
+}
+
+// returns the nanoseconds until pending motion has to be sent, -1 if nothing is pending
+int64_t coalesce_timeout(coalesce_state* state, uint64_t now) {
+	if (!state->pending) {
+		return -1;
+	}
+	return (now - state->last_sent >= state->window) ? 0 : state->last_sent + state->window - now;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+// events buffered per frame, longer frames are sent in parts
+#define COALESCE_FRAME_MAX 64
+// upper bound of events returned by one call
+#define COALESCE_OUTPUT_MAX (REL_CNT + COALESCE_FRAME_MAX + 1)
+
+/*
+ * Sums the deltas of motion-only frames (REL events and SYN_REPORT) arriving within
+ * the window after the last frame sent. A frame arriving after an idle window is sent
+ * right away, so single movements are not delayed. Frames with any other event flush
+ * the summed motion together with their own events, so button transitions keep their
+ * order and are never merged.
+ */
+typedef struct {
+	// window in nanoseconds, 0 disables coalescing
+	uint64_t window;
+	uint64_t last_sent;
+	bool pending;
+	uint32_t rel_mask;
+	int32_t rel[REL_CNT];
+	size_t frame_length;
+	struct input_event frame[COALESCE_FRAME_MAX];
+	uint64_t frames_in;
+	uint64_t frames_out;
+} coalesce_state;
+
+size_t coalesce_event(coalesce_state* state, struct input_event* event, uint64_t now, struct input_event* out);
+size_t coalesce_flush(coalesce_state* state, uint64_t now, struct input_event* out);
+int64_t coalesce_timeout(coalesce_state* state, uint64_t now);
@@ -0,0 +1,122 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/ioctl.h>
+
+#include "../libs/logger.h"
+#include "feedback.h"
+
+void feedback_init(feedback_state* state) {
+	size_t u;
+
+	memset(state, 0, sizeof(feedback_state));
+	for (u = 0; u < FF_EFFECTS_MAX; u++) {
+		state->local[u] = -1;
+	}
+}
+
+static bool feedback_upload(LOGGER log, feedback_state* state, int device_fd, int16_t id) {
+	struct ff_effect effect = state->effects[id];
+
+	effect.id = state->local[id];
+	if (ioctl(device_fd, EVIOCSFF, &effect) < 0) {
+		logprintf(log, LOG_WARNING, "Failed to upload force feedback effect %d: %s\n", id, strerror(errno));
+		state->failed++;
+		return false;
+	}
+	state->local[id] = effect.id;
+	return true;
+}
+
+// uploads all effects again, effects are bound to the descriptor they were uploaded with
+void feedback_reopen(LOGGER log, feedback_state* state, int device_fd) {
+	int16_t u;
+
+	for (u = 0; u < FF_EFFECTS_MAX; u++) {
+		state->local[u] = -1;
+		if (state->known[u]) {
+			feedback_upload(log, state, device_fd, u);
+		}
+	}
+}
+
+static void feedback_write(LOGGER log, feedback_state* state, int device_fd, struct input_event* event) {
+	if (event->type == EV_FF && event->code < FF_EFFECTS_MAX) {
+		if (state->local[event->code] < 0) {
+			logprintf(log, LOG_WARNING, "Playback of unknown force feedback effect %d\n", event->code);
+			state->failed++;
+			return;
+		}
+		event->code = state->local[event->code];
+	}
+
+	if (write(device_fd, event, sizeof(struct input_event)) < 0) {
+		logprintf(log, LOG_WARNING, "Failed to write feedback to the device: %s\n", strerror(errno));
+		state->failed++;
+	}
+}
+
+/**
+ * Applies the complete feedback messages in buf to the device.
+ * Returns the number of bytes used or -1 on an unexpected message.
+ */
+ssize_t feedback_handle(LOGGER log, feedback_state* state, int device_fd, uint8_t* buf, size_t len) {
+	struct input_event event = {
+		.time = {0}
+	};
+	FeedbackMessage* feedback;
+	FFUploadMessage* upload;
+	int16_t id;
+	size_t offset = 0;
+	int bytes;
+
+	while (offset < len) {
+		bytes = get_size_from_command(buf + offset, len - offset);
+		if (bytes < 0) {
+			logprintf(log, LOG_ERROR, "Unexpected message 0x%.2x from server\n", buf[offset]);
+			return -1;
+		}
+		if (!bytes || bytes > len - offset) {
+			break;
+		}
+
+		switch (buf[offset]) {
+			case MESSAGE_FEEDBACK:
+				feedback = (FeedbackMessage*) (buf + offset);
+				event.type = be16toh(feedback->type);
+				event.code = be16toh(feedback->code);
+				event.value = be32toh(feedback->value);
+				feedback_write(log, state, device_fd, &event);
+				break;
+			case MESSAGE_FF_UPLOAD:
+				upload = (FFUploadMessage*) (buf + offset);
+				id = be16toh(upload->id);
+				if (id < 0 || id >= FF_EFFECTS_MAX) {
+					logprintf(log, LOG_WARNING, "Force feedback effect id %d out of range\n", id);
+					break;
+				}
+				decode_ff_effect(upload, state->effects + id);
+				state->known[id] = true;
+				feedback_upload(log, state, device_fd, id);
+				break;
+			case MESSAGE_FF_ERASE:
+				id = be16toh(((FFEraseMessage*) (buf + offset))->id);
+				if (id >= 0 && id < FF_EFFECTS_MAX) {
+					if (state->local[id] >= 0 && ioctl(device_fd, EVIOCRMFF, state->local[id]) < 0) {
+						logprintf(log, LOG_WARNING, "Failed to erase force feedback effect %d: %s\n", id, strerror(errno));
+					}
+					state->local[id] = -1;
+					state->known[id] = false;
+				}
+				break;
+			default:
+				logprintf(log, LOG_DEBUG, "Ignoring %s message from server\n", get_message_name(buf[offset]));
+				break;
+		}
+
+		state->received++;
+		offset += bytes;
+	}
+	return offset;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/input.h>
+
+#include "../libs/logger.h"
+#include "../common/protocol.h"
+
+/*
+ * Force feedback effects uploaded on the server are replayed on the local device.
+ * Effects are kept, so they can be uploaded again when the device is reopened.
+ */
+typedef struct {
+	// local effect id per effect id of the server, -1 if not uploaded
+	int16_t local[FF_EFFECTS_MAX];
+	bool known[FF_EFFECTS_MAX];
+	struct ff_effect effects[FF_EFFECTS_MAX];
+	uint64_t received;
+	uint64_t failed;
+} feedback_state;
+
+void feedback_init(feedback_state* state);
+void feedback_reopen(LOGGER log, feedback_state* state, int device_fd);
+ssize_t feedback_handle(LOGGER log, feedback_state* state, int device_fd, uint8_t* buf, size_t len);
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+
+#include "../libs/logger.h"
+#include "filter.h"
+
+static struct {
+	char* name;
+	int type;
+} type_names[] = {
+	{"EV_SYN", EV_SYN},
+	{"EV_KEY", EV_KEY},
+	{"EV_REL", EV_REL},
+	{"EV_ABS", EV_ABS},
+	{"EV_MSC", EV_MSC},
+	{"EV_SW", EV_SW},
+	{"EV_LED", EV_LED},
+	{"EV_SND", EV_SND},
+	{"EV_REP", EV_REP},
+	{"EV_FF", EV_FF},
+	{NULL, 0}
+};
+
+// drops axis changes within the threshold (or the axis fuzz) of the last value sent,
+// values within the flat zone of the axis are sent as its center
+static bool filter_deadband(filter_chain* chain, filter_stage* stage, struct input_event* event) {
+	struct input_absinfo* info;
+	int64_t center, threshold;
+
+	if (event->type != EV_ABS || event->code >= ABS_CNT) {
+		return true;
+	}
+
+	info = chain->absinfo + event->code;
+	if (info->flat && info->maximum > info->minimum) {
+		center = info->minimum + ((int64_t) info->maximum - info->minimum) / 2;
+		if (llabs(event->value - center) <= info->flat) {
+			event->value = center;
+		}
+	}
+
+	if (!chain->known[event->code]) {
+		return true;
+	}
+
+	threshold = (stage->threshold >= 0) ? stage->threshold : info->fuzz;
+	return llabs((int64_t) event->value - chain->last[event->code]) > threshold;
+}
+
+// drops key auto-repeat, the device on the server generates its own
+static bool filter_repeat(filter_chain* chain, filter_stage* stage, struct input_event* event) {
+	return event->type != EV_KEY || event->value != 2;
+}
+
+static bool filter_drop(filter_chain* chain, filter_stage* stage, struct input_event* event) {
+	return event->type != stage->type || (!stage->all_codes && event->code != stage->code);
+}
+
+// rounds axis values to multiples of the step above the axis minimum, dropping unchanged values
+static bool filter_quantize(filter_chain* chain, filter_stage* stage, struct input_event* event) {
+	struct input_absinfo* info;
+	int64_t steps;
+
+	if (event->type != EV_ABS || event->code >= ABS_CNT || (!stage->all_codes && event->code != stage->code)) {
+		return true;
+	}
+
+	info = chain->absinfo + event->code;
+	steps = ((int64_t) event->value - info->minimum + stage->threshold / 2) / stage->threshold;
+	event->value = info->minimum + steps * stage->threshold;
+	if (info->maximum > info->minimum && event->value > info->maximum) {
+		event->value = info->maximum;
+	}
+
+	return !chain->known[event->code] || event->value != chain->last[event->code];
+}
+
+static filter_stage filter_types[] = {
+	{"deadband", filter_deadband},
+	{"repeat", filter_repeat},
+	{"drop", filter_drop},
+	{"quantize", filter_quantize},
+	{NULL}
+};
+
+static bool filter_type(char* name, int* type) {
+	size_t u;
+	char* end;
+
+	for (u = 0; type_names[u].name; u++) {
+		if (!strcasecmp(type_names[u].name, name) || !strcasecmp(type_names[u].name + 3, name)) {
+			*type = type_names[u].type;
+			return true;
+		}
+	}
+
+	*type = strtol(name, &end, 0);
+	return *name && !*end && *type > EV_SYN && *type < EV_CNT;
+}
+
+/**
+ * Appends a stage given as <name>[:<parameter>...] to the chain:
+ *   deadband[:<threshold>], repeat, drop:<type>[:<code>] and quantize:<step>[:<axis>]
+ */
+bool filter_add(LOGGER log, filter_chain* chain, char* spec) {
+	char* name = strtok(spec, ":");
+	char* first = strtok(NULL, ":");
+	char* second = strtok(NULL, ":");
+	char* end = NULL;
+	filter_stage* stage;
+	size_t u;
+
+	if (chain->num_stages >= FILTER_MAX_STAGES) {
+		logprintf(log, LOG_ERROR, "Too many filter stages, at most %d are supported\n", FILTER_MAX_STAGES);
+		return false;
+	}
+
+	for (u = 0; name && filter_types[u].name; u++) {
+		if (!strcmp(filter_types[u].name, name)) {
+			break;
+		}
+	}
+
+	if (!name || !filter_types[u].name) {
+		logprintf(log, LOG_ERROR, "Unknown filter %s\n", name ? name : "");
+		return false;
+	}
+
+	stage = chain->stages + chain->num_stages;
+	*stage = filter_types[u];
+	stage->threshold = -1;
+	stage->type = -1;
+	stage->all_codes = true;
+
+	if (stage->apply == filter_deadband && first) {
+		stage->threshold = strtol(first, &end, 10);
+	} else if (stage->apply == filter_drop) {
+		if (!first || !filter_type(first, &stage->type)) {
+			logprintf(log, LOG_ERROR, "The drop filter requires an event type (drop:<type>[:<code>])\n");
+			return false;
+		}
+		if (second) {
+			stage->code = strtol(second, &end, 0);
+			stage->all_codes = false;
+		}
+	} else if (stage->apply == filter_quantize) {
+		if (!first || (stage->threshold = strtol(first, &end, 10)) <= 0 || *end) {
+			logprintf(log, LOG_ERROR, "The quantize filter requires a positive step (quantize:<step>[:<axis>])\n");
+			return false;
+		}
+		if (second) {
+			stage->code = strtol(second, &end, 0);
+			stage->all_codes = false;
+		}
+	}
+
+	if ((end && *end) || stage->threshold < -1) {
+		logprintf(log, LOG_ERROR, "Invalid parameter for filter %s\n", name);
+		return false;
+	}
+
+	chain->num_stages++;
+	return true;
+}
+
+/**
+ * Reads the axis ranges of a (re)opened device. The current axis values are taken as sent,
+ * as the server creates its device with them.
+ */
+void filter_setup(LOGGER log, filter_chain* chain, int device_fd) {
+	size_t u;
+
+	if (!chain->num_stages) {
+		return;
+	}
+
+	for (u = 0; u < ABS_CNT; u++) {
+		chain->known[u] = !ioctl(device_fd, EVIOCGABS(u), chain->absinfo + u);
+		if (chain->known[u]) {
+			chain->last[u] = chain->absinfo[u].value;
+		} else {
+			memset(chain->absinfo + u, 0, sizeof(struct input_absinfo));
+		}
+	}
+	chain->frame_events = 0;
+}
+
+// runs an event through the chain, returns false if it should not be sent
+bool filter_event(filter_chain* chain, struct input_event* event) {
+	filter_stage* stage;
+	size_t u;
+
+	if (!chain->num_stages) {
+		return true;
+	}
+
+	if (event->type == EV_SYN) {
+		if (event->code == SYN_REPORT) {
+			if (!chain->frame_events) {
+				chain->empty_frames++;
+				return false;
+			}
+			chain->frame_events = 0;
+		}
+		return true;
+	}
+
+	for (u = 0; u < chain->num_stages; u++) {
+		stage = chain->stages + u;
+		if (!stage->apply(chain, stage, event)) {
+			stage->dropped++;
+			return false;
+		}
+		stage->passed++;
+	}
+
+	if (event->type == EV_ABS && event->code < ABS_CNT) {
+		chain->last[event->code] = event->value;
+		chain->known[event->code] = true;
+	}
+	chain->frame_events++;
+	return true;
+}
+
+void filter_report(LOGGER log, filter_chain* chain) {
+	size_t u;
+
+	for (u = 0; u < chain->num_stages; u++) {
+		logprintf(log, LOG_INFO, "Filter %zu (%s): %llu events passed, %llu dropped\n", u, chain->stages[u].name,
+				(unsigned long long) chain->stages[u].passed, (unsigned long long) chain->stages[u].dropped);
+	}
+	if (chain->num_stages) {
+		logprintf(log, LOG_INFO, "Dropped %llu empty frames\n", (unsigned long long) chain->empty_frames);
+	}
+}
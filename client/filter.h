@@ -0,0 +1,44 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "../libs/logger.h"
+
+#define FILTER_MAX_STAGES 16
+
+typedef struct filter_chain filter_chain;
+typedef struct filter_stage filter_stage;
+
+struct filter_stage {
+	char* name;
+	// returns false if the event should not be sent, may modify the event
+	bool (*apply)(filter_chain* chain, filter_stage* stage, struct input_event* event);
+	// stage parameters, -1 (or all_codes) where not given
+	int32_t threshold;
+	int type;
+	int code;
+	bool all_codes;
+	uint64_t passed;
+	uint64_t dropped;
+};
+
+/*
+ * Events read from the device pass the stages in command line order before they are sent.
+ * Frames left empty by the stages are dropped as well.
+ */
+struct filter_chain {
+	filter_stage stages[FILTER_MAX_STAGES];
+	size_t num_stages;
+	struct input_absinfo absinfo[ABS_CNT];
+	// last value sent per axis, filters compare against it
+	int32_t last[ABS_CNT];
+	bool known[ABS_CNT];
+	size_t frame_events;
+	uint64_t empty_frames;
+};
+
+bool filter_add(LOGGER log, filter_chain* chain, char* spec);
+void filter_setup(LOGGER log, filter_chain* chain, int device_fd);
+bool filter_event(filter_chain* chain, struct input_event* event);
+void filter_report(LOGGER log, filter_chain* chain);
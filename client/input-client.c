@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -11,6 +12,8 @@
 #include <signal.h>
 #include <dirent.h>
 #include <limits.h>
+#include <poll.h>
+#include <time.h>
 
 #if __BSD_SOURCE
 #include <sys/endian.h>
@@ -24,6 +27,9 @@
 
 #include "../common/network.h"
 #include "../common/protocol.h"
+#include "filter.h"
+#include "coalesce.h"
+#include "feedback.h"
 #include "input-client.h"
 
 #define INPUT_NODES "/dev/input"
@@ -62,7 +68,7 @@ bool send_key_info(int sock_fd, int device_fd, Config* config) {
 		.msg_type = MESSAGE_ABSINFO
 	};
 	for (i = 0; i < EV_MAX; i++) {
-		if(i == EV_REP || i == EV_LED){
+		if(i == EV_REP){
 			continue;
 		}
 		if ((types[i / (sizeof(unsigned long) * 8)] & ((unsigned long) 1 << i % (sizeof(unsigned long) * 8))) > 0) {
@@ -147,6 +153,47 @@ bool setup_device(int sock_fd, int device_fd, Config* config) {
 	return true;
 }
 
+/**
+ * Installs the event mask announced by the server on the device, so the kernel
+ * does not wake us up for events the server would drop anyway.
+ */
+void apply_event_mask(Config* config, int device_fd) {
+#ifdef EVIOCSMASK
+	EventMaskMessage* msg = (EventMaskMessage*) config->event_mask;
+	unsigned long codes[KEY_CNT / (8 * sizeof(unsigned long))];
+	struct input_mask mask;
+	size_t offset, bytes, u;
+
+	if (msg->msg_type != MESSAGE_EVENT_MASK) {
+		return;
+	}
+
+	for (offset = 0; offset + 2 <= msg->length; offset += 2 + bytes) {
+		bytes = msg->masks[offset + 1];
+		if (offset + 2 + bytes > msg->length || bytes > sizeof(codes)) {
+			logprintf(config->log, LOG_WARNING, "Malformed event mask\n");
+			return;
+		}
+
+		memset(codes, 0, sizeof(codes));
+		for (u = 0; u < bytes * 8; u++) {
+			if (msg->masks[offset + 2 + u / 8] & (1 << (u % 8))) {
+				codes[u / (8 * sizeof(unsigned long))] |= 1UL << (u % (8 * sizeof(unsigned long)));
+			}
+		}
+
+		mask.type = msg->masks[offset];
+		mask.codes_size = sizeof(codes);
+		mask.codes_ptr = (uintptr_t) codes;
+		if (ioctl(device_fd, EVIOCSMASK, &mask) < 0) {
+			logprintf(config->log, LOG_WARNING, "Failed to set event mask for type %d: %s\n", mask.type, strerror(errno));
+			return;
+		}
+	}
+	logprintf(config->log, LOG_INFO, "Installed event mask of the server\n");
+#endif
+}
+
 bool init_connect(int sock_fd, int device_fd, Config* config) {
 	logprintf(config->log, LOG_INFO, "Connecting...\n");
 
@@ -164,7 +211,7 @@ bool init_connect(int sock_fd, int device_fd, Config* config) {
 		return false;
 	}
 
-	recv_bytes = recv_message(config->log, sock_fd, buf, sizeof(buf), NULL, 0);
+	recv_bytes = recv_reply(config->log, sock_fd, buf, sizeof(buf), config->event_mask, sizeof(config->event_mask));
 	if (recv_bytes < 0) {
 		return false;
 	}
@@ -201,7 +248,7 @@ bool init_connect(int sock_fd, int device_fd, Config* config) {
 		}
 		free(passwordMessage);
 
-		recv_bytes = recv_message(config->log, sock_fd, buf, sizeof(buf), NULL, 0);
+		recv_bytes = recv_reply(config->log, sock_fd, buf, sizeof(buf), config->event_mask, sizeof(config->event_mask));
 		if (recv_bytes < 0) {
 			return false;
 		}
@@ -214,7 +261,7 @@ bool init_connect(int sock_fd, int device_fd, Config* config) {
 			return false;
 		}
 
-		recv_bytes = recv_message(config->log, sock_fd, buf, sizeof(buf), NULL, 0);
+		recv_bytes = recv_reply(config->log, sock_fd, buf, sizeof(buf), config->event_mask, sizeof(config->event_mask));
 		if (recv_bytes < 0) {
 			return false;
 		}
@@ -227,6 +274,7 @@ bool init_connect(int sock_fd, int device_fd, Config* config) {
 
 	logprintf(config->log, LOG_INFO, "Connected to slot %d\n", buf[1]);
 	config->slot = buf[1];
+	apply_event_mask(config, device_fd);
 
 	return true;
 }
@@ -239,6 +287,8 @@ int usage(int argc, char** argv, Config* config) {
 	printf("%s usage:\n"
 			"%s [<options>] <device>\n"
 			"    -c, --continue <slot>   - Request connection continuation on a given slot (1-255)\n"
+			"    -C, --coalesce <us>     - Sum mouse motion arriving within this many microseconds after a sent frame\n"
+			"    -f, --filter <stage>    - Add a filter stage: deadband[:<n>], repeat, drop:<type>[:<code>], quantize:<step>[:<axis>]\n"
 			"    -h, --host <host>       - Specify host to connect to\n"
 			"    -?, --help              - Display this help text\n"
 			"    -r,--reopen <x>         - Try to reopen device for x seconds after it disconnects (-1 retries indefinitely)\n"
@@ -264,6 +314,15 @@ int set_slot(int argc, char** argv, Config* config) {
 	return 1;
 }
 
+int set_coalesce(int argc, char** argv, Config* config) {
+	config->coalesce.window = strtoull(argv[1], NULL, 10) * 1000;
+	return 1;
+}
+
+int add_filter(int argc, char** argv, Config* config) {
+	return filter_add(config->log, &config->filters, argv[1]) ? 1 : -1;
+}
+
 void add_arguments(Config* config) {
 	eargs_addArgument("-?", "--help", usage, 0);
 	eargs_addArgumentString("-h", "--host", &config->host);
@@ -272,14 +331,29 @@ void add_arguments(Config* config) {
 	eargs_addArgumentString("-pw", "--password", &config->password);
 	eargs_addArgumentUInt("-v", "--verbosity", &config->log.verbosity);
 	eargs_addArgument("-c", "--continue", set_slot, 1);
+	eargs_addArgument("-f", "--filter", add_filter, 1);
+	eargs_addArgument("-C", "--coalesce", set_coalesce, 1);
 	eargs_addArgumentInt("-r", "--reopen", &config->reopen_attempts);
 }
 
+// opens a device for reading events and writing feedback, falls back to read access
+int device_open(Config* config, char* file) {
+	int fd = open(file, O_RDWR);
+
+	if (fd < 0 && errno == EACCES) {
+		fd = open(file, O_RDONLY);
+		if (fd >= 0) {
+			logprintf(config->log, LOG_WARNING, "No write access to %s, force feedback and LEDs are disabled\n", file);
+		}
+	}
+	return fd;
+}
+
 int device_reopen(Config* config, char* file, int* fd) {
 	int counter = config->reopen_attempts;
 
 	while (!quit_signal && counter != 0) {
-		*fd = open(file, O_RDONLY);
+		*fd = device_open(config, file);
 		if (*fd >= 0) {
 			//get exclusive control
 			int grab = 1;
@@ -355,22 +429,68 @@ int scan_devices(Config* config) {
 
 
 
+static uint64_t clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// sends a run of events as DATA messages with a single write, reconnecting if the server went away
+bool send_events(Config* config, int sock_fd, int event_fd, struct input_event* events, size_t count) {
+	DataMessage data[COALESCE_OUTPUT_MAX];
+	size_t u;
+
+	if (!count) {
+		return true;
+	}
+
+	for (u = 0; u < count; u++) {
+		data[u].msg_type = MESSAGE_DATA;
+		data[u].type = htobe16(events[u].type);
+		data[u].code = htobe16(events[u].code);
+		data[u].value = htobe32(events[u].value);
+	}
+
+	if(!send_message(config->log, sock_fd, data, count * sizeof(DataMessage))) {
+		//check if connection is closed
+		if(errno == ECONNRESET || errno == EPIPE) {
+			if (!init_connect(sock_fd, event_fd, config)) {
+				logprintf(config->log, LOG_ERROR, "Reconnection failed: %s\n", strerror(errno));
+				return false;
+			}
+		} else {
+			logprintf(config->log, LOG_ERROR, "Failed to send: %s\n", strerror(errno));
+			return false;
+		}
+	}
+	return true;
+}
+
 int run(Config* config, int event_fd) {
 	struct input_event event;
-	int sock_fd;
+	struct input_event events[COALESCE_OUTPUT_MAX];
+	// the device and the feedback sent by the server
+	struct pollfd pfd[2] = {
+		{.fd = event_fd, .events = POLLIN},
+		{.events = POLLIN}
+	};
+	uint8_t feedback[INPUT_BUFFER_SIZE];
+	size_t feedback_length = 0;
+	struct timespec wait;
+	int64_t wait_ns;
+	size_t count;
+	int sock_fd, status;
 	ssize_t bytes;
 	struct sigaction act = {
 		.sa_handler = &quit
 	};
-	DataMessage data = {0};
-	data.msg_type = MESSAGE_DATA;
 
 	if (sigaction(SIGINT, &act, NULL) < 0) {
 		logprintf(config->log, LOG_ERROR, "Failed to set signal mask\n");
 		return 10;
 	}
 
-	sock_fd = tcp_connect(config->host, config->port);
+	sock_fd = server_connect(config->host, config->port);
 	if(sock_fd < 0) {
 		logprintf(config->log, LOG_ERROR, "Failed to reach server at %s port %s\n", config->host, config->port);
 		return 2;
@@ -389,8 +509,47 @@ int run(Config* config, int event_fd) {
 		return 4;
 	}
 
+	pfd[1].fd = sock_fd;
 	while(!quit_signal){
-		//block on read
+		//wait for input, feedback or the end of the coalescing window of pending motion
+		wait_ns = coalesce_timeout(&config->coalesce, clock_ns());
+		wait.tv_sec = wait_ns / 1000000000LL;
+		wait.tv_nsec = wait_ns % 1000000000LL;
+		status = ppoll(pfd, 2, (wait_ns >= 0) ? &wait : NULL, NULL);
+		if (status < 0) {
+			if (errno != EINTR) {
+				logprintf(config->log, LOG_ERROR, "poll() failed: %s\n", strerror(errno));
+				break;
+			}
+			continue;
+		}
+		if (status == 0) {
+			count = coalesce_flush(&config->coalesce, clock_ns(), events);
+			if (!send_events(config, sock_fd, event_fd, events, count)) {
+				break;
+			}
+			continue;
+		}
+
+		if (pfd[1].revents) {
+			bytes = recv(sock_fd, feedback + feedback_length, sizeof(feedback) - feedback_length, MSG_DONTWAIT);
+			if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EINTR)) {
+				logprintf(config->log, LOG_ERROR, "Connection to server lost\n");
+				break;
+			}
+			feedback_length += (bytes > 0) ? bytes : 0;
+			bytes = feedback_handle(config->log, &config->feedback, event_fd, feedback, feedback_length);
+			if (bytes < 0) {
+				break;
+			}
+			feedback_length -= bytes;
+			memmove(feedback, feedback + bytes, feedback_length);
+		}
+
+		if (!pfd[0].revents) {
+			continue;
+		}
+
 		bytes = read(event_fd, &event, sizeof(event));
 		if(bytes < 0) {
 			logprintf(config->log, LOG_ERROR, "read() failed: %s\nReconnecting...\n", strerror(errno));
@@ -398,27 +557,32 @@ int run(Config* config, int event_fd) {
 			if (device_reopen(config, config->dev_path, &event_fd) < 0) {
 				break;
 			} else {
+				pfd[0].fd = event_fd;
+				apply_event_mask(config, event_fd);
+				filter_setup(config->log, &config->filters, event_fd);
+				feedback_reopen(config->log, &config->feedback, event_fd);
 				continue;
 			}
 		}
 		if(bytes == sizeof(event)) {
 			logprintf(config->log, LOG_DEBUG, "Event type:%d, code:%d, value:%d\n", event.type, event.code, event.value);
+			//LED state is set by the server, the device only reports it back
+			if (event.type == EV_LED) {
+				continue;
+			}
+			if (!filter_event(&config->filters, &event)) {
+				continue;
+			}
 
-			data.type = htobe16(event.type);
-			data.code = htobe16(event.code);
-			data.value = htobe32(event.value);
+			if (config->coalesce.window) {
+				count = coalesce_event(&config->coalesce, &event, clock_ns(), events);
+			} else {
+				events[0] = event;
+				count = 1;
+			}
 
-			if(!send_message(config->log, sock_fd, &data, sizeof(data))) {
-				//check if connection is closed
-				if(errno == ECONNRESET || errno == EPIPE) {
-					if (!init_connect(sock_fd, event_fd, config)) {
-						logprintf(config->log, LOG_ERROR, "Reconnection failed: %s\n", strerror(errno));
-						break;
-					}
-				} else {
-					logprintf(config->log, LOG_ERROR, "Failed to send: %s\n", strerror(errno));
-					break;
-				}
+			if (!send_events(config, sock_fd, event_fd, events, count)) {
+				break;
 			}
 		} else{
 			logprintf(config->log, LOG_WARNING, "Short read from event descriptor (%zd bytes)\n", bytes);
@@ -429,6 +593,13 @@ int run(Config* config, int event_fd) {
 		send_message(config->log, sock_fd, &quit_msg, sizeof(quit_msg));
 		close(sock_fd);
 	}
+	filter_report(config->log, &config->filters);
+	logprintf(config->log, LOG_INFO, "Received %llu feedback messages, %llu failed\n",
+			(unsigned long long) config->feedback.received, (unsigned long long) config->feedback.failed);
+	if (config->coalesce.window) {
+		logprintf(config->log, LOG_INFO, "Coalesced %llu frames into %llu\n",
+				(unsigned long long) config->coalesce.frames_in, (unsigned long long) config->coalesce.frames_out);
+	}
 
 	return 0;
 }
@@ -468,13 +639,16 @@ int main(int argc, char** argv){
 	}
 
 	logprintf(config.log, LOG_INFO, "Reading input events from %s\n", config.dev_path);
-	event_fd = open(config.dev_path, O_RDONLY);
+	event_fd = device_open(&config, config.dev_path);
 	if(event_fd < 0){
 		logprintf(config.log, LOG_ERROR, "Failed to open device %s: %s\n", config.dev_path, strerror(errno));
 		free(config.dev_path);
 		return EXIT_FAILURE;
 	}
 
+	filter_setup(config.log, &config.filters, event_fd);
+	feedback_init(&config.feedback);
+
 	printf("Connection negotiated, now streaming\n");
 	int status = run(&config, event_fd);
 	close(event_fd);
@@ -1,5 +1,10 @@
 #pragma once
 #include "../libs/logger.h"
+#include "../common/protocol.h"
+
+#include "filter.h"
+#include "coalesce.h"
+#include "feedback.h"
 
 #define VERSION "InputClient 2.0"
 
@@ -14,4 +19,10 @@ typedef struct {
 	uint64_t type;
 	uint8_t slot;
 	int reopen_attempts;
+	// last event mask announced by the server, reapplied when the device is reopened
+	uint8_t event_mask[sizeof(EventMaskMessage) + UINT8_MAX];
+	// stages events pass between reading and sending
+	filter_chain filters;
+	coalesce_state coalesce;
+	feedback_state feedback;
 } Config;
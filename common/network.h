@@ -5,6 +5,9 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 
 #include "../libs/logger.h"
 #include "protocol.h"
@@ -12,22 +15,49 @@
 #define LISTEN_QUEUE_LENGTH 128
 
 
+/**
+ * Returns the length of the complete messages at the start of buf that fit into
+ * the input buffer of the server. On a SOCK_SEQPACKET connection every send is
+ * one datagram, which the server has to receive as a whole.
+ */
+size_t message_span(uint8_t* buf, size_t len) {
+	size_t span = 0;
+	int bytes;
+
+	while (span < len) {
+		bytes = get_size_from_command(buf + span, len - span);
+		if (bytes <= 0 || span + bytes > INPUT_BUFFER_SIZE) {
+			break;
+		}
+		span += bytes;
+	}
+	return span ? span : len;
+}
+
 bool send_message(LOGGER log, int sock_fd, void* data, unsigned len) {
+	uint8_t* pos = data;
 	ssize_t bytes = len;
 	ssize_t status = 0;
+	size_t chunk;
 
 	while (bytes > 0) {
-		status = send(sock_fd, data, len, MSG_NOSIGNAL);
-		//status = send(sock_fd, data, bytes, 0);
+		chunk = message_span(pos, bytes);
+		while (chunk > 0) {
+			status = send(sock_fd, pos, chunk, MSG_NOSIGNAL);
+
+			if (status < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				logprintf(log, LOG_ERROR, "Failed to send: %s\n", strerror(errno));
+				return false;
+			}
+			logprintf(log, LOG_DEBUG, "%zd of %u bytes sent (%zd this iteration)\n", len - bytes + status, len, status);
 
-		if (status < 0) {
-			logprintf(log, LOG_ERROR, "Failed to send: %s\n", strerror(errno));
-			return false;
+			bytes -= status;
+			chunk -= status;
+			pos += status;
 		}
-		logprintf(log, LOG_DEBUG, "%zu of %zu bytes sent (%zu this iteration)\n", status, len, status);
-
-		bytes -= status;
-		data += status;
 	}
 
 
@@ -41,23 +71,15 @@ ssize_t recv_message(LOGGER log, int sock_fd, uint8_t buf[], unsigned len, uint8
 
 	// copy back old buffer
 	if (oldbuf && oldlen > 0) {
-		int i;
-		for (i = 0; i < oldlen; i++) {
-			buf[i] = oldbuf[i];
-		}
+		memmove(buf, oldbuf, oldlen);
 		bytes = oldlen;
 
-		length_needed = get_size_from_command(buf, status);
+		length_needed = get_size_from_command(buf, bytes);
 
 		if(length_needed < 0) {
 			logprintf(log, LOG_ERROR, "Unknown message type %d\n", buf[0]);
 			return -1;
 		}
-
-		// not enough bytes for getting the proper size.
-		if (length_needed == 0) {
-			bytes++;
-		}
 	}
 
 	while (length_needed < 1 || bytes < length_needed) {
@@ -76,26 +98,47 @@ ssize_t recv_message(LOGGER log, int sock_fd, uint8_t buf[], unsigned len, uint8
 
 		logprintf(log, LOG_DEBUG, "%d bytes received\n", status);
 
-		if (status > 0 && length_needed < 1) {
-			length_needed = get_size_from_command(buf, status);
+		bytes += status;
 
-			if (length_needed < 0) {
-				logprintf(log, LOG_ERROR, "Unknown message type 0x%.2x\n", buf[0]);
-				return -1;
-			}
+		// a length of 0 means the length field of the message is not complete yet
+		length_needed = get_size_from_command(buf, bytes);
 
-			// not enough bytes for getting the proper size.
-			if (length_needed == 0) {
-				bytes++;
-			}
+		if (length_needed < 0) {
+			logprintf(log, LOG_ERROR, "Unknown message type 0x%.2x\n", buf[0]);
+			return -1;
 		}
-
-		bytes += status;
 	}
 
 	return bytes;
 }
 
+/**
+ * Receives the reply to a handshake message. The server announces the accepted
+ * events with an EVENT_MASK message before MESSAGE_SUCCESS, it is copied to mask
+ * (if given, up to mask_len bytes) and skipped.
+ */
+ssize_t recv_reply(LOGGER log, int sock_fd, uint8_t buf[], unsigned len, uint8_t* mask, size_t mask_len) {
+	ssize_t bytes = recv_message(log, sock_fd, buf, len, NULL, 0);
+	int size;
+
+	if (bytes > 0 && buf[0] == MESSAGE_EVENT_MASK) {
+		size = get_size_from_command(buf, bytes);
+		if (mask) {
+			memcpy(mask, buf, (size < mask_len) ? size : mask_len);
+		}
+		bytes = recv_message(log, sock_fd, buf, len, buf + size, bytes - size);
+	}
+	return bytes;
+}
+
+bool set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return false;
+	}
+	return true;
+}
+
 int tcp_connect(char* host, char* port){
 	int sockfd = -1, error;
 	struct addrinfo hints;
@@ -143,6 +186,86 @@ int tcp_connect(char* host, char* port){
 	return sockfd;
 }
 
+int unix_connect(char* path){
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX
+	};
+	int sockfd;
+
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return -1;
+	}
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if(sockfd < 0){
+		perror("socket");
+		return -1;
+	}
+
+	if(connect(sockfd, (struct sockaddr*) &addr, sizeof(addr)) < 0){
+		perror("connect");
+		close(sockfd);
+		return -1;
+	}
+	return sockfd;
+}
+
+// connects to a server on this host if host is the path of its UNIX socket, over TCP otherwise
+int server_connect(char* host, char* port){
+	if(host[0] == '/'){
+		return unix_connect(host);
+	}
+	return tcp_connect(host, port);
+}
+
+/**
+ * Creates a SOCK_SEQPACKET listener at path, replacing a stale socket file.
+ * The socket is created with the permission bits in mode, which control who may connect.
+ */
+int unix_listener(char* path, mode_t mode){
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX
+	};
+	struct stat info;
+	mode_t mask;
+	int fd, status;
+
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return -1;
+	}
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	if(!lstat(path, &info) && S_ISSOCK(info.st_mode)){
+		unlink(path);
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if(fd < 0){
+		perror("socket");
+		return -1;
+	}
+
+	mask = umask(~mode & 0777);
+	status = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+	umask(mask);
+	if(status < 0){
+		fprintf(stderr, "Failed to bind socket %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if(listen(fd, LISTEN_QUEUE_LENGTH) < 0){
+		perror("listen");
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	return fd;
+}
+
 int tcp_listener(char* bindhost, char* port){
 	int fd = -1, status, yes = 1;
 	struct addrinfo hints;
@@ -0,0 +1,562 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+
+#include "osc.h"
+
+#define nextdword(a) ((((a) / 4) + (((a) % 4) ? 1:0)) * 4)
+
+static uint64_t osc_frame_sequence = 0;
+
+//current time as OSC timetag (NTP format, 32.32 fixed point)
+uint64_t osc_now(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((ts.tv_sec + NTP_UNIX_OFFSET) << 32) | (((uint64_t) ts.tv_nsec << 32) / 1000000000ULL);
+}
+
+// nanoseconds from now until a timetag, 0 if it has passed
+int64_t osc_delay(uint64_t due, uint64_t now){
+	uint64_t delta;
+
+	if(due <= now){
+		return 0;
+	}
+
+	delta = due - now;
+	return (delta >> 32) * 1000000000LL + (((delta & 0xFFFFFFFF) * 1000000000ULL) >> 32);
+}
+
+//FNV-1a
+uint32_t osc_hash(uint8_t* data, size_t len){
+	uint32_t hash = 2166136261u;
+	size_t u;
+
+	for(u = 0; u < len; u++){
+		hash ^= data[u];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+float osc_param_float(uint8_t* buffer, unsigned index){
+	unsigned u;
+	union{
+		float rv;
+		uint8_t in[4];
+	} conv;
+
+	for(u = 0; u < 4; u++){
+		conv.in[3 - u] = buffer[(index * 4) + u];
+	}
+
+	return conv.rv;
+}
+
+int osc_parse(LOGGER log, char* buffer, size_t len, char** path, unsigned* num_args, uint8_t** args){
+	unsigned args_supplied = 0;
+	char* param_str;
+	char* data_off;
+
+	if(!memchr(buffer, 0, len)){
+		logprintf(log, LOG_WARNING, "Unterminated path in OSC message\n");
+		return -1;
+	}
+
+	//the format string has to be terminated within the message before its length is taken
+	param_str = buffer + nextdword(strlen(buffer) + 1);
+	if(param_str >= buffer + len || !memchr(param_str, 0, (buffer + len) - param_str)){
+		logprintf(log, LOG_WARNING, "OSC message out of bounds\n");
+		return -1;
+	}
+	data_off = param_str + nextdword(strlen(param_str) + 1);
+
+	if(*param_str != ','){
+		logprintf(log, LOG_WARNING, "Invalid OSC format string %s (offset %zu)\n", param_str, param_str - buffer);
+		return -1;
+	}
+
+	args_supplied = strlen(param_str + 1);
+	if(data_off + (4 * args_supplied) > (buffer + len)){
+		logprintf(log, LOG_WARNING, "OSC message out of bounds\n");
+		return -1;
+	}
+
+	if(path){
+		*path = buffer;
+	}
+
+	if(num_args){
+		*num_args = args_supplied;
+	}
+
+	if(args){
+		*args = (uint8_t*)data_off;
+	}
+	return 0;
+}
+
+/**
+ * Walks an OSC packet, calling handler for every message it contains.
+ * Bundles are traversed recursively. Bundles timetagged later than now are
+ * passed to schedule instead, if given.
+ */
+int osc_packet(LOGGER log, char* buffer, size_t len, uint64_t now, unsigned depth, osc_handler handler, osc_scheduler schedule, void* user){
+	char* path;
+	unsigned num_args;
+	uint8_t* args;
+	uint64_t timetag;
+	uint32_t element;
+	size_t offset;
+	int status;
+
+	if(len < 8 || memcmp(buffer, "#bundle", 8)){
+		if(osc_parse(log, buffer, len, &path, &num_args, &args) < 0){
+			return -1;
+		}
+		return handler(path, num_args, args, user);
+	}
+
+	if(len < 16 || depth >= OSC_BUNDLE_DEPTH){
+		logprintf(log, LOG_WARNING, "Invalid OSC bundle\n");
+		return -1;
+	}
+
+	memcpy(&timetag, buffer + 8, sizeof(timetag));
+	timetag = be64toh(timetag);
+	//timetag 1 means immediately
+	if(schedule && timetag > 1 && timetag > now){
+		status = schedule(buffer, len, timetag, user);
+		if(status <= 0){
+			return status;
+		}
+	}
+
+	for(offset = 16; offset + 4 <= len; offset += 4 + element){
+		memcpy(&element, buffer + offset, sizeof(element));
+		element = be32toh(element);
+		if(element > len - offset - 4 || element % 4){
+			logprintf(log, LOG_WARNING, "OSC bundle element out of bounds\n");
+			return -1;
+		}
+
+		if(osc_packet(log, buffer + offset + 4, element, now, depth + 1, handler, schedule, user) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Drains pending datagrams of a non-blocking read with recvmmsg(), calling handler
+ * for each. At most batches recvmmsg() calls are made, 0 drains the socket.
+ * Truncated datagrams are dropped.
+ * Returns the number of datagrams read or -1 on failure.
+ */
+ssize_t osc_receive(LOGGER log, int fd, unsigned batches, osc_datagram handler, void* user){
+	static char buffers[OSC_RECV_BATCH][OSC_PACKET_MAX];
+	struct sockaddr_storage addrs[OSC_RECV_BATCH];
+	struct mmsghdr messages[OSC_RECV_BATCH];
+	struct iovec iov[OSC_RECV_BATCH];
+	ssize_t total = 0;
+	unsigned batch = 0;
+	int count, u;
+
+	for(u = 0; u < OSC_RECV_BATCH; u++){
+		iov[u].iov_base = buffers[u];
+		iov[u].iov_len = sizeof(buffers[u]);
+	}
+
+	do{
+		memset(messages, 0, sizeof(messages));
+		for(u = 0; u < OSC_RECV_BATCH; u++){
+			messages[u].msg_hdr.msg_iov = iov + u;
+			messages[u].msg_hdr.msg_iovlen = 1;
+			messages[u].msg_hdr.msg_name = addrs + u;
+			messages[u].msg_hdr.msg_namelen = sizeof(addrs[u]);
+		}
+
+		count = recvmmsg(fd, messages, OSC_RECV_BATCH, MSG_DONTWAIT, NULL);
+		if(count < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+				break;
+			}
+			logprintf(log, LOG_ERROR, "Failed to receive OSC data: %s\n", strerror(errno));
+			return -1;
+		}
+
+		for(u = 0; u < count; u++){
+			//a truncated packet would be applied partially
+			if(messages[u].msg_hdr.msg_flags & MSG_TRUNC){
+				logprintf(log, LOG_WARNING, "Dropping OSC datagram larger than %d bytes\n", OSC_PACKET_MAX);
+				continue;
+			}
+			handler(buffers[u], messages[u].msg_len, addrs + u, messages[u].msg_hdr.msg_namelen, user);
+		}
+		total += count;
+	} while(count == OSC_RECV_BATCH && (!batches || ++batch < batches));
+
+	return total;
+}
+
+//derives the affine mapping from the learned range to the device range, so translation needs no divisions
+void osc_channel_prepare(int type, osc_channel* channel, double deadzone){
+	channel->target_center = channel->target_min + (channel->target_max - channel->target_min) / 2;
+	channel->center = (channel->min + channel->max) / 2;
+	channel->deadzone = (type == EV_ABS) ? deadzone * (channel->max - channel->min) / 2 : -1;
+
+	if(channel->max > channel->min){
+		channel->scale = (channel->target_max - channel->target_min) / (channel->max - channel->min);
+		channel->offset = channel->target_min - channel->min * channel->scale;
+	}
+	else{
+		//nothing learned, pass values through
+		channel->scale = 1;
+		channel->offset = 0;
+	}
+}
+
+int32_t osc_channel_value(osc_channel* channel, float value){
+	if(fabsf(value - channel->center) <= channel->deadzone){
+		return channel->target_center;
+	}
+
+	value = value * channel->scale + channel->offset;
+	if(value < channel->target_min){
+		return channel->target_min;
+	}
+	if(value > channel->target_max){
+		return channel->target_max;
+	}
+	return lrintf(value);
+}
+
+//appends a copy of control to the mapping, taking ownership of its path
+int osc_mapping_add(LOGGER log, osc_mapping* mapping, osc_control* control){
+	osc_control* controls;
+	size_t c;
+
+	controls = realloc(mapping->controls, (mapping->num_controls + 1) * sizeof(osc_control));
+	if(!controls){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		return -1;
+	}
+	mapping->controls = controls;
+	mapping->controls[mapping->num_controls] = *control;
+	for(c = 0; c < control->num_channels; c++){
+		osc_channel_prepare(control->type, mapping->controls[mapping->num_controls].channels + c, mapping->deadzone);
+	}
+	mapping->num_controls++;
+	return 0;
+}
+
+static void osc_index_free(osc_index* index){
+	free(index->hashes);
+	free(index->entries);
+	index->hashes = NULL;
+	index->entries = NULL;
+	index->size = 0;
+}
+
+// builds the path index over all controls of the mapping
+int osc_mapping_index(LOGGER log, osc_mapping* mapping){
+	osc_index* index = &mapping->index;
+	osc_control* controls = mapping->controls;
+	size_t u, bucket;
+	uint32_t hash;
+
+	osc_index_free(index);
+	index->size = OSC_INDEX_SIZE;
+	while(index->size < mapping->num_controls * 2){
+		index->size *= 2;
+	}
+
+	index->hashes = calloc(index->size, sizeof(uint32_t));
+	index->entries = calloc(index->size, sizeof(size_t));
+	if(!index->hashes || !index->entries){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		osc_index_free(index);
+		return -1;
+	}
+
+	for(u = 0; u < mapping->num_controls; u++){
+		hash = osc_hash((uint8_t*) controls[u].path, strlen(controls[u].path));
+		for(bucket = hash & (index->size - 1); index->entries[bucket]; bucket = (bucket + 1) & (index->size - 1)){
+			if(index->hashes[bucket] == hash && !strcmp(controls[index->entries[bucket] - 1].path, controls[u].path)){
+				break;
+			}
+		}
+
+		if(index->entries[bucket]){
+			logprintf(log, LOG_WARNING, "OSC path %s is mapped more than once, using the first mapping\n", controls[u].path);
+			continue;
+		}
+		index->hashes[bucket] = hash;
+		index->entries[bucket] = u + 1;
+	}
+	return 0;
+}
+
+osc_control* osc_mapping_find(osc_mapping* mapping, char* path){
+	osc_index* index = &mapping->index;
+	uint32_t hash;
+	size_t bucket;
+
+	if(!index->size){
+		return NULL;
+	}
+
+	hash = osc_hash((uint8_t*) path, strlen(path));
+	for(bucket = hash & (index->size - 1); index->entries[bucket]; bucket = (bucket + 1) & (index->size - 1)){
+		if(index->hashes[bucket] == hash && !strcmp(mapping->controls[index->entries[bucket] - 1].path, path)){
+			return mapping->controls + index->entries[bucket] - 1;
+		}
+	}
+	return NULL;
+}
+
+void osc_mapping_free(osc_mapping* mapping){
+	size_t u;
+
+	osc_index_free(&mapping->index);
+	for(u = 0; u < mapping->num_controls; u++){
+		free(mapping->controls[u].path);
+	}
+	free(mapping->controls);
+	mapping->controls = NULL;
+	mapping->num_controls = 0;
+}
+
+/**
+ * Loads mappings from a profile, one control per line:
+ *   <path> <type> <code>:<min>:<max>[:<device min>:<device max>] ...
+ * A [slot N] line routes the following controls to slot N, numbered from 1 like
+ * in the protocol (default 1). control->slot holds the 0-based slot index.
+ * Empty lines and lines starting with # are ignored. Channels without a
+ * device range get it from target. Returns 1 if the file does not exist.
+ */
+int osc_profile_load(LOGGER log, osc_mapping* mapping, char* file, osc_target target){
+	FILE* source = fopen(file, "r");
+	char line[OSC_PROFILE_LINE];
+	char* token, *end, *saveptr;
+	osc_control control;
+	osc_channel* channel;
+	size_t line_no = 0;
+	int slot = 0;
+
+	if(!source){
+		if(errno == ENOENT){
+			return 1;
+		}
+		logprintf(log, LOG_ERROR, "Failed to open profile %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), source)){
+		line_no++;
+		memset(&control, 0, sizeof(control));
+
+		if(!strncmp(line, "[slot ", 6)){
+			slot = strtol(line + 6, &end, 10) - 1;
+			if(*end != ']' || slot < 0){
+				logprintf(log, LOG_ERROR, "%s:%zu: Section is not valid. Format is [slot N]\n", file, line_no);
+				fclose(source);
+				return -1;
+			}
+			continue;
+		}
+
+		token = strtok_r(line, " \t\r\n", &saveptr);
+		if(!token || *token == '#'){
+			continue;
+		}
+		control.path = token;
+		control.slot = slot;
+
+		token = strtok_r(NULL, " \t\r\n", &saveptr);
+		control.type = token ? strtol(token, &end, 0) : -1;
+		if(!token || *end || (control.type != EV_KEY && control.type != EV_ABS)){
+			logprintf(log, LOG_ERROR, "%s:%zu: Invalid event type\n", file, line_no);
+			fclose(source);
+			return -1;
+		}
+
+		while((token = strtok_r(NULL, " \t\r\n", &saveptr))){
+			if(control.num_channels == OSC_CHANNELS_MAX){
+				logprintf(log, LOG_ERROR, "%s:%zu: Too many channels\n", file, line_no);
+				fclose(source);
+				return -1;
+			}
+
+			channel = control.channels + control.num_channels;
+			channel->code = strtol(token, &end, 0);
+			if(*end == ':'){
+				channel->min = strtod(end + 1, &end);
+			}
+			if(*end == ':'){
+				channel->max = strtod(end + 1, &end);
+			}
+			if(*end == ':'){
+				channel->target_min = strtol(end + 1, &end, 10);
+				if(*end != ':'){
+					end = token;
+				}
+				else{
+					channel->target_max = strtol(end + 1, &end, 10);
+				}
+			}
+			else if(!*end && (!target || target(control.type, channel) < 0)){
+				logprintf(log, LOG_ERROR, "%s:%zu: No device range for code %d\n", file, line_no, channel->code);
+				fclose(source);
+				return -1;
+			}
+
+			if(*end || channel->code < 0 || channel->code >= ((control.type == EV_KEY) ? KEY_CNT : ABS_CNT)){
+				logprintf(log, LOG_ERROR, "%s:%zu: Invalid channel %s\n", file, line_no, token);
+				fclose(source);
+				return -1;
+			}
+			control.num_channels++;
+		}
+
+		if(!control.num_channels){
+			logprintf(log, LOG_ERROR, "%s:%zu: No channels for %s\n", file, line_no, control.path);
+			fclose(source);
+			return -1;
+		}
+
+		control.path = strdup(control.path);
+		if(!control.path || osc_mapping_add(log, mapping, &control) < 0){
+			free(control.path);
+			fclose(source);
+			return -1;
+		}
+	}
+
+	fclose(source);
+	logprintf(log, LOG_INFO, "Loaded mapping profile %s\n", file);
+	return 0;
+}
+
+//writes the mappings to a temporary file first, so an interrupted save keeps the old profile
+int osc_profile_save(LOGGER log, osc_mapping* mapping, char* file){
+	char* temporary = calloc(strlen(file) + 5, sizeof(char));
+	osc_control* control;
+	FILE* target;
+	size_t u, c;
+	int slot = 0;
+
+	if(!temporary){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		return -1;
+	}
+	sprintf(temporary, "%s.tmp", file);
+
+	target = fopen(temporary, "w");
+	if(!target){
+		logprintf(log, LOG_ERROR, "Failed to write profile %s: %s\n", temporary, strerror(errno));
+		free(temporary);
+		return -1;
+	}
+
+	fprintf(target, "# OSC mapping profile\n# <path> <type> <code>:<min>:<max>:<device min>:<device max> ...\n");
+	for(u = 0; u < mapping->num_controls; u++){
+		control = mapping->controls + u;
+		if(control->slot != slot){
+			slot = control->slot;
+			fprintf(target, "[slot %d]\n", slot + 1);
+		}
+
+		fprintf(target, "%s %d", control->path, control->type);
+		for(c = 0; c < control->num_channels; c++){
+			fprintf(target, " %d:%.9g:%.9g:%d:%d", control->channels[c].code, control->channels[c].min, control->channels[c].max,
+					control->channels[c].target_min, control->channels[c].target_max);
+		}
+		fprintf(target, "\n");
+	}
+
+	if(fclose(target) || rename(temporary, file)){
+		logprintf(log, LOG_ERROR, "Failed to write profile %s: %s\n", file, strerror(errno));
+		unlink(temporary);
+		free(temporary);
+		return -1;
+	}
+
+	logprintf(log, LOG_INFO, "Saved mapping profile %s\n", file);
+	free(temporary);
+	return 0;
+}
+
+void osc_frame_init(osc_frame* frame){
+	frame->id = ++osc_frame_sequence;
+	frame->start = 0;
+	frame->length = 0;
+}
+
+//terminates the current frame with a SYN_REPORT
+void osc_frame_end(osc_frame* frame){
+	if(frame->length == frame->start){
+		return;
+	}
+
+	frame->events[frame->length].type = EV_SYN;
+	frame->events[frame->length].code = SYN_REPORT;
+	frame->events[frame->length].value = 0;
+	frame->length++;
+
+	frame->start = frame->length;
+	frame->id = ++osc_frame_sequence;
+}
+
+/**
+ * Adds the channels of a mapped OSC message to the frame, replacing earlier
+ * values of the same path. Returns 1 if values were replaced, 0 if they were
+ * appended and -1 if the frame is full and has to be written out first.
+ */
+int osc_frame_add(osc_frame* frame, osc_control* control, uint8_t* args){
+	struct input_event* events;
+	int32_t value[OSC_CHANNELS_MAX];
+	size_t c;
+
+	for(c = 0; c < control->num_channels; c++){
+		value[c] = osc_channel_value(control->channels + c, osc_param_float(args, c));
+	}
+
+	if(control->frame == frame->id){
+		events = frame->events + control->position;
+		for(c = 0; c < control->num_channels && (control->type != EV_KEY || events[c].value == value[c]); c++){
+		}
+
+		if(c == control->num_channels){
+			for(c = 0; c < control->num_channels; c++){
+				events[c].value = value[c];
+			}
+			return 1;
+		}
+
+		//button changed again, keep both transitions
+		osc_frame_end(frame);
+	}
+
+	//keep room for the SYN_REPORT
+	if(frame->length + control->num_channels >= OSC_BATCH_MAX){
+		return -1;
+	}
+
+	control->frame = frame->id;
+	control->position = frame->length;
+	for(c = 0; c < control->num_channels; c++){
+		frame->events[frame->length].type = control->type;
+		frame->events[frame->length].code = control->channels[c].code;
+		frame->events[frame->length].value = value[c];
+		frame->length++;
+	}
+	return 0;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/input.h>
+
+#include "../libs/logger.h"
+
+// largest OSC datagram accepted
+#define OSC_PACKET_MAX 1024
+// datagrams read per recvmmsg() call
+#define OSC_RECV_BATCH 32
+// bundle nesting depth accepted
+#define OSC_BUNDLE_DEPTH 8
+// initial size of the path index, always a power of two
+#define OSC_INDEX_SIZE 32
+// events buffered per frame batch including the SYN_REPORTs
+#define OSC_BATCH_MAX 256
+// channels (arguments) of one control
+#define OSC_CHANNELS_MAX 2
+// longest line accepted in a mapping profile
+#define OSC_PROFILE_LINE 1024
+// seconds from the NTP epoch (1900) used by OSC timetags to the unix epoch
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+typedef struct /*_OSC_CHANNEL*/{
+	int code;
+	//range learned from the OSC source
+	double min;
+	double max;
+	//range of the axis on the device
+	int target_min;
+	int target_max;
+	//precomputed by osc_channel_prepare: value * scale + offset, inputs within deadzone of center map to target_center
+	float scale;
+	float offset;
+	float center;
+	float deadzone;
+	int target_center;
+} osc_channel;
+
+typedef struct /*_OSC_CONTROL*/{
+	char* path;
+	int type;
+	//slot the control drives when OSC is handled by the server
+	int slot;
+	unsigned num_channels;
+	osc_channel channels[OSC_CHANNELS_MAX];
+	//frame the channels were last added to and their position in the batch
+	uint64_t frame;
+	size_t position;
+} osc_control;
+
+/*
+ * Open-addressing hash table over the mapped OSC paths, built once all
+ * controls are known. Entries are indices into the controls plus one,
+ * 0 marks an empty bucket. The table is kept at most half full.
+ */
+typedef struct /*_OSC_INDEX*/{
+	size_t size;
+	uint32_t* hashes;
+	size_t* entries;
+} osc_index;
+
+typedef struct /*_OSC_MAPPING*/{
+	osc_control* controls;
+	size_t num_controls;
+	osc_index index;
+	// fraction of the learned range around its center mapped to the axis center
+	double deadzone;
+} osc_mapping;
+
+/*
+ * Events collected from OSC packets, written out together. Within a frame only
+ * the last value per path is kept, a button changing twice ends the frame so
+ * no transition is lost.
+ */
+typedef struct /*_OSC_FRAME*/{
+	//unique id of the current frame, start of the current frame in events
+	uint64_t id;
+	size_t start;
+	size_t length;
+	struct input_event events[OSC_BATCH_MAX];
+} osc_frame;
+
+typedef int (*osc_handler)(char* path, unsigned num_args, uint8_t* args, void* user);
+// takes a bundle timetagged in the future. Returns 0 if it was scheduled, 1 to apply it now and -1 on failure
+typedef int (*osc_scheduler)(char* buffer, size_t len, uint64_t due, void* user);
+typedef void (*osc_datagram)(char* buffer, size_t len, struct sockaddr_storage* addr, socklen_t addr_len, void* user);
+// sets the device range of a channel loaded without one, returns -1 if the code is not supported
+typedef int (*osc_target)(int type, osc_channel* channel);
+
+uint64_t osc_now(void);
+int64_t osc_delay(uint64_t due, uint64_t now);
+uint32_t osc_hash(uint8_t* data, size_t len);
+float osc_param_float(uint8_t* buffer, unsigned index);
+int osc_parse(LOGGER log, char* buffer, size_t len, char** path, unsigned* num_args, uint8_t** args);
+int osc_packet(LOGGER log, char* buffer, size_t len, uint64_t now, unsigned depth, osc_handler handler, osc_scheduler schedule, void* user);
+ssize_t osc_receive(LOGGER log, int fd, unsigned batches, osc_datagram handler, void* user);
+
+void osc_channel_prepare(int type, osc_channel* channel, double deadzone);
+int32_t osc_channel_value(osc_channel* channel, float value);
+
+int osc_mapping_add(LOGGER log, osc_mapping* mapping, osc_control* control);
+int osc_mapping_index(LOGGER log, osc_mapping* mapping);
+osc_control* osc_mapping_find(osc_mapping* mapping, char* path);
+void osc_mapping_free(osc_mapping* mapping);
+int osc_profile_load(LOGGER log, osc_mapping* mapping, char* file, osc_target target);
+int osc_profile_save(LOGGER log, osc_mapping* mapping, char* file);
+
+void osc_frame_init(osc_frame* frame);
+void osc_frame_end(osc_frame* frame);
+int osc_frame_add(osc_frame* frame, osc_control* control, uint8_t* args);
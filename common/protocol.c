@@ -1,6 +1,14 @@
 #include <inttypes.h>
+#include <stddef.h>
+#include <endian.h>
+#include <string.h>
 #include "protocol.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DATA_DECODE_SSSE3
+#endif
+
 struct MessageInfo MESSAGE_TYPES_INFO[256] = {
 	[0 ... 255] = { .length = -1, .name = "Invalid Message"},
 	[MESSAGE_HELLO] = { .length = sizeof(HelloMessage), .name = "Hello"},
@@ -8,8 +16,15 @@ struct MessageInfo MESSAGE_TYPES_INFO[256] = {
 	[MESSAGE_ABSINFO] = {.length = sizeof(ABSInfoMessage), .name = "AbsInfo"},
 	[MESSAGE_DEVICE] = { .length = sizeof(DeviceMessage), .name = "Device"},
 	[MESSAGE_REQUEST_EVENT] = {.length = sizeof(RequestEventMessage), .name = "EventEnableRequest"},
+	[MESSAGE_PING] = {.length = sizeof(PingMessage), .name = "Ping"},
+	[MESSAGE_RING] = {.length = sizeof(RingMessage), .name = "Ring"},
+	[MESSAGE_OPEN] = {.length = sizeof(OpenMessage), .name = "Open"},
 	[MESSAGE_SETUP_END] = { .length = 1, .name = "SetupDone"},
 	[MESSAGE_DATA] =  { .length = sizeof(DataMessage), .name = "Data"},
+	[MESSAGE_FEEDBACK] = { .length = sizeof(FeedbackMessage), .name = "Feedback"},
+	[MESSAGE_FF_UPLOAD] = { .length = sizeof(FFUploadMessage), .name = "FFUpload"},
+	[MESSAGE_FF_ERASE] = { .length = sizeof(FFEraseMessage), .name = "FFErase"},
+	[MESSAGE_SLOT] = { .length = sizeof(SlotMessage), .name = "Slot"},
 	[MESSAGE_SUCCESS] = { .length = sizeof(SuccessMessage), .name = "Success"},
 	[MESSAGE_VERSION_MISMATCH] = { .length = sizeof(VersionMismatchMessage), .name = "VersionMismatch"},
 	[MESSAGE_INVALID_PASSWORD] = { .length = 1, .name = "PasswordInvalid"},
@@ -20,6 +35,8 @@ struct MessageInfo MESSAGE_TYPES_INFO[256] = {
 	[MESSAGE_CLIENT_SLOT_IN_USE] = { .length = 1, .name = "Occupied"},
 	[MESSAGE_CLIENT_SLOTS_EXHAUSTED] = { .length = 1, .name = "Exhausted"},
 	[MESSAGE_QUIT] = { .length = 1, .name = "Quit"},
+	[MESSAGE_PONG] = { .length = sizeof(PingMessage), .name = "Pong"},
+	[MESSAGE_EVENT_MASK] = { .length = sizeof(EventMaskMessage), .name = "EventMask"},
 };
 
 char* get_message_name(uint8_t msg) {
@@ -27,7 +44,7 @@ char* get_message_name(uint8_t msg) {
 }
 
 int get_size_from_command(uint8_t* buf, unsigned len) {
-	if (buf[0] == MESSAGE_PASSWORD || buf[0] == MESSAGE_DEVICE) {
+	if (buf[0] == MESSAGE_PASSWORD || buf[0] == MESSAGE_DEVICE || buf[0] == MESSAGE_EVENT_MASK || buf[0] == MESSAGE_SLOT) {
 		if (len > 1) {
 			return MESSAGE_TYPES_INFO[buf[0]].length + buf[1];
 		} else {
@@ -37,3 +54,162 @@ int get_size_from_command(uint8_t* buf, unsigned len) {
 		return MESSAGE_TYPES_INFO[buf[0]].length;
 	}
 }
+
+// the vectorized decoder stores type, code and value of an event as one 8 byte block
+_Static_assert(offsetof(struct input_event, code) == offsetof(struct input_event, type) + 2
+		&& offsetof(struct input_event, value) == offsetof(struct input_event, type) + 4,
+		"unexpected struct input_event layout");
+
+static size_t decode_data_scalar(uint8_t* buf, struct input_event* events, size_t max) {
+	DataMessage* msg;
+	size_t u;
+
+	for (u = 0; u < max && buf[u * sizeof(DataMessage)] == MESSAGE_DATA; u++) {
+		msg = (DataMessage*) (buf + u * sizeof(DataMessage));
+		events[u].time.tv_sec = 0;
+		events[u].time.tv_usec = 0;
+		events[u].type = be16toh(msg->type);
+		events[u].code = be16toh(msg->code);
+		events[u].value = be32toh(msg->value);
+	}
+	return u;
+}
+
+#ifdef DATA_DECODE_SSSE3
+/*
+ * Decodes two messages per iteration: the 8 payload bytes of each message
+ * are loaded into one half of a register and byte-swapped with a single shuffle.
+ */
+__attribute__((target("ssse3")))
+static size_t decode_data_ssse3(uint8_t* buf, struct input_event* events, size_t max) {
+	const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 7, 6, 5, 4, 9, 8, 11, 10, 15, 14, 13, 12);
+	__m128i first, second, payload;
+	size_t u;
+
+	for (u = 0; u + 2 <= max; u += 2) {
+		if (buf[u * sizeof(DataMessage)] != MESSAGE_DATA || buf[(u + 1) * sizeof(DataMessage)] != MESSAGE_DATA) {
+			break;
+		}
+		first = _mm_loadl_epi64((__m128i*) (buf + u * sizeof(DataMessage) + 1));
+		second = _mm_loadl_epi64((__m128i*) (buf + (u + 1) * sizeof(DataMessage) + 1));
+		payload = _mm_shuffle_epi8(_mm_unpacklo_epi64(first, second), swap);
+
+		events[u].time.tv_sec = 0;
+		events[u].time.tv_usec = 0;
+		events[u + 1].time.tv_sec = 0;
+		events[u + 1].time.tv_usec = 0;
+		_mm_storel_epi64((__m128i*) &events[u].type, payload);
+		_mm_storeh_pd((double*) &events[u + 1].type, _mm_castsi128_pd(payload));
+	}
+
+	return u + decode_data_scalar(buf + u * sizeof(DataMessage), events + u, max - u);
+}
+#endif
+
+/**
+ * Decodes the run of consecutive, complete DATA messages at the start of buf
+ * (at most max) into events. Returns the number of messages decoded.
+ */
+size_t decode_data_messages(uint8_t* buf, size_t len, struct input_event* events, size_t max) {
+	if (max > len / sizeof(DataMessage)) {
+		max = len / sizeof(DataMessage);
+	}
+
+#ifdef DATA_DECODE_SSSE3
+	if (__builtin_cpu_supports("ssse3")) {
+		return decode_data_ssse3(buf, events, max);
+	}
+#endif
+	return decode_data_scalar(buf, events, max);
+}
+
+// collects the parameters of an effect in the order of struct ff_effect, returns their number
+static size_t ff_effect_params(struct ff_effect* effect, uint16_t* params[FF_PARAMS_MAX]) {
+	struct ff_envelope* envelope = NULL;
+	size_t count = 0, u;
+
+	switch (effect->type) {
+		case FF_CONSTANT:
+			params[count++] = (uint16_t*) &effect->u.constant.level;
+			envelope = &effect->u.constant.envelope;
+			break;
+		case FF_RAMP:
+			params[count++] = (uint16_t*) &effect->u.ramp.start_level;
+			params[count++] = (uint16_t*) &effect->u.ramp.end_level;
+			envelope = &effect->u.ramp.envelope;
+			break;
+		case FF_PERIODIC:
+			//custom waveforms are not transferred
+			params[count++] = &effect->u.periodic.waveform;
+			params[count++] = &effect->u.periodic.period;
+			params[count++] = (uint16_t*) &effect->u.periodic.magnitude;
+			params[count++] = (uint16_t*) &effect->u.periodic.offset;
+			params[count++] = &effect->u.periodic.phase;
+			envelope = &effect->u.periodic.envelope;
+			break;
+		case FF_SPRING:
+		case FF_FRICTION:
+		case FF_DAMPER:
+		case FF_INERTIA:
+			for (u = 0; u < 2; u++) {
+				params[count++] = &effect->u.condition[u].right_saturation;
+				params[count++] = &effect->u.condition[u].left_saturation;
+				params[count++] = (uint16_t*) &effect->u.condition[u].right_coeff;
+				params[count++] = (uint16_t*) &effect->u.condition[u].left_coeff;
+				params[count++] = &effect->u.condition[u].deadband;
+				params[count++] = (uint16_t*) &effect->u.condition[u].center;
+			}
+			break;
+		case FF_RUMBLE:
+			params[count++] = &effect->u.rumble.strong_magnitude;
+			params[count++] = &effect->u.rumble.weak_magnitude;
+			break;
+	}
+
+	if (envelope) {
+		params[count++] = &envelope->attack_length;
+		params[count++] = &envelope->attack_level;
+		params[count++] = &envelope->fade_length;
+		params[count++] = &envelope->fade_level;
+	}
+	return count;
+}
+
+// encodes an effect into an FF_UPLOAD message
+void encode_ff_effect(FFUploadMessage* msg, struct ff_effect* effect) {
+	uint16_t* params[FF_PARAMS_MAX];
+	size_t count = ff_effect_params(effect, params), u;
+
+	memset(msg, 0, sizeof(FFUploadMessage));
+	msg->msg_type = MESSAGE_FF_UPLOAD;
+	msg->type = htobe16(effect->type);
+	msg->id = htobe16(effect->id);
+	msg->direction = htobe16(effect->direction);
+	msg->trigger_button = htobe16(effect->trigger.button);
+	msg->trigger_interval = htobe16(effect->trigger.interval);
+	msg->replay_length = htobe16(effect->replay.length);
+	msg->replay_delay = htobe16(effect->replay.delay);
+	for (u = 0; u < count; u++) {
+		msg->params[u] = htobe16(*params[u]);
+	}
+}
+
+// decodes the effect of an FF_UPLOAD message, parameters of unknown effect types are ignored
+void decode_ff_effect(FFUploadMessage* msg, struct ff_effect* effect) {
+	uint16_t* params[FF_PARAMS_MAX];
+	size_t count, u;
+
+	memset(effect, 0, sizeof(struct ff_effect));
+	effect->type = be16toh(msg->type);
+	effect->id = be16toh(msg->id);
+	effect->direction = be16toh(msg->direction);
+	effect->trigger.button = be16toh(msg->trigger_button);
+	effect->trigger.interval = be16toh(msg->trigger_interval);
+	effect->replay.length = be16toh(msg->replay_length);
+	effect->replay.delay = be16toh(msg->replay_delay);
+
+	count = ff_effect_params(effect, params);
+	for (u = 0; u < count; u++) {
+		*params[u] = be16toh(msg->params[u]);
+	}
+}
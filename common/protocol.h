@@ -3,13 +3,18 @@
 #include <inttypes.h>
 #include <linux/input.h>
 
-#define PROTOCOL_VERSION 0x05
+#define PROTOCOL_VERSION 0x0A
 #define INPUT_BUFFER_SIZE 1024
 #define DEFAULT_PASSWORD "foobar"
 #define DEFAULT_HOST "::"
 #define DEFAULT_PORT "9292"
+// force feedback effect slots of devices created by the server
+#define FF_EFFECTS_MAX 16
+// 16 bit parameters of the largest effect type (two conditions) carried by FF_UPLOAD
+#define FF_PARAMS_MAX 12
 
-#pragma pack(1)
+// wire messages are packed, the pack setting is restored after their declarations
+#pragma pack(push, 1)
 
 enum MESSAGE_TYPES {
 	MESSAGE_RESERVED_UNCONN = 0x00,
@@ -19,7 +24,14 @@ enum MESSAGE_TYPES {
 	MESSAGE_DEVICE = 0x04,
 	MESSAGE_SETUP_END = 0x05,
 	MESSAGE_REQUEST_EVENT = 0x06,
+	MESSAGE_PING = 0x07,
+	MESSAGE_RING = 0x08,
+	MESSAGE_OPEN = 0x09,
 	MESSAGE_DATA = 0x10,
+	MESSAGE_FEEDBACK = 0x11,
+	MESSAGE_FF_UPLOAD = 0x12,
+	MESSAGE_FF_ERASE = 0x13,
+	MESSAGE_SLOT = 0x20,
 	MESSAGE_SUCCESS = 0xF0,
 	MESSAGE_VERSION_MISMATCH = 0xF1,
 	MESSAGE_INVALID_PASSWORD = 0xF2,
@@ -29,7 +41,9 @@ enum MESSAGE_TYPES {
 	MESSAGE_SETUP_REQUIRED = 0xF6,
 	MESSAGE_CLIENT_SLOT_IN_USE = 0xF7,
 	MESSAGE_CLIENT_SLOTS_EXHAUSTED = 0xF8,
-	MESSAGE_QUIT = 0xF9
+	MESSAGE_QUIT = 0xF9,
+	MESSAGE_PONG = 0xFA,
+	MESSAGE_EVENT_MASK = 0xFB
 };
 
 struct MessageInfo {
@@ -75,6 +89,69 @@ typedef struct {
 	__s32 value;
 } DataMessage;
 
+/*
+ * Sent by the server for LED changes and force feedback playback on the device
+ * of a slot. EV_FF codes below FF_EFFECTS_MAX are effect ids assigned by the server.
+ */
+typedef struct {
+	uint8_t msg_type;
+	uint16_t type;
+	uint16_t code;
+	__s32 value;
+} FeedbackMessage;
+
+/*
+ * Effect in network byte order, id is the id assigned by the server. params holds
+ * the parameters of the effect type in the order of struct ff_effect, unused ones are 0.
+ */
+typedef struct {
+	uint8_t msg_type;
+	uint16_t type;
+	int16_t id;
+	uint16_t direction;
+	uint16_t trigger_button;
+	uint16_t trigger_interval;
+	uint16_t replay_length;
+	uint16_t replay_delay;
+	uint16_t params[FF_PARAMS_MAX];
+} FFUploadMessage;
+
+typedef struct {
+	uint8_t msg_type;
+	int16_t id;
+} FFEraseMessage;
+
+typedef struct {
+	uint8_t msg_type;
+	uint32_t cookie;
+} PingMessage;
+
+/*
+ * Hands a shared memory event ring to the server, only on the UNIX socket.
+ * The memfd of the ring and its eventfd are attached as SCM_RIGHTS.
+ */
+typedef struct {
+	uint8_t msg_type;
+	uint32_t size;
+} RingMessage;
+
+// opens another slot on an authenticated connection, 0 selects a free slot
+typedef struct {
+	uint8_t msg_type;
+	uint8_t slot;
+} OpenMessage;
+
+/*
+ * Carries complete messages of a slot opened with OPEN, in both directions.
+ * length counts the bytes in messages, envelopes are not nested.
+ */
+typedef struct {
+	uint8_t msg_type;
+	uint8_t length;
+	uint8_t slot;
+	uint8_t messages[];
+} SlotMessage;
+
 typedef struct {
 	uint8_t msg_type;
 	uint8_t version;
@@ -85,6 +162,22 @@ typedef struct {
 	uint8_t slot;
 } SuccessMessage;
 
+/*
+ * masks holds a sequence of entries: uint8_t type, uint8_t bytes and a bitmap
+ * of the accepted codes of that type (bit n of byte n / 8). The leading entry
+ * with type 0 (EV_SYN) holds the bitmap of accepted event types instead.
+ */
+typedef struct {
+	uint8_t msg_type;
+	uint8_t length;
+	uint8_t masks[];
+} EventMaskMessage;
+
+#pragma pack(pop)
+
 extern struct MessageInfo MESSAGE_TYPES_INFO[256];
 char* get_message_name(uint8_t msg);
 int get_size_from_command(uint8_t* buf, unsigned len);
+size_t decode_data_messages(uint8_t* buf, size_t len, struct input_event* events, size_t max);
+void encode_ff_effect(FFUploadMessage* msg, struct ff_effect* effect);
+void decode_ff_effect(FFUploadMessage* msg, struct ff_effect* effect);
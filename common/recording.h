@@ -0,0 +1,44 @@
+#pragma once
+
+#include <inttypes.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+/*
+ * Event stream recordings consist of a recording_header, the capability table
+ * (header.num_capabilities entries of recording_capability), padding up to
+ * header.header_length and an append-only sequence of fixed-size recording_event
+ * records. All fields are stored in host byte order.
+ */
+
+#define RECORDING_MAGIC "NGPADREC"
+#define RECORDING_VERSION 1
+// records start at a multiple of this, so the event array can be used from an mmap()ed file directly
+#define RECORDING_ALIGN 16
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_length;
+	uint64_t start_time;
+	struct input_id id;
+	uint32_t num_capabilities;
+	uint32_t reserved;
+	char name[UINPUT_MAX_NAME_SIZE];
+	struct input_absinfo absinfo[ABS_CNT];
+} recording_header;
+
+typedef struct {
+	uint16_t type;
+	uint16_t code;
+} recording_capability;
+
+typedef struct {
+	uint64_t time; /* nanoseconds since the start of the recording, CLOCK_MONOTONIC */
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+} recording_event;
+
+#define recording_header_length(caps) \
+	((((sizeof(recording_header) + (caps) * sizeof(recording_capability)) + RECORDING_ALIGN - 1) / RECORDING_ALIGN) * RECORDING_ALIGN)
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "protocol.h"
+#include "ring.h"
+
+size_t ring_bytes(uint32_t size){
+	return sizeof(ring_shared) + (size_t) size * sizeof(ring_event);
+}
+
+static bool ring_size_valid(uint32_t size){
+	return size && size <= RING_MAX_SIZE && !(size & (size - 1));
+}
+
+static bool ring_map(LOGGER log, input_ring* ring, uint32_t size){
+	ring->bytes = ring_bytes(size);
+	ring->mask = size - 1;
+	ring->shared = mmap(NULL, ring->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+	if(ring->shared == MAP_FAILED){
+		logprintf(log, LOG_ERROR, "Failed to map event ring: %s\n", strerror(errno));
+		ring->shared = NULL;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Creates a ring of size events (a power of two) for the producer. The segment
+ * is sealed against resizing, so the consumer can map it without risking SIGBUS.
+ */
+bool ring_create(LOGGER log, input_ring* ring, uint32_t size){
+	memset(ring, 0, sizeof(input_ring));
+	ring->event_fd = -1;
+
+	if(!ring_size_valid(size)){
+		logprintf(log, LOG_ERROR, "Ring size %u is not a power of two up to %u\n", size, RING_MAX_SIZE);
+		return false;
+	}
+
+	ring->memfd = memfd_create("input-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(ring->memfd < 0){
+		logprintf(log, LOG_ERROR, "Failed to create ring segment: %s\n", strerror(errno));
+		return false;
+	}
+
+	if(ftruncate(ring->memfd, ring_bytes(size)) < 0
+			|| fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0){
+		logprintf(log, LOG_ERROR, "Failed to size ring segment: %s\n", strerror(errno));
+		ring_close(ring);
+		return false;
+	}
+
+	ring->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(ring->event_fd < 0 || !ring_map(log, ring, size)){
+		logprintf(log, LOG_ERROR, "Failed to set up the ring\n");
+		ring_close(ring);
+		return false;
+	}
+
+	ring->shared->magic = RING_MAGIC;
+	ring->shared->size = size;
+	atomic_init(&ring->shared->head, 0);
+	atomic_init(&ring->shared->tail, 0);
+	return true;
+}
+
+/**
+ * Maps a ring received from a producer. The ring takes ownership of both descriptors.
+ */
+bool ring_attach(LOGGER log, input_ring* ring, int memfd, int event_fd, uint32_t size){
+	struct stat info;
+	int seals;
+
+	memset(ring, 0, sizeof(input_ring));
+	ring->memfd = memfd;
+	ring->event_fd = event_fd;
+
+	if(!ring_size_valid(size)){
+		logprintf(log, LOG_WARNING, "Ring size %u is not a power of two up to %u\n", size, RING_MAX_SIZE);
+		ring_close(ring);
+		return false;
+	}
+
+	// the segment must not shrink below the mapping later on
+	seals = fcntl(memfd, F_GET_SEALS);
+	if(seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(memfd, &info) < 0 || info.st_size < ring_bytes(size)){
+		logprintf(log, LOG_WARNING, "Ring segment is not sealed or too small\n");
+		ring_close(ring);
+		return false;
+	}
+
+	if(!ring_map(log, ring, size)){
+		ring_close(ring);
+		return false;
+	}
+
+	if(ring->shared->magic != RING_MAGIC || ring->shared->size != size){
+		logprintf(log, LOG_WARNING, "Ring segment is not initialized\n");
+		ring_close(ring);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Sends a RING message with the descriptors of the ring to the server. A slot
+ * other than 0 wraps the message into a SLOT envelope for a multiplexed slot.
+ */
+bool ring_offer(LOGGER log, int sock_fd, input_ring* ring, uint8_t slot){
+	uint8_t offer[sizeof(SlotMessage) + sizeof(RingMessage)];
+	SlotMessage* envelope = (SlotMessage*) offer;
+	RingMessage msg = {
+		.msg_type = MESSAGE_RING,
+		.size = htobe32(ring->shared->size)
+	};
+	struct iovec iov = {
+		.iov_base = &msg,
+		.iov_len = sizeof(msg)
+	};
+	union {
+		char buffer[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr header = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buffer,
+		.msg_controllen = sizeof(control.buffer)
+	};
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+	int fds[2] = {ring->memfd, ring->event_fd};
+
+	if(slot){
+		envelope->msg_type = MESSAGE_SLOT;
+		envelope->length = sizeof(msg);
+		envelope->slot = slot;
+		memcpy(envelope->messages, &msg, sizeof(msg));
+		iov.iov_base = offer;
+		iov.iov_len = sizeof(offer);
+	}
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if(sendmsg(sock_fd, &header, MSG_NOSIGNAL) < 0){
+		logprintf(log, LOG_ERROR, "Failed to send ring: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void ring_close(input_ring* ring){
+	if(ring->shared){
+		munmap(ring->shared, ring->bytes);
+		ring->shared = NULL;
+	}
+	if(ring->memfd >= 0){
+		close(ring->memfd);
+		ring->memfd = -1;
+	}
+	if(ring->event_fd >= 0){
+		close(ring->event_fd);
+		ring->event_fd = -1;
+	}
+}
+
+/**
+ * Writes events to the ring, either all of them or none if they do not fit, so
+ * frames are never split. Wakes the consumer if the ring was empty before.
+ */
+size_t ring_write(input_ring* ring, struct input_event* events, size_t count){
+	ring_shared* shared = ring->shared;
+	uint64_t head = atomic_load_explicit(&shared->head, memory_order_relaxed);
+	uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_acquire);
+	uint64_t value = 1;
+	size_t u;
+
+	if(!count || head - tail + count > shared->size){
+		return 0;
+	}
+
+	for(u = 0; u < count; u++){
+		shared->events[(head + u) & ring->mask].type = events[u].type;
+		shared->events[(head + u) & ring->mask].code = events[u].code;
+		shared->events[(head + u) & ring->mask].value = events[u].value;
+	}
+
+	// pairs with the tail store of the consumer: either it sees the new head or we see it caught up
+	atomic_store_explicit(&shared->head, head + count, memory_order_seq_cst);
+	if(atomic_load_explicit(&shared->tail, memory_order_seq_cst) == head){
+		// a failed wakeup only happens on counter overflow, the consumer is awake then
+		ring->wakeups++;
+		if(write(ring->event_fd, &value, sizeof(value)) < 0){
+			ring->wakeups--;
+		}
+	}
+	return count;
+}
+
+/**
+ * Reads up to max events from the ring. Returns the number of events read or -1
+ * if the producer moved the head out of range.
+ */
+ssize_t ring_read(input_ring* ring, struct input_event* events, size_t max){
+	ring_shared* shared = ring->shared;
+	uint64_t tail = atomic_load_explicit(&shared->tail, memory_order_relaxed);
+	uint64_t head = atomic_load_explicit(&shared->head, memory_order_acquire);
+	size_t u, count = (head - tail < max) ? head - tail : max;
+	ring_event* event;
+
+	if(head - tail > ring->mask + 1){
+		return -1;
+	}
+
+	for(u = 0; u < count; u++){
+		event = shared->events + ((tail + u) & ring->mask);
+		events[u].type = event->type;
+		events[u].code = event->code;
+		events[u].value = event->value;
+	}
+
+	atomic_store_explicit(&shared->tail, tail + count, memory_order_seq_cst);
+	return count;
+}
+
+bool ring_empty(input_ring* ring){
+	return atomic_load_explicit(&ring->shared->head, memory_order_seq_cst)
+		== atomic_load_explicit(&ring->shared->tail, memory_order_relaxed);
+}
+
+// resets the eventfd of the consumer, the ring itself is checked with ring_empty
+void ring_clear_wakeup(input_ring* ring){
+	uint64_t value;
+
+	if(read(ring->event_fd, &value, sizeof(value)) > 0){
+		ring->wakeups += value;
+	}
+}
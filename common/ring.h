@@ -0,0 +1,60 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <linux/input.h>
+
+#include "../libs/logger.h"
+
+// "ngri", marks an initialized ring segment
+#define RING_MAGIC 0x6e677269
+// events per ring used by default, always a power of two
+#define RING_DEFAULT_SIZE 4096
+// largest ring accepted by the server
+#define RING_MAX_SIZE (1 << 20)
+#define RING_CACHELINE 64
+
+// an event as stored in the ring, host byte order
+typedef struct /*_RING_EVENT*/ {
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+} ring_event;
+
+/*
+ * Single producer, single consumer ring shared through a memfd. head is only
+ * written by the producer and counts the events written, tail is only written
+ * by the consumer and counts the events read. Both live on their own cache line.
+ */
+typedef struct /*_RING_SHARED*/ {
+	uint32_t magic;
+	uint32_t size;
+	_Alignas(RING_CACHELINE) _Atomic uint64_t head;
+	_Alignas(RING_CACHELINE) _Atomic uint64_t tail;
+	_Alignas(RING_CACHELINE) ring_event events[];
+} ring_shared;
+
+/*
+ * One end of a ring. The producer signals event_fd only when it makes the ring
+ * non-empty, the consumer drains the ring until it finds it empty.
+ */
+typedef struct /*_INPUT_RING*/ {
+	ring_shared* shared;
+	size_t bytes;
+	uint32_t mask;
+	int memfd;
+	int event_fd;
+	uint64_t wakeups;
+} input_ring;
+
+size_t ring_bytes(uint32_t size);
+bool ring_create(LOGGER log, input_ring* ring, uint32_t size);
+bool ring_attach(LOGGER log, input_ring* ring, int memfd, int event_fd, uint32_t size);
+bool ring_offer(LOGGER log, int sock_fd, input_ring* ring, uint8_t slot);
+void ring_close(input_ring* ring);
+
+size_t ring_write(input_ring* ring, struct input_event* events, size_t count);
+ssize_t ring_read(input_ring* ring, struct input_event* events, size_t max);
+bool ring_empty(input_ring* ring);
+void ring_clear_wakeup(input_ring* ring);
@@ -1,35 +1,44 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <errno.h>
 #include <linux/input.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <math.h>
+#include <endian.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <sys/un.h>
 
 #include "../libs/logger.h"
 #include "../common/network.h"
 #include "../common/protocol.h"
+#include "../common/osc.h"
 
 #define PROGRAM_NAME		"input-tools OSC translater 0.1"
 #define DEFAULT_OSC_PORT	"8000"
 #define DEFAULT_OSC_HOST	"::"
 #define MSG_MAX 128
+// bundles with a future timetag waiting to be applied
+#define OSC_SCHEDULE_MAX 32
+// OSC senders served, each gets its own slot on the input server
+#define OSC_SENDERS_MAX 8
+// buckets of the sender table, a power of two
+#define OSC_SENDER_BUCKETS 16
+// seconds to wait before connecting a sender to the input server again
+#define OSC_RETRY_INTERVAL 1
 
 volatile sig_atomic_t shutdown_requested = 0;
 
-typedef struct /*_OSC_CHANNEL*/{
-	int code;
-	double min;
-	double max;
-} osc_channel;
-
-typedef struct /*_OSC_CONTROL*/{
-	char* path;
-	int type;
-	unsigned num_channels;
-	osc_channel channels[2];
-} osc_control;
+//stream is set up in main
+LOGGER osc_log = {
+	.verbosity = LOG_INFO
+};
 
 typedef struct /*_GP_CHANNEL*/{
 	int code;
@@ -62,11 +71,149 @@ gp_control gamepad_controls[]  = {
 	{NULL}
 };
 
-osc_control* osc_controls = NULL;
+osc_mapping mapping = {0};
+
+struct {
+	uint64_t datagrams;
+	uint64_t wakeups;
+	uint64_t coalesced;
+	uint64_t rejected;
+} osc_stats = {0};
+
+/*
+ * Bundles with a timetag in the future are copied here and applied as their
+ * own frame once the timetag has passed.
+ */
+typedef struct /*_OSC_SCHEDULED*/{
+	uint64_t due;
+	size_t length;
+	char* data;
+	//sender the bundle came from
+	void* user;
+} osc_scheduled;
+
+osc_scheduled osc_schedule[OSC_SCHEDULE_MAX] = {{0}};
+
+enum /*_OSC_SERVER_STATE*/{
+	OSC_SERVER_CLOSED = 0,
+	OSC_SERVER_CONNECTING,
+	OSC_SERVER_NEGOTIATING,
+	OSC_SERVER_READY
+};
+
+enum /*_OSC_SENDER_STATE*/{
+	OSC_SENDER_CLOSED = 0,
+	//waits for the connection to the server to be ready
+	OSC_SENDER_WAITING,
+	OSC_SENDER_OPENING,
+	OSC_SENDER_SETUP,
+	OSC_SENDER_READY
+};
+
+/*
+ * Every OSC source address drives its own slot on the input server. Senders
+ * are created on their first packet and kept in an open-addressing table
+ * keyed by address. All slots share one connection to the server: the sender
+ * that causes the connection drives the slot of the connection itself, every
+ * other sender claims a slot with OPEN and talks to it in SLOT envelopes.
+ * Datagrams arriving before the slot of their sender is set up are dropped.
+ */
+typedef struct /*_OSC_SENDER*/{
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	uint32_t hash;
+	unsigned number;
+	uint64_t retry;
+	int state;
+	//slot opened with OPEN, 0 for the slot of the connection
+	uint8_t slot;
+	osc_frame frame;
+} osc_sender;
+
+osc_sender* osc_senders[OSC_SENDER_BUCKETS] = {NULL};
+unsigned osc_num_senders = 0;
+
+/*
+ * The connection to the input server. It is set up lazily and set up again after
+ * it fails, at most every OSC_RETRY_INTERVAL seconds. Connect and handshake do not
+ * block, they are driven by the main loop.
+ */
+struct {
+	char* host;
+	char* port;
+	char* name;
+	char* password;
+	//resolved once on startup, connecting never waits for the resolver
+	struct addrinfo* addresses;
+	struct addrinfo unix_address;
+	struct sockaddr_un unix_path;
+	int fd;
+	int state;
+	uint64_t retry;
+	//address to try if the current connect fails, NULL to start over
+	struct addrinfo* next_address;
+	uint8_t reply[INPUT_BUFFER_SIZE];
+	size_t reply_length;
+	//sender driving the slot of the connection
+	osc_sender* primary;
+	//senders waiting for the answer to their OPEN, the server answers in order
+	osc_sender* opening[OSC_SENDERS_MAX];
+	size_t num_opening;
+} input_server = {
+	.fd = -1
+};
+
+//sends messages of a sender, wrapped into envelopes for slots opened with OPEN
+bool osc_sender_send(osc_sender* sender, void* data, size_t len){
+	LOGGER log = {
+		.stream = stderr,
+		.verbosity = 0
+	};
+	uint8_t buffer[INPUT_BUFFER_SIZE];
+	SlotMessage* envelope;
+	uint8_t* pos = data;
+	size_t used = 0, chunk;
+	int bytes;
+
+	if(!sender->slot){
+		return send_message(log, input_server.fd, data, len);
+	}
+
+	while(len > 0){
+		//an envelope holds complete messages, up to 255 bytes of them
+		for(chunk = 0; chunk < len; chunk += bytes){
+			bytes = get_size_from_command(pos + chunk, len - chunk);
+			if(bytes <= 0 || bytes > len - chunk || chunk + bytes > UINT8_MAX){
+				break;
+			}
+		}
+		if(!chunk){
+			fprintf(stderr, "Message 0x%.2x does not fit an envelope\n", pos[0]);
+			return false;
+		}
+
+		if(used + sizeof(SlotMessage) + chunk > sizeof(buffer)){
+			if(!send_message(log, input_server.fd, buffer, used)){
+				return false;
+			}
+			used = 0;
+		}
+
+		envelope = (SlotMessage*) (buffer + used);
+		envelope->msg_type = MESSAGE_SLOT;
+		envelope->length = chunk;
+		envelope->slot = sender->slot;
+		memcpy(envelope->messages, pos, chunk);
+		used += sizeof(SlotMessage) + chunk;
+		pos += chunk;
+		len -= chunk;
+	}
+	return send_message(log, input_server.fd, buffer, used);
+}
 
 // THIS IS CURRENTLY PRETTY HACKY AND NOT USER FRIENDLY AT ALL
 
-int enable_codes(int fd) {
+int enable_codes(osc_sender* sender) {
 
 	int i = 0;
 	RequestEventMessage evmsg = {
@@ -85,18 +232,23 @@ int enable_codes(int fd) {
 
 		if (control.type == EV_ABS) {
 			for (j = 0; j < control.num_channels; j++) {
+				//the axis has to be requested like any other event, the server drops events it was not set up for
+				evmsg.type = EV_ABS;
+				evmsg.code = control.channels[j].code;
+				osc_sender_send(sender, &evmsg, sizeof(evmsg));
+
 				memset(&abs.info, 0, sizeof(abs.info));
 
 				abs.axis = control.channels[j].code;
 				abs.info.minimum = control.channels[j].min;
 				abs.info.maximum = control.channels[j].max;
 
-				send(fd, &abs, sizeof(abs), 0);
+				osc_sender_send(sender, &abs, sizeof(abs));
 			}
 		} else {
 			evmsg.type = control.type;
 			evmsg.code = control.channels[0].code;
-			send(fd, &evmsg, sizeof(evmsg), 0);
+			osc_sender_send(sender, &evmsg, sizeof(evmsg));
 		}
 
 		i++;
@@ -106,130 +258,119 @@ int enable_codes(int fd) {
 }
 
 
-float osc_param_float(uint8_t* buffer, unsigned index){
-	unsigned u;
-	union{
-		float rv;
-		uint8_t in[4];
-	} conv;
+int osc_schedule_add(char* buffer, size_t len, uint64_t due, void* user){
+	size_t u;
 
-	for(u = 0; u < 4; u++){
-		conv.in[3 - u] = buffer[(index * 4) + u];
+	for(u = 0; u < OSC_SCHEDULE_MAX; u++){
+		if(!osc_schedule[u].data){
+			osc_schedule[u].data = malloc(len);
+			if(!osc_schedule[u].data){
+				fprintf(stderr, "Failed to allocate memory\n");
+				return -1;
+			}
+			memcpy(osc_schedule[u].data, buffer, len);
+			osc_schedule[u].length = len;
+			osc_schedule[u].due = due;
+			osc_schedule[u].user = user;
+			return 0;
+		}
 	}
 
-	return conv.rv;
+	fprintf(stderr, "Too many scheduled OSC bundles, applying bundle now\n");
+	return 1;
 }
 
-#define nextdword(a) ((((a) / 4) + (((a) % 4) ? 1:0)) * 4)
-int osc_parse(char* buffer, size_t len, char** path, unsigned* num_args, uint8_t** args){
-	unsigned args_supplied = 0;
-	char* param_str;
-	char* data_off;
-
-	if(!memchr(buffer, 0, len)){
-		fprintf(stderr, "Unterminated path in OSC message\n");
-		return -1;
-	}
-
-	param_str = buffer + nextdword(strlen(buffer) + 1);
-	data_off = param_str + nextdword(strlen(param_str) + 1);
-
-	if(param_str + strlen(param_str) > (buffer + len) || data_off + (4 * args_supplied) > (buffer + len)){
-		fprintf(stderr, "OSC message out of bounds\n");
-		return -1;
-	}
+/**
+ * Answers one reply of the input server during the handshake of a sender.
+ * Returns 1 once the slot is set up, 0 while further replies are expected and
+ * -1 if the server refused the slot.
+ */
+int input_negotiate(osc_sender* sender, uint8_t* reply, char* devname, char* password){
+	switch (reply[0]) {
+		case MESSAGE_EVENT_MASK:
+			//the bridge sends every event it requested, the mask is not needed
+			return 0;
+		case MESSAGE_VERSION_MISMATCH:
+			printf("version mismatch: %.2x (client) != %.2x (server)\n", PROTOCOL_VERSION, reply[1]);
+			return -1;
+		case MESSAGE_INVALID_PASSWORD:
+			printf("invalid password\n");
+			return -1;
+		case MESSAGE_PASSWORD_REQUIRED: {
+			PasswordMessage* pw_msg = calloc(sizeof(PasswordMessage) + strlen(password) + 1, sizeof(char));
+			pw_msg->msg_type = MESSAGE_PASSWORD;
+			pw_msg->length = strlen(password) + 1;
+			strncpy(pw_msg->password, password, pw_msg->length);
+
+			osc_sender_send(sender, pw_msg, sizeof(PasswordMessage) + pw_msg->length);
+			free(pw_msg);
+			return 0;
+		}
+		case MESSAGE_SETUP_REQUIRED: {
+			DeviceMessage* dev_msg = calloc(sizeof(DeviceMessage) + strlen(devname) + 1, sizeof(char));
+			dev_msg->msg_type = MESSAGE_DEVICE;
+			dev_msg->length = strlen(devname) + 1;
+			strncpy(dev_msg->name, devname, dev_msg->length);
 
-	if(*param_str != ','){
-		fprintf(stderr, "Invalid OSC format string %s (offset %zu)\n", param_str, param_str - buffer);
-		return -1;
-	}
+			osc_sender_send(sender, dev_msg, sizeof(DeviceMessage) + dev_msg->length);
+			free(dev_msg);
 
-	args_supplied = strlen(param_str + 1);
+			if (enable_codes(sender) < 0) {
+				return -1;
+			}
 
-	if(path){
-		*path = buffer;
+			uint8_t setup_end = MESSAGE_SETUP_END;
+			osc_sender_send(sender, &setup_end, sizeof(uint8_t));
+			return 0;
+		}
+		case MESSAGE_SUCCESS:
+			return 1;
+		default:
+			printf("Not successful: %s\n", get_message_name(reply[0]));
+			return -1;
 	}
+}
 
-	if(num_args){
-		*num_args = args_supplied;
-	}
+//finds the device range of a gamepad control channel
+int osc_channel_target(int type, osc_channel* channel){
+	size_t u, c;
 
-	if(args){
-		*args = (uint8_t*)data_off;
+	for(u = 0; gamepad_controls[u].name; u++){
+		for(c = 0; gamepad_controls[u].type == type && c < gamepad_controls[u].num_channels; c++){
+			if(gamepad_controls[u].channels[c].code == channel->code){
+				channel->target_min = gamepad_controls[u].channels[c].min;
+				channel->target_max = gamepad_controls[u].channels[c].max;
+				return 0;
+			}
+		}
 	}
-	return 0;
+	return -1;
 }
 
-int input_negotiate(int fd, char* devname, char* password){
-	ssize_t bytes;
-
-	HelloMessage hello_message = {
-		.msg_type = MESSAGE_HELLO,
-		.version = PROTOCOL_VERSION,
-		.slot = 0x00
-	};
-
-	send(fd, &hello_message, sizeof(hello_message), 0);
-
-	uint8_t buf[2] = {0};
-	bytes = recv(fd, buf, sizeof(buf), 0);
+//widens the learned channel ranges of the control being configured
+int configure_message(char* path, unsigned num_args, uint8_t* args, void* user){
+	osc_control* current_osc = user;
+	double value;
+	size_t u;
 
-	if (bytes < 1) {
-		perror("negotiate/recv");
-		return -1;
+	if(num_args != current_osc->num_channels){
+		fprintf(stderr, "Ignoring packet with different number of channels\n");
+		return 0;
 	}
 
-	if (buf[0] == MESSAGE_VERSION_MISMATCH) {
-		printf("version mismatch: %.2x (client) != %.2x (server)\n", PROTOCOL_VERSION, buf[1]);
-		return -1;
-	} else if (buf[0] == MESSAGE_PASSWORD_REQUIRED) {
-		PasswordMessage* pw_msg = calloc(sizeof(PasswordMessage) + strlen(password) + 1, sizeof(char));
-		pw_msg->msg_type = MESSAGE_PASSWORD;
-		pw_msg->length = strlen(password) + 1;
-		strncpy(pw_msg->password, password, pw_msg->length);
-
-		send(fd, pw_msg, sizeof(PasswordMessage) + pw_msg->length, 0);
-		free(pw_msg);
-
-		bytes = recv(fd, buf, sizeof(buf), 0);
-		if (bytes < 1) {
-			perror("negotiate/recv");
-			return -1;
-		}
-
-		if (buf[0] == MESSAGE_INVALID_PASSWORD) {
-			printf("invalid password\n");
-			return -1;
-		}
+	if(!current_osc->path){
+		current_osc->path = strdup(path);
 	}
-
-	if (buf[0] == MESSAGE_SETUP_REQUIRED) {
-		DeviceMessage* dev_msg = calloc(sizeof(DeviceMessage) + strlen(devname) + 1, sizeof(char));
-		dev_msg->msg_type = MESSAGE_DEVICE;
-		dev_msg->length = strlen(devname) + 1;
-		strncpy(dev_msg->name, devname, dev_msg->length);
-
-		send(fd, dev_msg, sizeof(DeviceMessage) + dev_msg->length, 0);
-		free(dev_msg);
-
-		if (enable_codes(fd) < 0) {
-			return -1;
-		}
-
-		uint8_t setup_end = MESSAGE_SETUP_END;
-		send(fd, &setup_end, sizeof(uint8_t), 0);
-
-		bytes = recv(fd, buf, sizeof(buf), 0);
-
-		if (bytes < 1) {
-			perror("negotiate/recv");
-			return -1;
-		}
+	else if(strcmp(current_osc->path, path)){
+		return 0;
 	}
+	fprintf(stderr, ".");
+	fflush(stderr);
 
-	if (buf[0] != MESSAGE_SUCCESS) {
-		printf("Not successful: %s\n", get_message_name(buf[0]));
-		return -1;
+	for(u = 0; u < current_osc->num_channels; u++){
+		value = osc_param_float(args, u);
+		current_osc->channels[u].min = (value < current_osc->channels[u].min) ? value:current_osc->channels[u].min;
+		current_osc->channels[u].max = (value > current_osc->channels[u].max) ? value:current_osc->channels[u].max;
 	}
 	return 0;
 }
@@ -237,15 +378,10 @@ int input_negotiate(int fd, char* devname, char* password){
 int configure_mappings(int osc_fd){
 	gp_control* current_control = gamepad_controls;
 	ssize_t bytes;
-	size_t num_osc = 0, u;
+	size_t u;
 	fd_set read_fds;
 	int status;
 	char buffer[INPUT_BUFFER_SIZE];
-	double value;
-
-	char* path;
-	unsigned num_args;
-	uint8_t* args;
 
 	osc_control template = {
 		.path = NULL,
@@ -263,6 +399,8 @@ int configure_mappings(int osc_fd){
 		current_osc.type = current_control->type;
 		for(u = 0; u < current_osc.num_channels; u++){
 			current_osc.channels[u].code = current_control->channels[u].code;
+			current_osc.channels[u].target_min = current_control->channels[u].min;
+			current_osc.channels[u].target_max = current_control->channels[u].max;
 		}
 
 		//fetch events
@@ -290,28 +428,11 @@ int configure_mappings(int osc_fd){
 						return -1;
 					}
 
-					//parse osc message into buffer
-					if(osc_parse(buffer, bytes, &path, &num_args, &args) < 0){
+					//parse osc message into buffer, timetags do not matter while learning
+					if(osc_packet(osc_log, buffer, bytes, 0, 0, configure_message, NULL, &current_osc) < 0){
 						fprintf(stderr, "Failed to parse OSC data\n");
 						return -1;
 					}
-
-					if(num_args != current_osc.num_channels){
-						fprintf(stderr, "Ignoring packet with different number of channels\n");
-						continue;
-					}
-
-					if(!current_osc.path){
-						current_osc.path = strdup(path);
-					}
-					fprintf(stderr, ".");
-					fflush(stderr);
-
-					for(u = 0; u < current_osc.num_channels; u++){
-						value = osc_param_float(args, u);
-						current_osc.channels[u].min = (value < current_osc.channels[u].min) ? value:current_osc.channels[u].min;
-						current_osc.channels[u].max = (value > current_osc.channels[u].max) ? value:current_osc.channels[u].max;
-					}
 				}
 			}
 		}
@@ -336,14 +457,9 @@ int configure_mappings(int osc_fd){
 				//TODO get confirmation, else again
 				
 				//create osc control
-				osc_controls = realloc(osc_controls, (num_osc + 2) * sizeof(osc_control));
-				if(!osc_controls){
-					fprintf(stderr, "Failed to allocate memory\n");
+				if(osc_mapping_add(osc_log, &mapping, &current_osc) < 0){
 					return -1;
 				}
-				osc_controls[num_osc] = current_osc;
-				osc_controls[num_osc + 1] = template;
-				num_osc++;
 			}
 		}
 		current_control++;
@@ -358,53 +474,549 @@ void signal_handler(int param){
 	shutdown_requested = 1;
 }
 
-int osc_msg_xlate(int osc_fd, int host_fd){
-	struct input_event event;
-	uint8_t msg_data = MESSAGE_DATA;
-	char buffer[INPUT_BUFFER_SIZE];
-	ssize_t bytes;
-	size_t u, c;
+//drops the connection to the input server, every sender has to set up its slot again
+void input_server_reset(){
+	size_t u;
+
+	if(input_server.fd >= 0){
+		close(input_server.fd);
+	}
+	input_server.fd = -1;
+	input_server.state = OSC_SERVER_CLOSED;
+	input_server.reply_length = 0;
+	input_server.primary = NULL;
+	input_server.num_opening = 0;
+
+	for(u = 0; u < OSC_SENDER_BUCKETS; u++){
+		if(osc_senders[u]){
+			osc_senders[u]->state = OSC_SENDER_CLOSED;
+			osc_senders[u]->slot = 0;
+		}
+	}
+}
 
-	char* path;
-	uint8_t* data;
-	unsigned num_args;
+//sends the frames of a sender, frames of senders without a slot are dropped
+int osc_sender_flush(osc_sender* sender){
+	osc_frame* frame = &sender->frame;
+	DataMessage messages[OSC_BATCH_MAX];
+	int status = 0;
+	size_t u;
+
+	osc_frame_end(frame);
+	for(u = 0; u < frame->length; u++){
+		messages[u].msg_type = MESSAGE_DATA;
+		messages[u].type = htobe16(frame->events[u].type);
+		messages[u].code = htobe16(frame->events[u].code);
+		messages[u].value = htobe32(frame->events[u].value);
+	}
 
-	bytes = recv(osc_fd, buffer, sizeof(buffer), 0);
-	if(bytes <= 0){
-		perror("xlate/recv");
+	if(frame->length && sender->state == OSC_SENDER_READY && !osc_sender_send(sender, messages, frame->length * sizeof(DataMessage))){
+		fprintf(stderr, "Connection to input server lost\n");
+		input_server_reset();
+		status = -1;
+	}
+
+	frame->start = 0;
+	frame->length = 0;
+	return status;
+}
+
+//adds the channels of a mapped OSC message to the frame of its sender
+int osc_frame_message(char* path, unsigned num_args, uint8_t* args, void* user){
+	osc_sender* sender = user;
+	osc_control* control;
+	int status;
+
+	control = osc_mapping_find(&mapping, path);
+	if(!control){
+		fprintf(stderr, "Unknown OSC path\n");
+		return 0;
+	}
+
+	if(num_args < control->num_channels){
+		fprintf(stderr, "Ignoring packet for %s with %u of %u channels\n", path, num_args, control->num_channels);
+		return 0;
+	}
+
+	status = osc_frame_add(&sender->frame, control, args);
+	if(status < 0){
+		osc_sender_flush(sender);
+		status = osc_frame_add(&sender->frame, control, args);
+	}
+
+	osc_stats.coalesced += (status > 0) ? 1 : 0;
+	return 0;
+}
+
+//keeps bundles with a future timetag for osc_schedule_run
+int osc_schedule_bundle(char* buffer, size_t len, uint64_t due, void* user){
+	return osc_schedule_add(buffer, len, due, user);
+}
+
+// returns the nanoseconds until the next scheduled bundle is due, -1 if none is scheduled
+int64_t osc_schedule_timeout(uint64_t now){
+	uint64_t next = 0;
+	size_t u;
+
+	for(u = 0; u < OSC_SCHEDULE_MAX; u++){
+		if(osc_schedule[u].data && (!next || osc_schedule[u].due < next)){
+			next = osc_schedule[u].due;
+		}
+	}
+
+	return next ? osc_delay(next, now) : -1;
+}
+
+void osc_sender_name(osc_sender* sender, char* host, size_t len){
+	char port[NI_MAXSERV];
+
+	if(getnameinfo((struct sockaddr*) &sender->addr, sender->addr_len, host, len, port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV)){
+		snprintf(host, len, "sender %u", sender->number + 1);
+		return;
+	}
+	snprintf(host + strlen(host), len - strlen(host), ":%s", port);
+}
+
+//returns the sender for an address, creating it on its first packet
+osc_sender* osc_sender_find(struct sockaddr_storage* addr, socklen_t addr_len){
+	uint32_t hash = osc_hash((uint8_t*) addr, addr_len);
+	size_t bucket;
+	char name[NI_MAXHOST + NI_MAXSERV];
+
+	for(bucket = hash & (OSC_SENDER_BUCKETS - 1); osc_senders[bucket]; bucket = (bucket + 1) & (OSC_SENDER_BUCKETS - 1)){
+		if(osc_senders[bucket]->hash == hash && osc_senders[bucket]->addr_len == addr_len
+				&& !memcmp(&osc_senders[bucket]->addr, addr, addr_len)){
+			return osc_senders[bucket];
+		}
+	}
+
+	if(osc_num_senders >= OSC_SENDERS_MAX){
+		return NULL;
+	}
+
+	osc_senders[bucket] = calloc(1, sizeof(osc_sender));
+	if(!osc_senders[bucket]){
+		fprintf(stderr, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	memcpy(&osc_senders[bucket]->addr, addr, addr_len);
+	osc_senders[bucket]->addr_len = addr_len;
+	osc_senders[bucket]->hash = hash;
+	osc_senders[bucket]->number = osc_num_senders++;
+	osc_frame_init(&osc_senders[bucket]->frame);
+
+	osc_sender_name(osc_senders[bucket], name, sizeof(name));
+	fprintf(stderr, "New OSC sender %s\n", name);
+	return osc_senders[bucket];
+}
+
+//device name of the slot of a sender, the first sender keeps the configured name
+void osc_sender_device(osc_sender* sender, char* name, size_t len){
+	if(sender->number){
+		snprintf(name, len, "%s %u", input_server.name, sender->number + 1);
+		return;
+	}
+	snprintf(name, len, "%s", input_server.name);
+}
+
+//starts the handshake on an established connection
+int input_server_hello(){
+	HelloMessage hello_message = {
+		.msg_type = MESSAGE_HELLO,
+		.version = PROTOCOL_VERSION,
+		.slot = 0x00
+	};
+
+	//frames are sent with blocking writes, replies are read without waiting
+	if(fcntl(input_server.fd, F_SETFL, fcntl(input_server.fd, F_GETFL, 0) & ~O_NONBLOCK) < 0
+			|| send(input_server.fd, &hello_message, sizeof(hello_message), MSG_NOSIGNAL) != sizeof(hello_message)){
 		return -1;
 	}
+	input_server.state = OSC_SERVER_NEGOTIATING;
+	return 0;
+}
 
-	if(osc_parse(buffer, bytes, &path, &num_args, &data) < 0){
-		fprintf(stderr, "Invalid OSC packet\n");
+//starts a non-blocking connect to the next address of the input server
+int input_server_start(){
+	struct addrinfo* address;
+	int fd;
+
+	for(address = input_server.next_address ? input_server.next_address : input_server.addresses; address; address = address->ai_next){
+		fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
+		if(fd < 0){
+			continue;
+		}
+
+		input_server.fd = fd;
+		input_server.next_address = address->ai_next;
+		if(!connect(fd, address->ai_addr, address->ai_addrlen)){
+			if(!input_server_hello()){
+				return 0;
+			}
+		}
+		else if(errno == EINPROGRESS){
+			input_server.state = OSC_SERVER_CONNECTING;
+			return 0;
+		}
+		close(fd);
+		input_server.fd = -1;
+	}
+
+	input_server.next_address = NULL;
+	return -1;
+}
+
+//gives up the connection, the next address of the server is tried right away while negotiating
+void input_server_fail(char* reason){
+	fprintf(stderr, "%s\n", reason);
+	if(input_server.state != OSC_SERVER_READY && input_server.next_address){
+		close(input_server.fd);
+		input_server.fd = -1;
+		input_server.state = OSC_SERVER_CLOSED;
+		input_server.reply_length = 0;
+		if(!input_server_start()){
+			return;
+		}
+		fprintf(stderr, "Failed to connect to input server\n");
+	}
+	input_server_reset();
+}
+
+//claims another slot on the connection for a sender
+int osc_sender_open(osc_sender* sender, uint64_t now){
+	LOGGER log = {
+		.stream = stderr,
+		.verbosity = 0
+	};
+	OpenMessage open_message = {
+		.msg_type = MESSAGE_OPEN,
+		.slot = 0x00
+	};
+
+	sender->retry = now + ((uint64_t) OSC_RETRY_INTERVAL << 32);
+	if(!send_message(log, input_server.fd, &open_message, sizeof(open_message))){
+		input_server_fail("Connection to input server lost");
+		return -1;
+	}
+
+	sender->state = OSC_SENDER_OPENING;
+	input_server.opening[input_server.num_opening++] = sender;
+	return 0;
+}
+
+//starts setting up the slot of a sender, returns 0 once it is set up
+int osc_sender_connect(osc_sender* sender, uint64_t now){
+	if(sender->state == OSC_SENDER_READY){
+		return 0;
+	}
+
+	if(sender->state != OSC_SENDER_CLOSED || now < sender->retry){
+		return -1;
+	}
+
+	switch(input_server.state){
+		case OSC_SERVER_CLOSED:
+			//the first sender on a new connection uses the slot of the connection
+			if(now < input_server.retry){
+				return -1;
+			}
+			input_server.retry = now + ((uint64_t) OSC_RETRY_INTERVAL << 32);
+			input_server.primary = sender;
+			sender->state = OSC_SENDER_WAITING;
+			if(input_server_start() < 0){
+				fprintf(stderr, "Failed to connect to input server\n");
+				input_server_reset();
+			}
+			return -1;
+		case OSC_SERVER_READY:
+			osc_sender_open(sender, now);
+			return -1;
+		default:
+			sender->state = OSC_SENDER_WAITING;
+			return -1;
+	}
+}
+
+//returns the sender of a slot opened with OPEN
+osc_sender* osc_sender_slot(uint8_t slot){
+	size_t u;
+
+	for(u = 0; u < OSC_SENDER_BUCKETS; u++){
+		if(osc_senders[u] && osc_senders[u]->slot && osc_senders[u]->slot == slot){
+			return osc_senders[u];
+		}
+	}
+	return NULL;
+}
+
+//answers one reply of the server to a sender, returns -1 once the slot is gone
+int osc_sender_reply(osc_sender* sender, uint8_t* reply){
+	char name[NI_MAXHOST + NI_MAXSERV];
+	char device_name[256];
+	int status;
+
+	if(reply[0] == MESSAGE_QUIT){
 		return -1;
 	}
 
-	for(u = 0; osc_controls && osc_controls[u].path; u++){
-		if(!strcmp(osc_controls[u].path, path)){
-			//event type
-			event.type = osc_controls[u].type; 
-			for(c = 0; c < osc_controls[u].num_channels; c++){
-				event.code = osc_controls[u].channels[c].code;
-				//send event
-				//FIXME might want to apply internal scaling here
-				event.value = (int)roundf(osc_param_float(data, c));
-				fprintf(stderr, "Event type:%d, code:%d, value:%d (raw %f max %f)\n", event.type, event.code, event.value, osc_param_float(data, c), osc_controls[u].channels[c].max);
-				send(host_fd, &msg_data, 1, 0);
-				send(host_fd, &event, sizeof(struct input_event), 0);
+	//feedback is not forwarded to OSC
+	if(sender->state == OSC_SENDER_READY){
+		return 0;
+	}
+
+	osc_sender_device(sender, device_name, sizeof(device_name));
+	status = input_negotiate(sender, reply, device_name, input_server.password);
+	if(status > 0){
+		osc_sender_name(sender, name, sizeof(name));
+		fprintf(stderr, "OSC sender %s connected as %s\n", name, device_name);
+		sender->state = OSC_SENDER_READY;
+	}
+	return (status < 0) ? -1 : 0;
+}
+
+//the slot of the connection is set up, opens the slots of all senders waiting for it
+int input_server_ready(){
+	uint64_t now = osc_now();
+	size_t u;
+
+	input_server.state = OSC_SERVER_READY;
+	input_server.next_address = NULL;
+	for(u = 0; u < OSC_SENDER_BUCKETS; u++){
+		if(osc_senders[u] && osc_senders[u]->state == OSC_SENDER_WAITING
+				&& osc_sender_open(osc_senders[u], now) < 0){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Handles one message from the input server. Envelopes go to the sender of
+ * their slot, the first envelope of a new slot answers the oldest OPEN.
+ * Returns -1 if the connection was dropped.
+ */
+int input_server_reply(uint8_t* reply){
+	SlotMessage* envelope = (SlotMessage*) reply;
+	osc_sender* sender = input_server.primary;
+	char name[NI_MAXHOST + NI_MAXSERV];
+	size_t pos;
+	int size;
+
+	switch(reply[0]){
+		case MESSAGE_SLOT:
+			sender = osc_sender_slot(envelope->slot);
+			if(!sender && input_server.num_opening){
+				sender = input_server.opening[0];
+				input_server.num_opening--;
+				memmove(input_server.opening, input_server.opening + 1, input_server.num_opening * sizeof(osc_sender*));
+				sender->slot = envelope->slot;
+				sender->state = OSC_SENDER_SETUP;
+			}
+			if(!sender){
+				return 0;
 			}
 
-			//send syn
-			event.type = EV_SYN;
-			event.code = SYN_REPORT;
-			event.value = 0;
-			send(host_fd, &msg_data, 1, 0);
-			send(host_fd, &event, sizeof(struct input_event), 0);
+			for(pos = 0; pos < envelope->length; pos += size){
+				size = get_size_from_command(envelope->messages + pos, envelope->length - pos);
+				if(size <= 0 || size > envelope->length - pos){
+					input_server_fail("Invalid envelope from input server");
+					return -1;
+				}
+
+				if(sender->state != OSC_SENDER_CLOSED && osc_sender_reply(sender, envelope->messages + pos) < 0){
+					osc_sender_name(sender, name, sizeof(name));
+					fprintf(stderr, "Input server closed the slot of %s\n", name);
+					sender->state = OSC_SENDER_CLOSED;
+					sender->slot = 0;
+				}
+			}
 			return 0;
+		case MESSAGE_INVALID_CLIENT_SLOT:
+		case MESSAGE_CLIENT_SLOT_IN_USE:
+		case MESSAGE_CLIENT_SLOTS_EXHAUSTED:
+			//the connection is set up, so this refuses an OPEN
+			if(input_server.state == OSC_SERVER_READY && input_server.num_opening){
+				sender = input_server.opening[0];
+				input_server.num_opening--;
+				memmove(input_server.opening, input_server.opening + 1, input_server.num_opening * sizeof(osc_sender*));
+				osc_sender_name(sender, name, sizeof(name));
+				fprintf(stderr, "Input server refused a slot for %s: %s\n", name, get_message_name(reply[0]));
+				sender->state = OSC_SENDER_CLOSED;
+				return 0;
+			}
+			break;
+	}
+
+	if(osc_sender_reply(sender, reply) < 0){
+		input_server_fail("Failed to negotiate input-server protocol");
+		return -1;
+	}
+
+	if(input_server.state == OSC_SERVER_NEGOTIATING && sender->state == OSC_SENDER_READY){
+		return input_server_ready();
+	}
+	return 0;
+}
+
+//completes the connect to the input server or handles its replies
+void input_server_negotiate(){
+	socklen_t error_len = sizeof(int);
+	int error = 0, size;
+	ssize_t bytes;
+
+	if(input_server.state == OSC_SERVER_CONNECTING){
+		if(getsockopt(input_server.fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error
+				|| input_server_hello() < 0){
+			input_server_fail("Failed to connect to input server");
+		}
+		return;
+	}
+
+	bytes = recv(input_server.fd, input_server.reply + input_server.reply_length, sizeof(input_server.reply) - input_server.reply_length, MSG_DONTWAIT);
+	if(bytes < 0 && (errno == EAGAIN || errno == EINTR)){
+		return;
+	}
+	if(bytes <= 0){
+		input_server_fail("Connection to input server lost");
+		return;
+	}
+	input_server.reply_length += bytes;
+
+	while(input_server.reply_length){
+		size = get_size_from_command(input_server.reply, input_server.reply_length);
+		if(size < 0){
+			input_server_fail("Failed to negotiate input-server protocol");
+			return;
+		}
+		if(!size || size > input_server.reply_length){
+			break;
+		}
+
+		if(input_server_reply(input_server.reply) < 0){
+			return;
+		}
+
+		input_server.reply_length -= size;
+		memmove(input_server.reply, input_server.reply + size, input_server.reply_length);
+	}
+
+	if(input_server.reply_length == sizeof(input_server.reply)){
+		input_server_fail("Failed to negotiate input-server protocol");
+	}
+}
+
+//adds the connection to the input server to the sets of the main loop
+int input_server_select(fd_set* read_fds, fd_set* write_fds, int max_fd){
+	if(input_server.fd < 0){
+		return max_fd;
+	}
+
+	FD_SET(input_server.fd, (input_server.state == OSC_SERVER_CONNECTING) ? write_fds : read_fds);
+	return (input_server.fd > max_fd) ? input_server.fd : max_fd;
+}
+
+//resolves the address of the input server, a path is the UNIX socket of a server on this host
+int input_server_resolve(){
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM
+	};
+	int error;
+
+	if(input_server.host[0] == '/'){
+		if(strlen(input_server.host) >= sizeof(input_server.unix_path.sun_path)){
+			fprintf(stderr, "Socket path %s is too long\n", input_server.host);
+			return -1;
+		}
+		input_server.unix_path.sun_family = AF_UNIX;
+		strncpy(input_server.unix_path.sun_path, input_server.host, sizeof(input_server.unix_path.sun_path) - 1);
+		input_server.unix_address.ai_family = AF_UNIX;
+		input_server.unix_address.ai_socktype = SOCK_SEQPACKET;
+		input_server.unix_address.ai_addr = (struct sockaddr*) &input_server.unix_path;
+		input_server.unix_address.ai_addrlen = sizeof(input_server.unix_path);
+		input_server.addresses = &input_server.unix_address;
+		return 0;
+	}
+
+	error = getaddrinfo(input_server.host, input_server.port, &hints, &input_server.addresses);
+	if(error){
+		fprintf(stderr, "Failed to resolve input server %s: %s\n", input_server.host, gai_strerror(error));
+		return -1;
+	}
+	return 0;
+}
+
+void osc_senders_flush(){
+	size_t u;
+
+	for(u = 0; u < OSC_SENDER_BUCKETS; u++){
+		if(osc_senders[u]){
+			osc_sender_flush(osc_senders[u]);
 		}
 	}
+}
+
+void osc_senders_close(){
+	size_t u;
+
+	for(u = 0; u < OSC_SENDER_BUCKETS; u++){
+		free(osc_senders[u]);
+		osc_senders[u] = NULL;
+	}
+}
+
+// applies all scheduled bundles that are due, each as its own frame
+void osc_schedule_run(){
+	uint64_t now = osc_now();
+	size_t u;
+
+	for(u = 0; u < OSC_SCHEDULE_MAX; u++){
+		if(osc_schedule[u].data && osc_schedule[u].due <= now){
+			if(osc_packet(osc_log, osc_schedule[u].data, osc_schedule[u].length, now, 0, osc_frame_message, osc_schedule_bundle, osc_schedule[u].user) < 0){
+				fprintf(stderr, "Invalid OSC packet\n");
+			}
+			free(osc_schedule[u].data);
+			osc_schedule[u].data = NULL;
+			osc_frame_end(&((osc_sender*) osc_schedule[u].user)->frame);
+		}
+	}
+
+	osc_senders_flush();
+}
+
+//translates one datagram into the frame of its sender
+void osc_datagram_xlate(char* buffer, size_t len, struct sockaddr_storage* addr, socklen_t addr_len, void* user){
+	uint64_t now = *((uint64_t*) user);
+	osc_sender* sender = osc_sender_find(addr, addr_len);
+
+	if(!sender || osc_sender_connect(sender, now) < 0){
+		osc_stats.rejected++;
+		return;
+	}
+
+	//all messages of a packet, including those of nested bundles, end up in the same frame
+	if(osc_packet(osc_log, buffer, len, now, 0, osc_frame_message, osc_schedule_bundle, sender) < 0){
+		fprintf(stderr, "Invalid OSC packet\n");
+	}
+}
+
+/**
+ * Drains all pending datagrams and translates them as one batch, sending one
+ * write per sender. Invalid datagrams are skipped.
+ */
+int osc_msg_xlate(int osc_fd){
+	uint64_t now = osc_now();
+	ssize_t count;
+
+	count = osc_receive(osc_log, osc_fd, 0, osc_datagram_xlate, &now);
+	if(count < 0){
+		return -1;
+	}
 
-	fprintf(stderr, "Unknown OSC path\n");
+	osc_stats.datagrams += count;
+	osc_stats.wakeups++;
+	osc_senders_flush();
 	return 0;
 }
 
@@ -414,14 +1026,21 @@ int main(int argc, char** argv){
 	//name
 	char* osc_port = getenv("OSC_PORT") ? getenv("OSC_PORT"):DEFAULT_OSC_PORT;
 	char* osc_host = getenv("OSC_HOST") ? getenv("OSC_HOST"):DEFAULT_OSC_HOST;
-	char* device_name = getenv("SERVER_NAME") ? getenv("SERVER_NAME"):"OSC Gamepad Bridge";
-	char* input_host = getenv("SERVER_HOST") ? getenv("SERVER_HOST"):DEFAULT_HOST;
-	char* input_port = getenv("SERVER_PORT") ? getenv("SERVER_PORT"):DEFAULT_PORT;
-	char* password = getenv("SERVER_PW") ? getenv("SERVER_PW"):DEFAULT_PASSWORD;
+	char* profile = getenv("OSC_PROFILE");
 
-	int osc_fd, host_fd;
+	int osc_fd, max_fd, status;
+	fd_set read_fds, write_fds;
+	struct timeval timeout;
+	int64_t wait_ns;
 
+	input_server.name = getenv("SERVER_NAME") ? getenv("SERVER_NAME"):"OSC Gamepad Bridge";
+	input_server.host = getenv("SERVER_HOST") ? getenv("SERVER_HOST"):DEFAULT_HOST;
+	input_server.port = getenv("SERVER_PORT") ? getenv("SERVER_PORT"):DEFAULT_PORT;
+	input_server.password = getenv("SERVER_PW") ? getenv("SERVER_PW"):DEFAULT_PASSWORD;
+
+	osc_log.stream = stderr;
 	signal(SIGINT, signal_handler);
+	mapping.deadzone = getenv("OSC_DEADZONE") ? strtod(getenv("OSC_DEADZONE"), NULL):0;
 	fprintf(stderr, "%s\n", PROGRAM_NAME);
 
 	//set stdin nonblocking
@@ -438,40 +1057,73 @@ int main(int argc, char** argv){
 		return EXIT_FAILURE;
 	}
 
-	host_fd = tcp_connect(input_host, input_port);
-	if(host_fd < 0){
-		fprintf(stderr, "Failed to connect to input server\n");
+	//load learned mappings, configure osc input interactively if there are none
+	status = profile ? osc_profile_load(osc_log, &mapping, profile, osc_channel_target) : 1;
+	if(status < 0){
+		fprintf(stderr, "Failed to load OSC mapping profile\n");
 		return EXIT_FAILURE;
 	}
 
-	//negotiate inputserver
-	if(input_negotiate(host_fd, device_name, password) < 0){
-		fprintf(stderr, "Failed to negotiate input-server protocol\n");
-		return EXIT_FAILURE;
+	if(status > 0){
+		if(configure_mappings(osc_fd) < 0){
+			fprintf(stderr, "Failed to configure OSC mappings\n");
+			return EXIT_FAILURE;
+		}
+
+		if(profile && osc_profile_save(osc_log, &mapping, profile) < 0){
+			fprintf(stderr, "Continuing without saving the mappings\n");
+		}
 	}
-	
-	//configure osc input
-	if(configure_mappings(osc_fd) < 0){
-		fprintf(stderr, "Failed to configure OSC mappings\n");
+
+	if(osc_mapping_index(osc_log, &mapping) < 0 || input_server_resolve() < 0){
 		return EXIT_FAILURE;
 	}
 
 	//xlate events
 	while(!shutdown_requested){
-		if(osc_msg_xlate(osc_fd, host_fd) < 0){
+		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		FD_SET(osc_fd, &read_fds);
+		max_fd = input_server_select(&read_fds, &write_fds, osc_fd);
+		wait_ns = osc_schedule_timeout(osc_now());
+		timeout.tv_sec = wait_ns / 1000000000LL;
+		timeout.tv_usec = (wait_ns % 1000000000LL) / 1000;
+		status = select(max_fd + 1, &read_fds, &write_fds, NULL, (wait_ns < 0) ? NULL : &timeout);
+		if(status < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("xlate/select");
+			break;
+		}
+
+		if(input_server.fd >= 0 && (FD_ISSET(input_server.fd, &read_fds) || FD_ISSET(input_server.fd, &write_fds))){
+			input_server_negotiate();
+		}
+		osc_schedule_run();
+
+		//every sender is set up on the input server with its first packet
+		if(FD_ISSET(osc_fd, &read_fds) && osc_msg_xlate(osc_fd) < 0){
 			fprintf(stderr, "Translation failed\n");
 			break;
 		}
 	}
 
 	//free mappings
-	for(u = 0; osc_controls && osc_controls[u].path; u++){
-		free(osc_controls[u].path);
+	for(u = 0; u < OSC_SCHEDULE_MAX; u++){
+		free(osc_schedule[u].data);
 	}
-	free(osc_controls);
+	osc_mapping_free(&mapping);
 
+	fprintf(stderr, "Translated %llu datagrams from %u senders in %llu batches, %llu values coalesced, %llu datagrams rejected\n",
+			(unsigned long long) osc_stats.datagrams, osc_num_senders, (unsigned long long) osc_stats.wakeups,
+			(unsigned long long) osc_stats.coalesced, (unsigned long long) osc_stats.rejected);
 	fprintf(stderr, "Shutting down\n");
+	input_server_reset();
+	osc_senders_close();
+	if(input_server.addresses != &input_server.unix_address){
+		freeaddrinfo(input_server.addresses);
+	}
 	close(osc_fd);
-	close(host_fd);
 	return EXIT_SUCCESS;
 }
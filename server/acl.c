@@ -0,0 +1,201 @@
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libevdev/libevdev.h>
+
+#include "../libs/logger.h"
+#include "acl.h"
+
+bool acl_add_file(LOGGER log, acl_config* acl, char* path, bool whitelist){
+	if(acl->num_files >= ACL_MAX_FILES){
+		logprintf(log, LOG_ERROR, "Too many ACL files, at most %d are supported\n", ACL_MAX_FILES);
+		return false;
+	}
+
+	acl->files[acl->num_files].path = path;
+	acl->files[acl->num_files].whitelist = whitelist;
+	acl->num_files++;
+	return true;
+}
+
+static void acl_set(acl_table* table, unsigned type, unsigned code, bool allow){
+	if(allow){
+		event_bitmap_set(table->allowed, type, code);
+	}
+	else{
+		table->allowed[type][code / EVENT_MAP_BITS] &= ~(1ULL << (code % EVENT_MAP_BITS));
+	}
+}
+
+// applies one file of type.code or type.* lines to the table
+static bool acl_parse(LOGGER log, acl_table* table, acl_file* file){
+	FILE* f = fopen(file->path, "r");
+	char* line = NULL;
+	char* type;
+	char* code;
+	size_t len = 0, line_num = 0;
+	int itype, icode;
+	bool status = true;
+
+	if(!f){
+		logprintf(log, LOG_ERROR, "Cannot open file %s: %s\n", file->path, strerror(errno));
+		return false;
+	}
+
+	if(file->whitelist){
+		memset(table->allowed, 0, sizeof(table->allowed));
+	}
+
+	while(getline(&line, &len, f) != -1){
+		line_num++;
+		line[strcspn(line, "\r\n")] = 0;
+		if(line[0] == '#' || line[0] == 0){
+			continue;
+		}
+
+		type = strtok(line, ".");
+		code = strtok(NULL, ".");
+
+		if(!type || !code){
+			logprintf(log, LOG_ERROR, "%s:%zu: Code not defined. Format is type.code or type.*\n", file->path, line_num);
+			status = false;
+			break;
+		}
+
+		itype = libevdev_event_type_from_name(type);
+		if(itype < 0 || itype >= EV_CNT){
+			logprintf(log, LOG_ERROR, "%s:%zu: Type is not valid.\n", file->path, line_num);
+			status = false;
+			break;
+		}
+
+		if(code[0] == '*'){
+			logprintf(log, LOG_INFO, "Set all events of type %s to %d\n", type, file->whitelist);
+			memset(table->allowed[itype], file->whitelist ? 0xFF : 0, sizeof(table->allowed[itype]));
+			continue;
+		}
+
+		icode = libevdev_event_code_from_name(itype, code);
+		if(icode < 0 || icode >= KEY_CNT){
+			logprintf(log, LOG_ERROR, "%s:%zu: Code is not valid.\n", file->path, line_num);
+			status = false;
+			break;
+		}
+
+		logprintf(log, LOG_INFO, "Set %s.%s to %d\n", type, code, file->whitelist);
+		acl_set(table, itype, icode, file->whitelist);
+	}
+
+	fclose(f);
+	free(line);
+	return status;
+}
+
+/**
+ * Compiles the configured ACL files into a new table. Without any files, all events are allowed.
+ * Returns NULL if a file could not be parsed.
+ */
+acl_table* acl_compile(LOGGER log, acl_config* acl){
+	acl_table* table = malloc(sizeof(acl_table));
+	size_t u;
+
+	if(!table){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		return NULL;
+	}
+
+	memset(table->allowed, 0xFF, sizeof(table->allowed));
+	for(u = 0; u < acl->num_files; u++){
+		if(!acl_parse(log, table, acl->files + u)){
+			free(table);
+			return NULL;
+		}
+	}
+	return table;
+}
+
+bool acl_reload_init(LOGGER log, acl_config* acl){
+	acl->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(acl->event_fd < 0){
+		logprintf(log, LOG_ERROR, "Failed to create eventfd: %s\n", strerror(errno));
+		return false;
+	}
+	atomic_init(&acl->running, false);
+	atomic_init(&acl->pending, NULL);
+	return true;
+}
+
+static void* acl_reload_thread(void* param){
+	acl_config* acl = param;
+	acl_table* table = acl_compile(acl->log, acl);
+	uint64_t signal = 1;
+
+	if(table){
+		//a table that was not picked up yet is superseded
+		free(atomic_exchange(&acl->pending, table));
+		if(write(acl->event_fd, &signal, sizeof(signal)) < 0){
+			logprintf(acl->log, LOG_ERROR, "Failed to signal ACL reload: %s\n", strerror(errno));
+		}
+	}
+	else{
+		logprintf(acl->log, LOG_ERROR, "Failed to reload ACL files, keeping the active rules\n");
+	}
+
+	atomic_store(&acl->running, false);
+	return NULL;
+}
+
+/**
+ * Starts compiling the ACL files in a background thread. The new table is
+ * announced via acl->event_fd and collected with acl_reload_result.
+ */
+bool acl_reload(LOGGER log, acl_config* acl){
+	pthread_attr_t attr;
+	pthread_t thread;
+	int error;
+
+	if(atomic_exchange(&acl->running, true)){
+		logprintf(log, LOG_WARNING, "ACL reload already in progress\n");
+		return false;
+	}
+
+	acl->log = log;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	error = pthread_create(&thread, &attr, acl_reload_thread, acl);
+	pthread_attr_destroy(&attr);
+
+	if(error){
+		logprintf(log, LOG_ERROR, "Failed to start ACL reload: %s\n", strerror(error));
+		atomic_store(&acl->running, false);
+		return false;
+	}
+	return true;
+}
+
+// returns the table compiled by the last reload, if any. The caller takes ownership.
+acl_table* acl_reload_result(acl_config* acl){
+	uint64_t signals;
+
+	if(read(acl->event_fd, &signals, sizeof(signals)) < 0 && errno != EAGAIN){
+		return NULL;
+	}
+	return atomic_exchange(&acl->pending, NULL);
+}
+
+void acl_reload_close(acl_config* acl){
+	//let a running reload finish before its resources go away
+	while(atomic_load(&acl->running)){
+		usleep(1000);
+	}
+
+	if(acl->event_fd >= 0){
+		close(acl->event_fd);
+		acl->event_fd = -1;
+	}
+	free(atomic_exchange(&acl->pending, NULL));
+}
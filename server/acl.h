@@ -0,0 +1,57 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "../libs/logger.h"
+
+// bits per word of the event bitmaps
+#define EVENT_MAP_BITS 64
+// maximum number of white- and blacklist files
+#define ACL_MAX_FILES 16
+
+typedef uint64_t event_bitmap[EV_CNT][KEY_CNT / EVENT_MAP_BITS];
+
+typedef struct {
+	char* path;
+	bool whitelist;
+} acl_file;
+
+// compiled access control list, immutable once published
+typedef struct {
+	event_bitmap allowed;
+} acl_table;
+
+typedef struct {
+	// files are applied in command line order
+	acl_file files[ACL_MAX_FILES];
+	size_t num_files;
+	// signalled by the reload thread when a table is pending
+	int event_fd;
+	LOGGER log;
+	atomic_bool running;
+	_Atomic(acl_table*) pending;
+} acl_config;
+
+static inline bool event_bitmap_test(event_bitmap map, unsigned type, unsigned code) {
+	return type < EV_CNT && code < KEY_CNT && (map[type][code / EVENT_MAP_BITS] >> (code % EVENT_MAP_BITS)) & 1;
+}
+
+static inline void event_bitmap_set(event_bitmap map, unsigned type, unsigned code) {
+	if (type < EV_CNT && code < KEY_CNT) {
+		map[type][code / EVENT_MAP_BITS] |= 1ULL << (code % EVENT_MAP_BITS);
+	}
+}
+
+static inline bool acl_allowed(acl_table* acl, unsigned type, unsigned code) {
+	return event_bitmap_test(acl->allowed, type, code);
+}
+
+bool acl_add_file(LOGGER log, acl_config* acl, char* path, bool whitelist);
+acl_table* acl_compile(LOGGER log, acl_config* acl);
+
+bool acl_reload_init(LOGGER log, acl_config* acl);
+bool acl_reload(LOGGER log, acl_config* acl);
+acl_table* acl_reload_result(acl_config* acl);
+void acl_reload_close(acl_config* acl);
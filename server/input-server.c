@@ -4,12 +4,28 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
-
-#include <libevdev/libevdev.h>
+#include <stddef.h>
 
 #define SERVER_VERSION "InputServer 2.0"
 #define MAX_CLIENTS 8
 #define MAX_WAITING_CLIENTS 8
+// upper bound of messages handled per slot and scheduler pass
+#define MESSAGES_PER_PASS 16
+// recvmmsg() batches read from the OSC socket per scheduler pass
+#define OSC_BATCHES_PER_PASS 1
+// seconds a connection may take to finish HELLO and authentication/setup
+#define DEFAULT_HANDSHAKE_TIMEOUT 10
+#define DEFAULT_SOCKET_MODE "0600"
+// device range of OSC profile channels that do not specify one, the range of the osc-xlater gamepad
+#define OSC_DEFAULT_ABS_MAX 255
+
+enum TIMER_KINDS {
+	TIMER_HANDSHAKE,
+	TIMER_SETUP,
+	TIMER_LEASE
+};
+
+#define timer_client(t) ((gamepad_client*) ((uint8_t*) (t) - offsetof(gamepad_client, timer)))
 
 #include "../libs/easy_args.h"
 #include "../libs/logger.h"
@@ -17,67 +33,476 @@
 #include "../common/strdup.h"
 #include "../common/network.h"
 #include "../common/protocol.h"
+#include "../common/osc.h"
+#include "../common/ring.h"
 
 #include "uinput.h"
+#include "record.h"
+#include "timer.h"
+#include "acl.h"
+#include "remap.h"
 #include "input-server.h"
 
 volatile sig_atomic_t shutdown_server = 0;
+volatile sig_atomic_t reload_acl = 0;
+// eventfd the main loop waits on, set once the ACL reload is initialized
+int reload_wakeup_fd = -1;
 gamepad_client clients[MAX_CLIENTS] = {};
 
 void signal_handler(int param) {
 	shutdown_server = 1;
 }
 
-int client_close(LOGGER log, gamepad_client* client, uint8_t slot, bool cleanup){
+void reload_handler(int param) {
+	uint64_t wakeup = 1;
+	int saved_errno = errno;
+
+	reload_acl = 1;
+	// a SIGHUP between checking reload_acl and entering select() must still wake the loop
+	if (reload_wakeup_fd >= 0 && write(reload_wakeup_fd, &wakeup, sizeof(wakeup)) < 0) {
+		// the counter is already pending
+	}
+	errno = saved_errno;
+}
+
+// updates the handshake state of a slot, connections have to reach MESSAGE_SUCCESS before the deadline
+void client_status(Config* config, gamepad_client* client, uint8_t status) {
+	size_t u;
+
+	client->status = status;
+	if (status == MESSAGE_SUCCESS) {
+		timer_disarm(&config->timers, &client->timer);
+		// a client attaching to a device is sent the effects uploaded on it so far
+		client->effects_pending = 0;
+		for (u = 0; u < FF_EFFECTS_MAX; u++) {
+			if (client->effects[u].msg_type == MESSAGE_FF_UPLOAD) {
+				client->effects_pending |= 1u << u;
+			}
+		}
+	// the deadline runs from the start of the handshake, later steps do not extend it
+	} else if (config->handshake_timeout && !(timer_armed(&client->timer) && client->timer.kind == TIMER_SETUP)) {
+		timer_arm(&config->timers, &client->timer, TIMER_SETUP, config->handshake_timeout * 1000);
+	}
+}
+
+// a slot is connected while it has a connection of its own or is multiplexed over one
+bool client_connected(gamepad_client* client) {
+	return client->fd >= 0 || client->owner;
+}
+
+// closes descriptors passed by a local client that were not claimed by a message
+void client_passed_close(gamepad_client* client) {
+	size_t u;
+
+	for (u = 0; u < 2; u++) {
+		if (client->ring_fds[u] >= 0) {
+			close(client->ring_fds[u]);
+			client->ring_fds[u] = -1;
+		}
+	}
+}
+
+// tears down a connection in the waiting queue, including descriptors a local client passed
+void waiting_close(Config* config, gamepad_client* client) {
+	if (client->fd >= 0) {
+		close(client->fd);
+		client->fd = -1;
+	}
+	client_passed_close(client);
+	client->bytes_available = 0;
+	client->scan_offset = 0;
+	client->output_bytes = 0;
+	timer_disarm(&config->timers, &client->timer);
+}
+
+bool client_send(LOGGER log, gamepad_client* client, uint8_t slot, void* data, size_t len);
+
+int client_close(Config* config, gamepad_client* client, uint8_t slot, bool cleanup){
+	LOGGER log = config->log;
+	uint8_t quit = MESSAGE_QUIT;
+	size_t u;
 	if(cleanup){
 		cleanup_device(log, client);
 	}
 
+	// keep the device for a reconnecting client until the lease runs out
+	if(client->ev_fd >= 0 && config->device_lease){
+		timer_arm(&config->timers, &client->timer, TIMER_LEASE, config->device_lease * 1000);
+	} else {
+		timer_disarm(&config->timers, &client->timer);
+	}
+
 	logprintf(log, LOG_INFO, "[%d] Closing client connection\n", slot);
 
+	// a slot multiplexed over a connection that stays open is told that it is gone
+	if(client->owner && client->owner->fd >= 0){
+		client_send(log, client, slot, &quit, sizeof(quit));
+	}
 	if(client->fd >= 0){
 		close(client->fd);
 		client->fd = -1;
 	}
+	// slots multiplexed over the connection go with it
+	for(u = 0; u < MAX_CLIENTS; u++){
+		if(clients[u].owner == client){
+			client_close(config, clients + u, u, cleanup);
+		}
+	}
+	client->owner = NULL;
+	client_passed_close(client);
+	if(client->ring){
+		logprintf(log, LOG_INFO, "[%d] Closing event ring after %llu wakeups\n", slot, (unsigned long long) client->ring->wakeups);
+		ring_close(client->ring);
+		free(client->ring);
+		client->ring = NULL;
+	}
 	client->status = MESSAGE_RESERVED_UNCONN;
 	client->scan_offset = 0;
+	client->output_bytes = 0;
 
-	//remove this, as when reconnecting we either reuse the old device or re-setup a new one
-	//in the first case, we dont need to set the bits again
-	//in the second case, we want a clean slate
-	free(client->meta.enabled_events);
-	client->meta.enabled_events = NULL;
-	client->meta.enabled_events_length = 0;
+	//a device that is kept keeps its capabilities, they are needed to apply ACL changes.
+	//without a device, the next client starts with a clean slate
+	if(client->ev_fd < 0){
+		free(client->meta.enabled_events);
+		client->meta.enabled_events = NULL;
+		client->meta.enabled_events_length = 0;
+	}
 	return 0;
 }
 
-bool client_connection(Config* config, int listener, gamepad_client waiting_queue[MAX_WAITING_CLIENTS]){
+/**
+ * Sends the contents of the output buffer without blocking.
+ * Returns false when the connection failed.
+ */
+bool client_flush(LOGGER log, gamepad_client* client, uint8_t slot) {
+	ssize_t bytes;
+
+	while (client->output_bytes > 0) {
+		bytes = send(client->fd, client->output_buffer, client->output_bytes, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (bytes < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return true;
+			}
+			logprintf(log, LOG_ERROR, "[%d] Failed to send: %s\n", slot, strerror(errno));
+			return false;
+		}
+
+		client->output_bytes -= bytes;
+		memmove(client->output_buffer, client->output_buffer + bytes, client->output_bytes);
+	}
+
+	return true;
+}
+
+// length of the complete messages at the start of data that fit into one envelope
+size_t envelope_chunk(uint8_t* data, size_t len) {
+	size_t chunk;
+	int bytes;
+
+	for (chunk = 0; chunk < len; chunk += bytes) {
+		bytes = get_size_from_command(data + chunk, len - chunk);
+		if (bytes <= 0 || bytes > len - chunk || chunk + bytes > UINT8_MAX) {
+			break;
+		}
+	}
+	return chunk;
+}
+
+/**
+ * Returns the bytes client_send queues on the connection for the messages in data,
+ * including the envelopes of a multiplexed slot, or 0 if they can not be enveloped.
+ */
+size_t client_send_length(gamepad_client* client, uint8_t* data, size_t len) {
+	size_t total = 0, chunk;
+
+	if (!client->owner) {
+		return len;
+	}
+
+	while (len > 0) {
+		chunk = envelope_chunk(data, len);
+		if (!chunk) {
+			return 0;
+		}
+		total += sizeof(SlotMessage) + chunk;
+		data += chunk;
+		len -= chunk;
+	}
+	return total;
+}
+
+/**
+ * Queues a message for the client and tries to send it right away.
+ * Data the peer does not accept immediately is flushed once the socket becomes writable.
+ * Returns false when the connection failed or the output buffer overflowed, nothing is
+ * queued in that case.
+ */
+bool client_send(LOGGER log, gamepad_client* client, uint8_t slot, void* data, size_t len) {
+	gamepad_client* connection = client->owner ? client->owner : client;
+	size_t total = client_send_length(client, data, len);
+	SlotMessage envelope = {
+		.msg_type = MESSAGE_SLOT,
+		.slot = slot + 1
+	};
+	uint8_t* pos = data;
+	size_t chunk;
+
+	if (!total && len) {
+		logprintf(log, LOG_ERROR, "[%d] Message 0x%.2x does not fit an envelope\n", slot, pos[0]);
+		return false;
+	}
+	if (connection->output_bytes + total > OUTPUT_BUFFER_SIZE) {
+		logprintf(log, LOG_ERROR, "[%d] Output buffer overflow, peer is not reading\n", slot);
+		return false;
+	}
+
+	if (!client->owner) {
+		memcpy(client->output_buffer + client->output_bytes, data, len);
+		client->output_bytes += len;
+		return client_flush(log, client, slot);
+	}
+
+	// messages of a multiplexed slot are wrapped into envelopes on its connection
+	while (len > 0) {
+		chunk = envelope_chunk(pos, len);
+		envelope.length = chunk;
+		memcpy(connection->output_buffer + connection->output_bytes, &envelope, sizeof(envelope));
+		memcpy(connection->output_buffer + connection->output_bytes + sizeof(envelope), pos, chunk);
+		connection->output_bytes += sizeof(envelope) + chunk;
+		pos += chunk;
+		len -= chunk;
+	}
+	return client_flush(log, connection, slot);
+}
+
+/**
+ * Sends the effect uploads and erasures of a device its client has not seen yet. They were
+ * acknowledged to the application already and must not be lost, effects that do not fit the
+ * output buffer stay pending until it drains. Returns false if the slot was closed.
+ */
+bool client_effects(Config* config, gamepad_client* client, uint8_t slot) {
+	gamepad_client* connection = client->owner ? client->owner : client;
+	FFEraseMessage erase = {
+		.msg_type = MESSAGE_FF_ERASE
+	};
+	uint8_t* message;
+	size_t length;
+	int16_t id;
+
+	if (connection->fd < 0 || client->status != MESSAGE_SUCCESS) {
+		return true;
+	}
+
+	for (id = 0; id < FF_EFFECTS_MAX && client->effects_pending; id++) {
+		if (!(client->effects_pending & (1u << id))) {
+			continue;
+		}
+
+		message = (uint8_t*) (client->effects + id);
+		length = sizeof(FFUploadMessage);
+		if (client->effects[id].msg_type != MESSAGE_FF_UPLOAD) {
+			erase.id = htobe16(id);
+			message = (uint8_t*) &erase;
+			length = sizeof(erase);
+		}
+
+		if (connection->output_bytes + client_send_length(client, message, length) > OUTPUT_BUFFER_SIZE) {
+			return true;
+		}
+		if (!client_send(config->log, client, slot, message, length)) {
+			client_close(config, client, slot, false);
+			return false;
+		}
+		client->effects_pending &= ~(1u << id);
+	}
+	return true;
+}
+
+/**
+ * Forwards force feedback and LED requests of a device to its client. Effects are sent
+ * first, playback arriving while the client is away or can not keep up is dropped,
+ * stale feedback is of no use.
+ */
+void client_feedback(Config* config, gamepad_client* client, uint8_t slot) {
+	uint8_t buffer[FEEDBACK_BUFFER_SIZE];
+	ssize_t bytes = read_feedback(config->log, client, buffer, slot);
+	gamepad_client* connection = client->owner ? client->owner : client;
+
+	if (bytes < 0 || !client_effects(config, client, slot) || !bytes) {
+		return;
+	}
+
+	// playback must not overtake the upload of its effect
+	if (connection->fd < 0 || client->status != MESSAGE_SUCCESS || client->effects_pending
+			|| connection->output_bytes + client_send_length(client, buffer, bytes) > OUTPUT_BUFFER_SIZE) {
+		client->feedback_dropped += bytes / sizeof(FeedbackMessage);
+		logprintf(config->log, LOG_DEBUG, "[%d] Dropped %zd bytes of feedback\n", slot, bytes);
+		return;
+	}
+
+	if (!client_send(config->log, client, slot, buffer, bytes)) {
+		client_close(config, client, slot, false);
+	}
+}
+
+/**
+ * Builds the bitmap of events a device accepts from its capabilities and the active ACL.
+ * Synchronization events are always allowed.
+ */
+void client_event_map(gamepad_client* client, acl_table* acl) {
+	size_t u;
+	unsigned long type, code;
+
+	memset(client->event_map, 0, sizeof(client->event_map));
+	client->event_map[EV_SYN][0] = (1ULL << SYN_CNT) - 1;
+
+	for (u = 0; u < client->meta.enabled_events_length; u++) {
+		type = client->meta.enabled_events[u].type;
+		code = client->meta.enabled_events[u].code;
+		if (acl_allowed(acl, type, code)) {
+			event_bitmap_set(client->event_map, type, code);
+		}
+	}
+}
+
+static inline bool client_event_allowed(gamepad_client* client, struct input_event* event) {
+	return event_bitmap_test(client->event_map, event->type, event->code);
+}
+
+/**
+ * Announces the events accepted by the device in a slot, so the client can mask everything
+ * else in the kernel. Sent before every MESSAGE_SUCCESS, the message layout is described
+ * with EventMaskMessage. Type bitmaps that do not fit the message are left out, which only
+ * means the client receives (and sends) those events anyway.
+ */
+bool client_event_mask(LOGGER log, gamepad_client* client, gamepad_client* device, uint8_t slot) {
+	uint8_t buffer[sizeof(EventMaskMessage) + UINT8_MAX];
+	EventMaskMessage* msg = (EventMaskMessage*) buffer;
+	uint8_t* types = msg->masks + 2;
+	size_t type, bytes, u, offset = 2 + EV_CNT / 8;
+
+	memset(buffer, 0, sizeof(buffer));
+	msg->msg_type = MESSAGE_EVENT_MASK;
+	msg->masks[0] = EV_SYN;
+	msg->masks[1] = EV_CNT / 8;
+	types[0] = 1 << EV_SYN;
+
+	for (type = EV_SYN + 1; type < EV_CNT; type++) {
+		// size of the bitmap up to the last accepted code
+		for (bytes = KEY_CNT / 8; bytes > 0; bytes--) {
+			if ((device->event_map[type][(bytes - 1) / 8] >> ((bytes - 1) % 8 * 8)) & 0xFF) {
+				break;
+			}
+		}
+		if (!bytes) {
+			continue;
+		}
+
+		types[type / 8] |= 1 << (type % 8);
+		if (offset + 2 + bytes > UINT8_MAX) {
+			logprintf(log, LOG_WARNING, "[%d] Event mask for type %02zX does not fit\n", slot, type);
+			continue;
+		}
+
+		msg->masks[offset] = type;
+		msg->masks[offset + 1] = bytes;
+		for (u = 0; u < bytes; u++) {
+			msg->masks[offset + 2 + u] = device->event_map[type][u / 8] >> (u % 8 * 8);
+		}
+		offset += 2 + bytes;
+	}
+
+	msg->length = offset;
+	return client_send(log, client, slot, buffer, sizeof(EventMaskMessage) + offset);
+}
+
+bool client_connection(Config* config, int listener, bool local, gamepad_client waiting_queue[MAX_WAITING_CLIENTS]){
 	size_t client_ident;
+	int fd;
 	for(client_ident = 0;
 			client_ident < MAX_WAITING_CLIENTS && waiting_queue[client_ident].fd >= 0;
 			client_ident++) {}
 
+	fd = accept(listener, NULL, NULL);
+	if (fd < 0) {
+		logprintf(config->log, LOG_ERROR, "Failed to accept client: %s\n", strerror(errno));
+		return false;
+	}
+
+	if (!set_nonblocking(fd)) {
+		logprintf(config->log, LOG_ERROR, "Failed to set client socket nonblocking\n");
+		close(fd);
+		return false;
+	}
+
 	if(client_ident == MAX_WAITING_CLIENTS){
 		logprintf(config->log, LOG_ERROR, "Client slots exhausted, turning connection away\n");
-		int fd = accept(listener, NULL, NULL);
-		if (fd < 0) {
-			return false;
-		}
 		uint8_t err = MESSAGE_CLIENT_SLOTS_EXHAUSTED;
-		send_message(config->log, fd, &err, 1);
+		// best effort, the connection is closed either way
+		send(fd, &err, 1, MSG_NOSIGNAL | MSG_DONTWAIT);
 		close(fd);
 		return true;
 	}
 
-	logprintf(config->log, LOG_INFO, "New client in waiting slot %zu\n", client_ident);
-	waiting_queue[client_ident].fd = accept(listener, NULL, NULL);
+	logprintf(config->log, LOG_INFO, "New %s client in waiting slot %zu\n", local ? "local" : "network", client_ident);
+	waiting_queue[client_ident].fd = fd;
+	waiting_queue[client_ident].local = local;
+	waiting_queue[client_ident].output_bytes = 0;
+	if (config->handshake_timeout) {
+		timer_arm(&config->timers, &waiting_queue[client_ident].timer, TIMER_HANDSHAKE, config->handshake_timeout * 1000);
+	}
 
 	return true;
 }
 
+/**
+ * Picks the slot for a new connection or an OPEN request: the requested slot (1-based)
+ * or, for 0, the first free one, reusing a slot whose device outlived its client.
+ * Returns the slot index or -1 with the error response in error.
+ */
+int client_claim(Config* config, uint8_t requested, uint8_t* error) {
+	size_t u;
+
+	if (requested > MAX_CLIENTS) {
+		*error = MESSAGE_INVALID_CLIENT_SLOT;
+		return -1;
+	}
+	if (requested > 0) {
+		if (client_connected(clients + requested - 1) || clients[requested - 1].osc) {
+			*error = MESSAGE_CLIENT_SLOT_IN_USE;
+			return -1;
+		}
+		return requested - 1;
+	}
+
+	// check for free slot with no ev_fd
+	for (u = 0; u < MAX_CLIENTS; u++) {
+		if (!client_connected(clients + u) && clients[u].ev_fd < 0) {
+			return u;
+		}
+	}
+
+	// check for free slot with ev_fd device and close the device
+	for (u = 0; u < MAX_CLIENTS; u++) {
+		// devices fed by OSC are never handed to network clients
+		if (!client_connected(clients + u) && !clients[u].osc) {
+			logprintf(config->log, LOG_INFO, "Removing old device from allocated slot %zu\n", u);
+			timer_disarm(&config->timers, &clients[u].timer);
+			cleanup_device(config->log, clients + u);
+			return u;
+		}
+	}
+
+	*error = MESSAGE_CLIENT_SLOTS_EXHAUSTED;
+	return -1;
+}
+
 bool client_hello(Config* config, gamepad_client* client, uint8_t slot) {
 	uint8_t ret = 0;
-	size_t u;
+	int index;
 
 	if (client->bytes_available < sizeof(HelloMessage)) {
 		logprintf(config->log, LOG_DEBUG, "[Wait%d] Short read\n", slot);
@@ -89,9 +514,8 @@ bool client_hello(Config* config, gamepad_client* client, uint8_t slot) {
 	if (msg->msg_type != MESSAGE_HELLO) {
 		logprintf(config->log, LOG_WARNING, "[Wait%d] Protocol error\n", slot);
 		ret = MESSAGE_INVALID;
-		send_message(config->log, client->fd, &ret, 1);
-		close(client->fd);
-		client->fd = -1;
+		client_send(config->log, client, slot, &ret, 1);
+		waiting_close(config, client);
 		return false;
 	}
 
@@ -100,63 +524,27 @@ bool client_hello(Config* config, gamepad_client* client, uint8_t slot) {
 		logprintf(config->log, LOG_DEBUG,
 				"[Wait%d] Version mismatch: %.2x (client) vs %.2x (server)\n",
 				slot, msg->version, PROTOCOL_VERSION);
-		ret = MESSAGE_VERSION_MISMATCH;
-		send_message(config->log, client->fd, &ret, 1);
-		close(client->fd);
-		client->fd = -1;
+		VersionMismatchMessage mismatch = {
+			.msg_type = MESSAGE_VERSION_MISMATCH,
+			.version = PROTOCOL_VERSION
+		};
+		client_send(config->log, client, slot, &mismatch, sizeof(mismatch));
+		waiting_close(config, client);
 		return false;
 	}
 
 	logprintf(config->log, LOG_DEBUG, "[Wait%d] Slot requested: %d\n", slot, msg->slot);
-	if (msg->slot > 0) {
-		if (msg->slot > MAX_CLIENTS) {
-			ret = MESSAGE_INVALID_CLIENT_SLOT;
-			logprintf(config->log, LOG_WARNING, "[Wait%d] Invalid slot supplied\n", slot);
-		} else if (clients[msg->slot - 1].fd > 0) {
-			ret = MESSAGE_CLIENT_SLOT_IN_USE;
-			logprintf(config->log, LOG_WARNING, "[Wait%d] Slot occupied\n", slot);
-		}
-
-		if (ret > 0) {
-			send_message(config->log, client->fd, &ret, 1);
-			close(client->fd);
-			client->fd = -1;
-			return false;
-		}
-	} else {
-
-		// check for free slot with no ev_fd
-		for (u = 0; u < MAX_CLIENTS; u++) {
-			if (clients[u].fd < 0 && clients[u].ev_fd < 0) {
-				msg->slot = u + 1;
-				break;
-			}
-		}
-
-		// check for free slot with ev_fd device and close the device
-		if (msg->slot == 0) {
-			for (u = 0; u < MAX_CLIENTS; u++) {
-				if (clients[u].fd < 0) {
-					logprintf(config->log, LOG_INFO, "[Wait%d] Removing old device from allocated slot %d\n", slot, u);
-					cleanup_device(config->log, clients + u);
-					msg->slot = u + 1;
-					break;
-				}
-			}
-		}
-
-		// client slots exhausted
-		if (msg->slot == 0) {
-			ret = MESSAGE_CLIENT_SLOTS_EXHAUSTED;
-			send_message(config->log, client->fd, &ret, 1);
-			close(client->fd);
-			client->fd = -1;
-			return false;
-		}
+	index = client_claim(config, msg->slot, &ret);
+	if (index < 0) {
+		logprintf(config->log, LOG_WARNING, "[Wait%d] Slot not available: %s\n", slot, get_message_name(ret));
+		client_send(config->log, client, slot, &ret, 1);
+		waiting_close(config, client);
+		return false;
 	}
+	msg->slot = index + 1;
 
-	// check if the server has set a password
-	if (strlen(config->password) > 0) {
+	// check if the server has set a password, the socket permissions authenticate local clients
+	if (strlen(config->password) > 0 && !client->local) {
 		ret = MESSAGE_PASSWORD_REQUIRED;
 	// check if the device is already set up
 	} else if (clients[msg->slot - 1].ev_fd == -1) {
@@ -165,22 +553,34 @@ bool client_hello(Config* config, gamepad_client* client, uint8_t slot) {
 		ret = MESSAGE_SUCCESS;
 	}
 
-	if (!send_message(config->log, client->fd, &ret, 1)) {
-		close(client->fd);
-		client->fd = -1;
+	// SUCCESS names the slot, the other responses are a single byte
+	SuccessMessage reply = {
+		.msg_type = ret,
+		.slot = msg->slot
+	};
+	if ((ret == MESSAGE_SUCCESS && !client_event_mask(config->log, client, clients + msg->slot - 1, slot))
+			|| !client_send(config->log, client, slot, &reply, get_size_from_command((uint8_t*) &reply, sizeof(reply)))) {
+		waiting_close(config, client);
 		return false;
 	}
 
 	// move the client data to the right slot
 	logprintf(config->log, LOG_INFO, "[Wait%d] Connection negotiated\n", slot);
 	clients[msg->slot - 1].fd = client->fd;
+	clients[msg->slot - 1].local = client->local;
 	clients[msg->slot - 1].scan_offset = 0;
 	clients[msg->slot - 1].bytes_available = 0;
 	memset(clients[msg->slot - 1].input_buffer, 0, INPUT_BUFFER_SIZE);
+	memcpy(clients[msg->slot - 1].output_buffer, client->output_buffer, client->output_bytes);
+	clients[msg->slot - 1].output_bytes = client->output_bytes;
 	client->bytes_available = 0;
 	client->scan_offset = 0;
+	client->output_bytes = 0;
 	client->fd = -1;
-	clients[msg->slot - 1].status = ret;
+	client_passed_close(client);
+	// the slot keeps the deadline armed when the connection was accepted
+	timer_move(&config->timers, &client->timer, &clients[msg->slot - 1].timer, TIMER_SETUP);
+	client_status(config, clients + msg->slot - 1, ret);
 
 	return true;
 }
@@ -191,83 +591,42 @@ int usage(int argc, char** argv, Config* config) {
 			"    -b,  --bind <bind>          - Address to bind to\n"
 			"    -p,  --port <port>          - Port to use\n"
 			"    -h,  --help                 - Print this help message\n"
-			"    -B,  --blacklist <file>     - Read an event code blacklist file\n"
-			"    -W,  --whitelist <file>     - Read an event code whitelist file\n"
+			"    -B,  --blacklist <file>     - Read an event code blacklist file (reloaded on SIGHUP)\n"
+			"    -W,  --whitelist <file>     - Read an event code whitelist file (reloaded on SIGHUP)\n"
 			"    -pw, --password <password>  - Connection password\n"
+			"    -s,  --socket <path>        - Also accept clients on this host at a UNIX socket, without password\n"
+			"    -S,  --socket-mode <mode>   - Permissions of the UNIX socket (default %s)\n"
+			"    -o,  --output <backend>     - Output backend: uinput (default), null or file:<path>\n"
+			"    -M,  --remap <file>         - Read an event remapping profile file\n"
+			"    -R,  --record <prefix>      - Record the event stream of every device to <prefix>-<slot>-<time>.rec\n"
+			"    -O,  --osc <port>           - Receive OSC on this UDP port, mapped by the --osc-profile\n"
+			"    -P,  --osc-profile <file>   - Read an OSC mapping profile routing OSC paths to slots\n"
+			"    -t,  --timeout <seconds>    - Handshake and setup deadline (0 disables, default %d)\n"
+			"    -l,  --lease <seconds>      - Remove devices of disconnected clients after this time (0 keeps them)\n"
 			"    -v,  --verbosity <level>    - Verbosity level (0 (errors only) - 4 (all I/O))\n"
-			, config->program_name, config->program_name);
+			, config->program_name, config->program_name, DEFAULT_SOCKET_MODE, DEFAULT_HANDSHAKE_TIMEOUT);
 
 	return -1;
 }
 
-int setCodeList(Config* config, char* file, int whitelist) {
-	FILE* f = fopen(file, "r");
-	char* line = NULL;
-	char* type;
-	char* code;
-	size_t len = 0;
-	if (f == NULL) {
-		fprintf(stderr, "Cannot open file: %s\n", strerror(errno));
-		return -1;
-	}
-	int status = 1;
-	int itype;
-	int icode;
-	int line_num = 0;
-	while (getline(&line, &len, f) != -1) {
-		if (line[0] == '#') {
-			continue;
-		}
-		line[strlen(line) -1] = 0;
-		type = strtok(line, ".");
-		code = strtok(NULL, ".");
-
-		if (!type || !code) {
-			logprintf(config->log, LOG_ERROR, "Line %d: Code not defined. Format is type.code or type.*\n", line_num);
-			break;
-		}
-		itype = libevdev_event_type_from_name(type);
-
-		if (itype < 0) {
-			logprintf(config->log, LOG_ERROR, "Line %d: Type is not valid.\n", line_num);
-			status = -1;
-			break;
-		}
-		if (code[0] == '*') {
-			logprintf(config->log, LOG_INFO, "Enable all events from type %s.\n", type);
-			memset(config->whitelist[itype], 1, sizeof(int) * EV_KEY);
-			continue;
-		}
-
-		icode = libevdev_event_code_from_name(itype, code);
-
-		if (icode < 0) {
-			logprintf(config->log, LOG_ERROR, "Line %d: Code is not valid.\n", line_num);
-			status = -1;
-			break;
-		}
-
-		logprintf(config->log, LOG_INFO, "Set %s.%s to %d\n", type, code, whitelist);
-
-		config->whitelist[itype][icode] = whitelist;
-		line_num++;
-	}
-
-	fclose(f);
-	if (line) {
-		free(line);
-	}
+int setWhitelist(int argc, char** argv, Config* config) {
+	return acl_add_file(config->log, &config->acl, argv[1], true) ? 1 : -1;
+}
 
-	return status;
+int setBlacklist(int argc, char** argv, Config* config) {
+	return acl_add_file(config->log, &config->acl, argv[1], false) ? 1 : -1;
 }
 
-int setWhitelist(int argc, char** argv, Config* config) {
-	memset(config->whitelist, 0, sizeof(config->whitelist));
-	return setCodeList(config, argv[1], 1);
+int setRemap(int argc, char** argv, Config* config) {
+	return remap_load(config->log, &config->remap, argv[1]) ? 1 : -1;
 }
 
-int setBlacklist(int argc, char** argv, Config* config) {
-	return setCodeList(config, argv[1], 0);
+int setOutput(int argc, char** argv, Config* config) {
+	if (!output_select(config->log, argv[1])) {
+		return -1;
+	}
+	config->output = argv[1];
+	return 1;
 }
 
 
@@ -276,9 +635,18 @@ bool add_arguments(Config* config) {
 	eargs_addArgumentString("-p", "--port", &config->port);
 	eargs_addArgumentString("-b", "--bind", &config->bindhost);
 	eargs_addArgumentString("-pw", "--password", &config->password);
+	eargs_addArgumentString("-s", "--socket", &config->socket_path);
+	eargs_addArgumentString("-S", "--socket-mode", &config->socket_mode);
 	eargs_addArgumentUInt("-v", "--verbosity", &config->log.verbosity);
 	eargs_addArgument("-W", "--whitelist", setWhitelist, 1);
 	eargs_addArgument("-B", "--blacklist", setBlacklist, 1);
+	eargs_addArgument("-o", "--output", setOutput, 1);
+	eargs_addArgument("-M", "--remap", setRemap, 1);
+	eargs_addArgumentString("-R", "--record", &config->record_prefix);
+	eargs_addArgumentString("-O", "--osc", &config->osc_port);
+	eargs_addArgumentString("-P", "--osc-profile", &config->osc_profile);
+	eargs_addArgumentUInt("-t", "--timeout", &config->handshake_timeout);
+	eargs_addArgumentUInt("-l", "--lease", &config->device_lease);
 
 	return true;
 }
@@ -294,6 +662,9 @@ int handle_password(Config* config, gamepad_client* client, PasswordMessage* msg
 		return sizeof(PasswordMessage) + msg->length;
 	}
 
+	SuccessMessage reply = {
+		.slot = slot + 1
+	};
 	uint8_t message;
 
 	if (strncmp(config->password, msg->password, msg->length)) {
@@ -307,8 +678,12 @@ int handle_password(Config* config, gamepad_client* client, PasswordMessage* msg
 		}
 	}
 
-	client->status = message;
-	if (!send_message(config->log, client->fd, &message, sizeof(message))) {
+	client_status(config, client, message);
+	if (message == MESSAGE_SUCCESS && !client_event_mask(config->log, client, client, slot)) {
+		return -1;
+	}
+	reply.msg_type = message;
+	if (!client_send(config->log, client, slot, &reply, get_size_from_command((uint8_t*) &reply, sizeof(reply)))) {
 		return -1;
 	}
 
@@ -362,9 +737,9 @@ int handle_setup_required(Config* config, gamepad_client* client, uint8_t* messa
 		return -1;
 	} else {
 		msg = MESSAGE_SETUP_REQUIRED;
-		client->status = msg;
+		client_status(config, client, msg);
 	}
-	if (!send_message(config->log, client->fd, &msg, 1)) {
+	if (!client_send(config->log, client, slot, &msg, 1)) {
 		return -1;
 	}
 	return 1;
@@ -372,7 +747,7 @@ int handle_setup_required(Config* config, gamepad_client* client, uint8_t* messa
 
 // handles the quit message. Returns the bytes used or -1 on failure.
 int handle_quit(Config* config, gamepad_client* client, uint8_t* msg, uint8_t slot) {
-	client_close(config->log, client, slot, true);
+	client_close(config, client, slot, true);
 	return -1;
 }
 
@@ -382,7 +757,7 @@ int handle_request_event(Config* config, gamepad_client* client, RequestEventMes
 	if(client->status != MESSAGE_SETUP_REQUIRED){
 		message = MESSAGE_INVALID;
 		logprintf(config->log, LOG_WARNING, "[%d] Protocol error\n", slot);
-		send_message(config->log, client->fd, &message, sizeof(message));
+		client_send(config->log, client, slot, &message, sizeof(message));
 		return -1;
 
 	}
@@ -396,7 +771,7 @@ int handle_request_event(Config* config, gamepad_client* client, RequestEventMes
 		return -1;
 	}
 
-	if (!config->whitelist[msg->type][msg->code]) {
+	if (!acl_allowed(config->acl_active, msg->type, msg->code)) {
 		logprintf(config->log, LOG_WARNING, "[%d] Type %02X Code %X is forbidden.\n", slot, msg->type, msg->code);
 		return sizeof(RequestEventMessage);
 	}
@@ -416,6 +791,35 @@ int handle_request_event(Config* config, gamepad_client* client, RequestEventMes
 	return sizeof(RequestEventMessage);
 }
 
+/**
+ * Creates the device of a slot from the capabilities in its meta, after remapping,
+ * and starts its recording.
+ */
+bool client_device(Config* config, gamepad_client* client, uint8_t slot) {
+	// the device is created with the capabilities after remapping
+	struct device_meta output = {
+		0
+	};
+	struct device_meta* meta = &client->meta;
+	client->remap = remap_compile(config->log, &config->remap, &client->meta, slot, &output);
+	if (client->remap) {
+		meta = &output;
+	}
+	if (!create_device(config->log, client, meta, slot)) {
+		remap_free(client->remap);
+		client->remap = NULL;
+		free(output.enabled_events);
+		return false;
+	}
+	client_event_map(client, config->acl_active);
+	// a failing recording does not affect the device
+	if (config->record_prefix) {
+		record_start(config->log, client, meta, config->record_prefix, slot);
+	}
+	free(output.enabled_events);
+	return true;
+}
+
 // handles the setup end message. Returns the bytes used or -1 on failure.
 int handle_setup_end(Config* config, gamepad_client* client, uint8_t* msg, uint8_t slot) {
 	logprintf(config->log, LOG_DEBUG, "[%d] Setup done\n", slot);
@@ -425,110 +829,352 @@ int handle_setup_end(Config* config, gamepad_client* client, uint8_t* msg, uint8
 		message = MESSAGE_INVALID;
 		logprintf(config->log, LOG_WARNING,
 				"[%d] Protocol error\n", slot);
-		send_message(config->log, client->fd, &message, sizeof(message));
+		client_send(config->log, client, slot, &message, sizeof(message));
 		return -1;
 	}
-	if (!create_device(config->log, client, &client->meta)) {
+	if (!client_device(config, client, slot)) {
 		return -1;
 	}
 	SuccessMessage msg_succ = {
 		.msg_type = MESSAGE_SUCCESS,
 		.slot = slot + 1
 	};
-	client->status = MESSAGE_SUCCESS;
-	if (!send_message(config->log, client->fd, &msg_succ, sizeof(msg_succ))) {
+	client_status(config, client, MESSAGE_SUCCESS);
+	if (!client_event_mask(config->log, client, client, slot)
+			|| !client_send(config->log, client, slot, &msg_succ, sizeof(msg_succ))) {
 		return -1;
 	}
 
 	return 1;
 }
 
-// handles data messages. Returns the bytes used or -1 on failure.
-int handle_data(Config* config, gamepad_client* client, DataMessage* msg, uint8_t slot) {
-	if (client->status != MESSAGE_SUCCESS) {
-		logprintf(config->log, LOG_WARNING, "[%d] Protocol error\n", slot);
-		return sizeof(DataMessage);
+// answers ping messages with the same cookie. Returns the bytes used or -1 on failure.
+int handle_ping(Config* config, gamepad_client* client, PingMessage* msg, uint8_t slot) {
+	PingMessage pong = {
+		.msg_type = MESSAGE_PONG,
+		.cookie = msg->cookie
+	};
+
+	if (!client_send(config->log, client, slot, &pong, sizeof(pong))) {
+		return -1;
 	}
+	return sizeof(PingMessage);
+}
 
-	struct input_event event = {
-		.time = {0},
-		.type = be16toh(msg->type),
-		.code = be16toh(msg->code),
-		.value = be32toh(msg->value)
+/**
+ * Attaches the event ring whose descriptors a local client passed with the message.
+ * A refused ring is answered with INVALID, the connection stays usable.
+ * Returns the bytes used or -1 on failure.
+ */
+int handle_ring(Config* config, gamepad_client* client, RingMessage* msg, uint8_t slot) {
+	uint8_t refused = MESSAGE_INVALID;
+	SuccessMessage msg_succ = {
+		.msg_type = MESSAGE_SUCCESS,
+		.slot = slot + 1
 	};
+	// the descriptors arrive with the datagram, on the connection a multiplexed slot uses
+	gamepad_client* connection = client->owner ? client->owner : client;
+	input_ring* ring = NULL;
+
+	if (client->status == MESSAGE_SUCCESS && client->local && !client->ring && connection->ring_fds[1] >= 0) {
+		ring = calloc(1, sizeof(input_ring));
+		if (ring && !ring_attach(config->log, ring, connection->ring_fds[0], connection->ring_fds[1], be32toh(msg->size))) {
+			free(ring);
+			ring = NULL;
+		}
+		if (ring) {
+			// the descriptors belong to the ring now, a failed attach has closed them
+			connection->ring_fds[0] = connection->ring_fds[1] = -1;
+		}
+	}
 
-	logprintf(config->log, LOG_DEBUG,
-			"[%d] Type: 0x%.2x Code: 0x%.2x Value: 0x%.2x\n", slot, event.type, event.code, event.value);
+	if (!ring) {
+		logprintf(config->log, LOG_WARNING, "[%d] Refusing event ring\n", slot);
+		client_passed_close(connection);
+		return client_send(config->log, client, slot, &refused, sizeof(refused)) ? sizeof(RingMessage) : -1;
+	}
 
-	ssize_t bytes = write(client->ev_fd, &event, sizeof(struct input_event));
-	if (bytes < 0) {
-		logprintf(config->log, LOG_ERROR, "[%d:] Failed to write event: %s\n", slot, strerror(errno));
+	logprintf(config->log, LOG_INFO, "[%d] Attached event ring of %u events\n", slot, ring->shared->size);
+	client->ring = ring;
+	if (!client_send(config->log, client, slot, &msg_succ, sizeof(msg_succ))) {
 		return -1;
 	}
-
-	return sizeof(DataMessage);
+	return sizeof(RingMessage);
+}
+
+/**
+ * Delivers events to the device of a slot, dropping events it was not set up for
+ * and applying its remapping. Returns false if the device failed.
+ */
+bool client_events(Config* config, gamepad_client* client, struct input_event* events, size_t decoded, uint8_t slot) {
+	size_t u, count;
+
+	// drop events the device was not set up for
+	for (u = 0, count = 0; u < decoded; u++) {
+		if (client_event_allowed(client, events + u)) {
+			events[count++] = events[u];
+		}
+	}
+	if (count < decoded) {
+		client->events_denied += decoded - count;
+		logprintf(config->log, LOG_DEBUG, "[%d] Denied %zu events\n", slot, decoded - count);
+	}
+
+	if (client->remap) {
+		for (u = 0; u < count; u++) {
+			remap_event(client->remap, events + u);
+		}
+	}
+
+	if (config->log.verbosity >= LOG_DEBUG) {
+		for (u = 0; u < count; u++) {
+			logprintf(config->log, LOG_DEBUG,
+					"[%d] Type: 0x%.2x Code: 0x%.2x Value: 0x%.2x\n", slot, events[u].type, events[u].code, events[u].value);
+		}
+	}
+
+	if (count && !write_events(config->log, client, events, count, slot)) {
+		return false;
+	}
+	record_events(config->log, client, events, count);
+	return true;
+}
+
+// handles a run of consecutive data messages. Returns the bytes used or -1 on failure.
+int handle_data(Config* config, gamepad_client* client, uint8_t* msg, size_t available, uint8_t slot) {
+	struct input_event events[DATA_BATCH_EVENTS];
+	size_t decoded;
+
+	if (client->status != MESSAGE_SUCCESS) {
+		logprintf(config->log, LOG_WARNING, "[%d] Protocol error\n", slot);
+		return sizeof(DataMessage);
+	}
+
+	decoded = decode_data_messages(msg, available, events, DATA_BATCH_EVENTS);
+	if (!client_events(config, client, events, decoded, slot)) {
+		return -1;
+	}
+
+	return decoded * sizeof(DataMessage);
+}
+
+/**
+ * Drains the ring of a client into its device, at most MESSAGES_PER_PASS batches
+ * per call like the messages on the socket. Returns false if the client was closed.
+ */
+bool client_ring(Config* config, gamepad_client* client, uint8_t slot) {
+	struct input_event events[DATA_BATCH_EVENTS];
+	ssize_t count = 1;
+	size_t budget;
+
+	ring_clear_wakeup(client->ring);
+	for (budget = 0; budget < MESSAGES_PER_PASS && count > 0; budget++) {
+		count = ring_read(client->ring, events, DATA_BATCH_EVENTS);
+		if (count < 0) {
+			logprintf(config->log, LOG_WARNING, "[%d] Event ring is corrupted\n", slot);
+			client_close(config, client, slot, false);
+			return false;
+		}
+		if (count && client->status == MESSAGE_SUCCESS && !client_events(config, client, events, count, slot)) {
+			client_close(config, client, slot, false);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Checks whether a client has a complete (or invalid) message buffered that has not been handled yet.
+ */
+bool client_pending(gamepad_client* client) {
+	if (client->fd < 0 || client->bytes_available <= 0) {
+		return false;
+	}
+
+	int bytes = get_size_from_command(client->input_buffer + client->scan_offset, client->bytes_available);
+	return bytes < 0 || (bytes > 0 && bytes <= client->bytes_available);
+}
+
+int client_message(Config* config, gamepad_client* client, uint8_t* msg, size_t available, uint8_t slot);
+
+/**
+ * Opens another slot on the authenticated connection of client. The slot is answered
+ * like a HELLO, in an envelope, a slot that can not be opened with a bare error response.
+ * Returns the bytes used or -1 on failure.
+ */
+int handle_open(Config* config, gamepad_client* client, OpenMessage* msg, uint8_t slot) {
+	gamepad_client* target;
+	SuccessMessage reply = {0};
+	uint8_t ret = 0;
+	int index;
+
+	if (client->owner || client->fd < 0
+			|| (client->status != MESSAGE_SETUP_REQUIRED && client->status != MESSAGE_SUCCESS)) {
+		logprintf(config->log, LOG_WARNING, "[%d] Protocol error\n", slot);
+		return -1;
+	}
+
+	index = client_claim(config, msg->slot, &ret);
+	if (index < 0) {
+		logprintf(config->log, LOG_WARNING, "[%d] Slot not available: %s\n", slot, get_message_name(ret));
+		return client_send(config->log, client, slot, &ret, 1) ? sizeof(OpenMessage) : -1;
+	}
+
+	target = clients + index;
+	target->owner = client;
+	target->local = client->local;
+	target->scan_offset = 0;
+	target->bytes_available = 0;
+	target->output_bytes = 0;
+	// the reply names the slot, the client needs it to address its envelopes
+	reply.msg_type = (target->ev_fd < 0) ? MESSAGE_SETUP_REQUIRED : MESSAGE_SUCCESS;
+	reply.slot = index + 1;
+	logprintf(config->log, LOG_INFO, "[%d] Opened slot %d on the connection\n", slot, index);
+
+	if ((reply.msg_type == MESSAGE_SUCCESS && !client_event_mask(config->log, target, target, index))
+			|| !client_send(config->log, target, index, &reply, get_size_from_command((uint8_t*) &reply, sizeof(reply)))) {
+		client_close(config, target, index, false);
+		return -1;
+	}
+	client_status(config, target, reply.msg_type);
+	return sizeof(OpenMessage);
+}
+
+/**
+ * Handles the messages in an envelope for a slot opened on this connection. A slot
+ * failing a message is closed and told so with a QUIT, the connection stays open.
+ * Returns the bytes used or -1 on failure.
+ */
+int handle_slot(Config* config, gamepad_client* client, SlotMessage* msg, uint8_t slot) {
+	gamepad_client* target;
+	size_t offset = 0;
+	uint8_t index;
+	int ret, bytes;
+
+	// envelopes are not nested
+	if (client->owner || !msg->slot || msg->slot > MAX_CLIENTS) {
+		logprintf(config->log, LOG_WARNING, "[%d] Invalid envelope for slot %d\n", slot, msg->slot);
+		return -1;
+	}
+
+	index = msg->slot - 1;
+	target = clients + index;
+	if (target->owner != client) {
+		// the slot may have been closed by the server while the messages were underway
+		logprintf(config->log, LOG_DEBUG, "[%d] Dropping messages for slot %d not open on this connection\n", slot, index);
+		return sizeof(SlotMessage) + msg->length;
+	}
+
+	while (offset < msg->length) {
+		bytes = get_size_from_command(msg->messages + offset, msg->length - offset);
+		ret = (bytes > 0 && bytes <= msg->length - offset)
+			? client_message(config, target, msg->messages + offset, msg->length - offset, index) : -1;
+		if (ret <= 0) {
+			// a QUIT has closed the slot already
+			if (target->owner == client) {
+				logprintf(config->log, LOG_WARNING, "[%d] Closing slot %d opened on the connection\n", slot, index);
+				client_close(config, target, index, false);
+			}
+			break;
+		}
+		offset += ret;
+	}
+	return sizeof(SlotMessage) + msg->length;
+}
+
+/**
+ * Handles one complete message of a slot, available bytes being buffered at msg.
+ * Returns the bytes used or -1 if the slot has to be closed.
+ */
+int client_message(Config* config, gamepad_client* client, uint8_t* msg, size_t available, uint8_t slot) {
+	int ret;
+
+	switch (msg[0]) {
+		case MESSAGE_PASSWORD:
+			ret = handle_password(config, client, (PasswordMessage*) msg, slot);
+			break;
+		case MESSAGE_ABSINFO:
+			ret = handle_absinfo(config, client, (ABSInfoMessage*) msg, slot);
+			break;
+		case MESSAGE_DEVICE:
+			ret = handle_device(config, client, (DeviceMessage*) msg, slot);
+			break;
+		case MESSAGE_REQUEST_EVENT:
+			ret = handle_request_event(config, client, (RequestEventMessage*) msg, slot);
+			break;
+		case MESSAGE_SETUP_REQUIRED:
+			ret = handle_setup_required(config, client, msg, slot);
+			break;
+		case MESSAGE_QUIT:
+			ret = handle_quit(config, client, msg, slot);
+			break;
+		case MESSAGE_SETUP_END:
+			ret = handle_setup_end(config, client, msg, slot);
+			break;
+		case MESSAGE_DATA:
+			ret = handle_data(config, client, msg, available, slot);
+			break;
+		case MESSAGE_PING:
+			ret = handle_ping(config, client, (PingMessage*) msg, slot);
+			break;
+		case MESSAGE_RING:
+			ret = handle_ring(config, client, (RingMessage*) msg, slot);
+			break;
+		case MESSAGE_OPEN:
+			ret = handle_open(config, client, (OpenMessage*) msg, slot);
+			break;
+		case MESSAGE_SLOT:
+			ret = handle_slot(config, client, (SlotMessage*) msg, slot);
+			break;
+		default:
+			logprintf(config->log, LOG_ERROR, "[%d] Unknown message type 0x%.2x\n", slot, msg[0]);
+			ret = -1;
+			break;
+	}
+	return ret;
 }
 
 /**
  * Handles data from socket except the hello message. Hello message is handled in the hello_data function.
+ * At most MESSAGES_PER_PASS messages (a run of DATA messages counting as one) are handled per call,
+ * remaining data is left in the buffer
+ * for the next scheduler pass (see client_pending).
  */
 bool client_data(Config* config, gamepad_client* client, uint8_t slot) {
 
 	ssize_t bytes;
 	uint8_t* msg;
 	int ret;
-	while (client->bytes_available > 0) {
+	size_t budget;
+	for (budget = 0; budget < MESSAGES_PER_PASS && client->bytes_available > 0; budget++) {
 		msg = client->input_buffer + client->scan_offset;
 
 		bytes = get_size_from_command(msg, client->bytes_available);
 
 		if (bytes < 0){
 			logprintf(config->log, LOG_WARNING, "[%d] Invalid message: 0x%.2x.\n", slot, msg[0]);
+			client_close(config, client, slot, false);
 			return false;
 		}
 
-		// we need additional bytes
-		if (client->bytes_available < bytes) {
+		// we need additional bytes, which never follow on the UNIX socket
+		if (bytes == 0 || client->bytes_available < bytes) {
+			if (client->local) {
+				logprintf(config->log, LOG_WARNING, "[%d] Incomplete message 0x%.2x in datagram\n", slot, msg[0]);
+				client_close(config, client, slot, false);
+				return false;
+			}
 			logprintf(config->log, LOG_DEBUG, "[%d] Short read, expected %zu\n", slot, bytes);
 			return true;
 		}
 
-		// handle messages
-		switch (msg[0]) {
-			case MESSAGE_PASSWORD:
-				ret = handle_password(config, client, (PasswordMessage*) msg, slot);
-				break;
-			case MESSAGE_ABSINFO:
-				ret = handle_absinfo(config, client, (ABSInfoMessage*) msg, slot);
-				break;
-			case MESSAGE_DEVICE:
-				ret = handle_device(config, client, (DeviceMessage*) msg, slot);
-				break;
-			case MESSAGE_REQUEST_EVENT:
-				ret = handle_request_event(config, client, (RequestEventMessage*) msg, slot);
-				break;
-			case MESSAGE_SETUP_REQUIRED:
-				ret = handle_setup_required(config, client, msg, slot);
-				break;
-			case MESSAGE_QUIT:
-				handle_quit(config, client, msg, slot);
-				return false;
-			case MESSAGE_SETUP_END:
-				ret = handle_setup_end(config, client, msg, slot);
-				break;
-			case MESSAGE_DATA:
-				ret = handle_data(config, client, (DataMessage*) msg, slot);
-				break;
-			default:
-				logprintf(config->log, LOG_ERROR, "[%d] Unknown message type 0x%.2x\n", slot, msg[0]);
-				ret = -1;
-				break;
-		}
+		ret = client_message(config, client, msg, client->bytes_available, slot);
 
-		// error in handling message
+		// error in handling message, a QUIT has closed the client already
 		if (ret < 0) {
-			close(client->fd);
-			client->fd = -1;
+			if (client_connected(client)) {
+				client_close(config, client, slot, false);
+			}
 			return false;
 		}
 
@@ -542,19 +1188,80 @@ bool client_data(Config* config, gamepad_client* client, uint8_t slot) {
 	return true;
 }
 
+/**
+ * Receives a datagram from a local client, keeping descriptors passed along
+ * with it (SCM_RIGHTS) for the message that claims them.
+ */
+ssize_t recv_local(Config* config, gamepad_client* client, uint8_t slot) {
+	struct iovec iov = {
+		.iov_base = client->input_buffer + client->bytes_available,
+		.iov_len = INPUT_BUFFER_SIZE - client->bytes_available
+	};
+	union {
+		char buffer[CMSG_SPACE(sizeof(client->ring_fds))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr header = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buffer,
+		.msg_controllen = sizeof(control.buffer)
+	};
+	struct cmsghdr* cmsg;
+	size_t u, count;
+	int* fds;
+	ssize_t bytes;
+
+	bytes = recvmsg(client->fd, &header, MSG_TRUNC | MSG_CMSG_CLOEXEC);
+	if (bytes < 0) {
+		return bytes;
+	}
+
+	// descriptors nobody asked for are not kept around
+	client_passed_close(client);
+	for (cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+			continue;
+		}
+		fds = (int*) CMSG_DATA(cmsg);
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (u = 0; u < count; u++) {
+			if (u < 2 && client->ring_fds[u] < 0) {
+				client->ring_fds[u] = fds[u];
+			} else {
+				close(fds[u]);
+			}
+		}
+	}
+	if (header.msg_flags & MSG_CTRUNC) {
+		logprintf(config->log, LOG_WARNING, "[%d] Dropped descriptors passed with a datagram\n", slot);
+		client_passed_close(client);
+	}
+	return bytes;
+}
+
 /**
  * moves the buffer of a client to the beginning and receives new data from the socket.
  * Returns false when a error occurs on receiving data from socket.
  */
 bool recv_data(Config* config, gamepad_client* client, uint8_t slot) {
 	memmove(client->input_buffer, client->input_buffer + client->scan_offset, client->bytes_available);
+	client->scan_offset = 0;
 
 	ssize_t bytes;
 
-	bytes = recv(client->fd, client->input_buffer + client->bytes_available, INPUT_BUFFER_SIZE - client->bytes_available, 0);
+	// datagrams of local clients are only read into an empty buffer, MSG_TRUNC reports their full length
+	if (client->local) {
+		bytes = recv_local(config, client, slot);
+	} else {
+		bytes = recv(client->fd, client->input_buffer + client->bytes_available, INPUT_BUFFER_SIZE - client->bytes_available, 0);
+	}
 
 	// cannot receive data
 	if (bytes < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return true;
+		}
 		logprintf(config->log, LOG_ERROR, "[%d] Failed to receive data\n", slot);
 		return false;
 	}
@@ -563,26 +1270,256 @@ bool recv_data(Config* config, gamepad_client* client, uint8_t slot) {
 		logprintf(config->log, LOG_ERROR, "[%d] Connection closed by remote\n", slot);
 		return false;
 	}
+	if (bytes > INPUT_BUFFER_SIZE - client->bytes_available) {
+		logprintf(config->log, LOG_ERROR, "[%d] Datagram of %zd bytes exceeds the input buffer\n", slot, bytes);
+		return false;
+	}
 	logprintf(config->log, LOG_DEBUG, "[%d] %zd bytes received\n", slot, bytes);
 
 	client->bytes_available += bytes;
-	client->scan_offset = 0;
 
 	return true;
 }
 
+/**
+ * Handles all expired timers: drops connections that did not finish their handshake
+ * in time and destroys devices whose owner did not return within the lease.
+ */
+void client_timeouts(Config* config, gamepad_client waiting_queue[MAX_WAITING_CLIENTS]) {
+	wheel_timer* timer;
+	gamepad_client* client;
+	uint8_t slot;
+
+	while ((timer = timer_wheel_expired(&config->timers))) {
+		client = timer_client(timer);
+		switch (timer->kind) {
+			case TIMER_HANDSHAKE:
+				slot = client - waiting_queue;
+				logprintf(config->log, LOG_WARNING, "[Wait%d] Handshake timed out\n", slot);
+				waiting_close(config, client);
+				break;
+			case TIMER_SETUP:
+				slot = client - clients;
+				logprintf(config->log, LOG_WARNING, "[%d] Setup timed out\n", slot);
+				client_close(config, client, slot, false);
+				break;
+			case TIMER_LEASE:
+				slot = client - clients;
+				if (!client_connected(client)) {
+					logprintf(config->log, LOG_INFO, "[%d] Device lease expired, removing device\n", slot);
+					cleanup_device(config->log, client);
+				}
+				break;
+		}
+	}
+}
+
+/**
+ * Activates an ACL table compiled by the reload thread and applies it to all devices.
+ */
+void acl_activate(Config* config, acl_table* table) {
+	acl_table* old = config->acl_active;
+	size_t u;
+
+	config->acl_active = table;
+	for (u = 0; u < MAX_CLIENTS; u++) {
+		if (clients[u].ev_fd >= 0) {
+			client_event_map(clients + u, table);
+		}
+	}
+	free(old);
+	logprintf(config->log, LOG_INFO, "Activated reloaded ACL\n");
+}
+
+/**
+ * Device range of OSC profile channels that do not name one: axes span 0..OSC_DEFAULT_ABS_MAX
+ * like the osc-xlater gamepad, keys are pressed or released.
+ */
+int osc_default_target(int type, osc_channel* channel) {
+	switch (type) {
+		case EV_ABS:
+			channel->target_min = 0;
+			channel->target_max = OSC_DEFAULT_ABS_MAX;
+			return 0;
+		case EV_KEY:
+			channel->target_min = 0;
+			channel->target_max = 1;
+			return 0;
+	}
+	return -1;
+}
+
+/**
+ * Creates the devices of all slots driven by the OSC profile. Their capabilities
+ * are the channels of the controls routed to the slot.
+ */
+bool osc_devices(Config* config) {
+	struct input_absinfo* absinfo;
+	osc_control* control;
+	gamepad_client* client;
+	char name[UINPUT_MAX_NAME_SIZE];
+	size_t u, c;
+
+	for (u = 0; u < config->osc.num_controls; u++) {
+		control = config->osc.controls + u;
+		if (control->slot < 0 || control->slot >= MAX_CLIENTS) {
+			logprintf(config->log, LOG_ERROR, "OSC path %s is routed to slot %d, only %d slots exist\n",
+					control->path, control->slot + 1, MAX_CLIENTS);
+			return false;
+		}
+		client = clients + control->slot;
+		if (!client->osc) {
+			client->osc = calloc(1, sizeof(osc_frame));
+			snprintf(name, sizeof(name), "OSC Gamepad %d", control->slot + 1);
+			client->meta.name = strdup(name);
+			client->meta.id.bustype = BUS_VIRTUAL;
+			if (!client->osc || !client->meta.name) {
+				logprintf(config->log, LOG_ERROR, "Failed to allocate memory\n");
+				return false;
+			}
+			osc_frame_init(client->osc);
+		}
+
+		client->meta.enabled_events = realloc(client->meta.enabled_events,
+				(client->meta.enabled_events_length + control->num_channels) * sizeof(struct enabled_event));
+		if (!client->meta.enabled_events) {
+			logprintf(config->log, LOG_ERROR, "Failed to allocate memory\n");
+			client->meta.enabled_events_length = 0;
+			return false;
+		}
+		for (c = 0; c < control->num_channels; c++) {
+			client->meta.enabled_events[client->meta.enabled_events_length].type = control->type;
+			client->meta.enabled_events[client->meta.enabled_events_length++].code = control->channels[c].code;
+			if (control->type == EV_ABS && control->channels[c].code < ABS_CNT) {
+				absinfo = client->meta.absinfo + control->channels[c].code;
+				absinfo->minimum = control->channels[c].target_min;
+				absinfo->maximum = control->channels[c].target_max;
+				absinfo->value = control->channels[c].target_center;
+			}
+		}
+	}
+
+	for (u = 0; u < MAX_CLIENTS; u++) {
+		if (clients[u].osc) {
+			if (!client_device(config, clients + u, u)) {
+				return false;
+			}
+			clients[u].status = MESSAGE_SUCCESS;
+		}
+	}
+	return true;
+}
+
+/**
+ * Loads the OSC profile, creates its devices and opens the OSC socket.
+ */
+bool osc_init(Config* config) {
+	if (!config->osc_profile) {
+		logprintf(config->log, LOG_ERROR, "Receiving OSC requires a profile (--osc-profile)\n");
+		return false;
+	}
+	if (osc_profile_load(config->log, &config->osc, config->osc_profile, osc_default_target)) {
+		logprintf(config->log, LOG_ERROR, "Failed to load OSC profile %s\n", config->osc_profile);
+		return false;
+	}
+	if (osc_mapping_index(config->log, &config->osc) < 0 || !osc_devices(config)) {
+		return false;
+	}
+
+	config->osc_fd = udp_listener(config->bindhost, config->osc_port);
+	if (config->osc_fd < 0) {
+		logprintf(config->log, LOG_ERROR, "Failed to open OSC listener\n");
+		return false;
+	}
+	logprintf(config->log, LOG_INFO, "Receiving OSC for %zu paths on %s:%s\n", config->osc.num_controls,
+			config->bindhost, config->osc_port);
+	return true;
+}
+
+/**
+ * Opens the UNIX socket for clients on this host. Returns the listener or -1 on failure.
+ */
+int local_listener(Config* config) {
+	char* end;
+	unsigned long mode = strtoul(config->socket_mode, &end, 8);
+
+	if (*end || mode > 0777) {
+		logprintf(config->log, LOG_ERROR, "Invalid socket mode %s\n", config->socket_mode);
+		return -1;
+	}
+	return unix_listener(config->socket_path, mode);
+}
+
+// writes the events collected for an OSC slot
+void osc_flush(Config* config, gamepad_client* client, uint8_t slot) {
+	osc_frame_end(client->osc);
+	if (client->osc->length && !client_events(config, client, client->osc->events, client->osc->length, slot)) {
+		logprintf(config->log, LOG_WARNING, "[%d] Failed to write OSC events\n", slot);
+	}
+	osc_frame_init(client->osc);
+}
+
+// adds the values of a mapped OSC message to the frame of its slot
+int osc_message(char* path, unsigned num_args, uint8_t* args, void* user) {
+	Config* config = user;
+	osc_control* control = osc_mapping_find(&config->osc, path);
+	gamepad_client* client;
+
+	if (!control || num_args != control->num_channels) {
+		config->osc_unknown++;
+		logprintf(config->log, LOG_DEBUG, "Ignoring unmapped OSC path %s\n", path);
+		return 0;
+	}
+
+	client = clients + control->slot;
+	if (osc_frame_add(client->osc, control, args) < 0) {
+		osc_flush(config, client, control->slot);
+		osc_frame_add(client->osc, control, args);
+	}
+	return 0;
+}
+
+void osc_datagram_handle(char* buffer, size_t len, struct sockaddr_storage* addr, socklen_t addr_len, void* user) {
+	Config* config = user;
+	// no scheduler: bundles timetagged in the future are applied on arrival
+	osc_packet(config->log, buffer, len, osc_now(), 0, osc_message, NULL, config);
+}
+
+/**
+ * Reads up to OSC_BATCHES_PER_PASS batches of datagrams from the OSC socket and writes
+ * one batch per slot that received values. Datagrams left over keep the socket readable,
+ * they are read on the next pass so a busy sender can not starve the other clients.
+ */
+void osc_input(Config* config) {
+	size_t u;
+
+	if (osc_receive(config->log, config->osc_fd, OSC_BATCHES_PER_PASS, osc_datagram_handle, config) < 0) {
+		return;
+	}
+	for (u = 0; u < MAX_CLIENTS; u++) {
+		if (clients[u].osc && clients[u].ev_fd >= 0) {
+			osc_flush(config, clients + u, u);
+		}
+	}
+}
+
 // initializes the gamepad_client struct
 void init_client(gamepad_client* client) {
 	gamepad_client empty = {
 		.fd = -1,
-		.ev_fd = -1
+		.ring_fds = {-1, -1},
+		.ev_fd = -1,
+		.record_fd = -1
 	};
 	*client = empty;
 }
 
 int main(int argc, char** argv) {
-	size_t u;
-	fd_set readfds;
+	size_t u, p, first_slot = 0;
+	int local_fd = -1;
+	fd_set readfds, writefds;
+	struct timeval timeout;
+	bool pending;
 	int maxfd;
 	int status;
 
@@ -595,11 +1532,14 @@ int main(int argc, char** argv) {
 		},
 		.bindhost = getenv("SERVER_HOST") ? getenv("SERVER_HOST"):DEFAULT_HOST,
 		.port = getenv("SERVER_PORT") ? getenv("SERVER_PORT"):DEFAULT_PORT,
-		.password = getenv("SERVER_PW") ? getenv("SERVER_PW"):DEFAULT_PASSWORD
+		.password = getenv("SERVER_PW") ? getenv("SERVER_PW"):DEFAULT_PASSWORD,
+		.socket_mode = DEFAULT_SOCKET_MODE,
+		.output = "uinput",
+		.handshake_timeout = DEFAULT_HANDSHAKE_TIMEOUT,
+		.device_lease = 0,
+		.osc_fd = -1
 	};
 
-	memset(config.whitelist, 1, sizeof(config.whitelist));
-
 	// argument parsing
 	add_arguments(&config);
 	status = eargs_parse(argc, argv, NULL, &config);
@@ -612,21 +1552,54 @@ int main(int argc, char** argv) {
 		return usage(argc, argv, &config);
 	}
 
-	logprintf(config.log, LOG_INFO, "%s starting\nProtocol Version: %.2x\n", SERVER_VERSION, PROTOCOL_VERSION);
+	logprintf(config.log, LOG_INFO, "%s starting\nProtocol Version: %.2x\nOutput: %s\n", SERVER_VERSION, PROTOCOL_VERSION, config.output);
 	int listen_fd = tcp_listener(config.bindhost, config.port);
 	if(listen_fd < 0){
 		logprintf(config.log, LOG_ERROR, "Failed to open listener\n");
 		return EXIT_FAILURE;
 	}
 
+	config.acl_active = acl_compile(config.log, &config.acl);
+	if(!config.acl_active){
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+
+	if(!timer_wheel_init(config.log, &config.timers)){
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+
+	if(!acl_reload_init(config.log, &config.acl)){
+		timer_wheel_close(&config.timers);
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+
 	//set up signal handling
+	reload_wakeup_fd = config.acl.event_fd;
 	signal(SIGINT, signal_handler);
+	signal(SIGHUP, reload_handler);
 
 	//initialize all clients to invalid sockets
 	for(u = 0; u < MAX_CLIENTS; u++){
 		init_client(clients + u);
 	}
 
+	if ((config.osc_port && !osc_init(&config))
+			|| (config.socket_path && (local_fd = local_listener(&config)) < 0)) {
+		for (u = 0; u < MAX_CLIENTS; u++) {
+			cleanup_device(config.log, clients + u);
+			free(clients[u].osc);
+		}
+		osc_mapping_free(&config.osc);
+		reload_wakeup_fd = -1;
+		acl_reload_close(&config.acl);
+		timer_wheel_close(&config.timers);
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+
 	gamepad_client waiting_clients[MAX_WAITING_CLIENTS];
 	// initialize all waiting slots to invalid sockets
 	for (u = 0; u < MAX_WAITING_CLIENTS; u++) {
@@ -634,18 +1607,61 @@ int main(int argc, char** argv) {
 	}
 
 	logprintf(config.log, LOG_INFO, "Now waiting for connections on %s:%s\n", config.bindhost, config.port);
+	if (local_fd >= 0) {
+		logprintf(config.log, LOG_INFO, "Now waiting for local connections on %s\n", config.socket_path);
+	}
 
 	//core loop
 	while (!shutdown_server) {
+		if (reload_acl) {
+			//compile the ACL files off the input path, the result is picked up via config.acl.event_fd
+			reload_acl = 0;
+			logprintf(config.log, LOG_INFO, "Reloading ACL files\n");
+			acl_reload(config.log, &config.acl);
+		}
+
 		FD_ZERO(&readfds);
+		FD_ZERO(&writefds);
 		FD_SET(listen_fd, &readfds);
-		maxfd = listen_fd;
+		FD_SET(config.timers.fd, &readfds);
+		FD_SET(config.acl.event_fd, &readfds);
+		maxfd = (listen_fd > config.timers.fd) ? listen_fd:config.timers.fd;
+		maxfd = (maxfd > config.acl.event_fd) ? maxfd:config.acl.event_fd;
+		if(local_fd >= 0){
+			FD_SET(local_fd, &readfds);
+			maxfd = (maxfd > local_fd) ? maxfd:local_fd;
+		}
+		if(config.osc_fd >= 0){
+			FD_SET(config.osc_fd, &readfds);
+			maxfd = (maxfd > config.osc_fd) ? maxfd:config.osc_fd;
+		}
+		pending = false;
 
 		// adding client slots
 		for(u = 0; u < MAX_CLIENTS; u++){
+			// devices with force feedback or LED requests, also while their client is away
+			if(clients[u].ev_fd >= 0 && output_feedback()){
+				FD_SET(clients[u].ev_fd, &readfds);
+				maxfd = (maxfd > clients[u].ev_fd) ? maxfd:clients[u].ev_fd;
+			}
+			if(clients[u].ring){
+				// events left in the ring after a batch do not wake us again
+				pending |= !ring_empty(clients[u].ring);
+				FD_SET(clients[u].ring->event_fd, &readfds);
+				maxfd = (maxfd > clients[u].ring->event_fd) ? maxfd:clients[u].ring->event_fd;
+			}
 			if(clients[u].fd >= 0){
-				FD_SET(clients[u].fd, &readfds);
-				maxfd = (maxfd > clients[u].fd) ? maxfd:clients[u].fd;
+				pending |= client_pending(clients + u);
+				// stop reading from clients with a full buffer until their backlog is handled,
+				// the next datagram of a local client is read once the previous one is handled
+				if(clients[u].local ? !clients[u].bytes_available : clients[u].bytes_available < INPUT_BUFFER_SIZE){
+					FD_SET(clients[u].fd, &readfds);
+					maxfd = (maxfd > clients[u].fd) ? maxfd:clients[u].fd;
+				}
+				if(clients[u].output_bytes){
+					FD_SET(clients[u].fd, &writefds);
+					maxfd = (maxfd > clients[u].fd) ? maxfd:clients[u].fd;
+				}
 			}
 		}
 
@@ -654,51 +1670,134 @@ int main(int argc, char** argv) {
 			if (waiting_clients[u].fd >= 0) {
 				FD_SET(waiting_clients[u].fd, &readfds);
 				maxfd = (maxfd > waiting_clients[u].fd ? maxfd : waiting_clients[u].fd);
+				if (waiting_clients[u].output_bytes) {
+					FD_SET(waiting_clients[u].fd, &writefds);
+				}
 			}
 		}
 
-		//wait for events
-		status = select(maxfd + 1, &readfds, NULL, NULL, NULL);
+		//wait for events, do not block while there is deferred work
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 0;
+		status = select(maxfd + 1, &readfds, &writefds, NULL, pending ? &timeout : NULL);
 		if(status < 0){
-			logprintf(config.log, LOG_ERROR, "Failed to select: %s\n", strerror(errno));;
-			shutdown_server = 1;
+			if(errno != EINTR){
+				logprintf(config.log, LOG_ERROR, "Failed to select: %s\n", strerror(errno));;
+				shutdown_server = 1;
+			}
 		}
 		else{
+			if(FD_ISSET(config.acl.event_fd, &readfds)){
+				//swap in a reloaded ACL, a wakeup by reload_handler is handled at the top of the loop
+				acl_table* table = acl_reload_result(&config.acl);
+				if(table){
+					acl_activate(&config, table);
+				}
+			}
 			if(FD_ISSET(listen_fd, &readfds)){
 				//handle client connection
-				client_connection(&config, listen_fd, waiting_clients);
+				client_connection(&config, listen_fd, false, waiting_clients);
+			}
+			if(local_fd >= 0 && FD_ISSET(local_fd, &readfds)){
+				client_connection(&config, local_fd, true, waiting_clients);
+			}
+			if(FD_ISSET(config.timers.fd, &readfds)){
+				//handle deadlines and leases
+				if(!timer_wheel_read(config.log, &config.timers)){
+					shutdown_server = 1;
+				}
+				client_timeouts(&config, waiting_clients);
 			}
+
+			if(config.osc_fd >= 0 && FD_ISSET(config.osc_fd, &readfds)){
+				osc_input(&config);
+			}
+
+			// feedback is forwarded before any input is handled
 			for(u = 0; u < MAX_CLIENTS; u++){
-				if(FD_ISSET(clients[u].fd, &readfds)){
+				if(clients[u].ev_fd >= 0 && FD_ISSET(clients[u].ev_fd, &readfds)){
+					client_feedback(&config, clients + u, u);
+				}
+			}
+
+			// rotate the first slot served so low slot numbers are not favoured
+			for(p = 0; p < MAX_CLIENTS; p++){
+				u = (first_slot + p) % MAX_CLIENTS;
+				if(clients[u].fd >= 0 && FD_ISSET(clients[u].fd, &writefds)){
+					//flush pending replies
+					if (!client_flush(config.log, clients + u, u)) {
+						client_close(&config, clients + u, u, false);
+						continue;
+					}
+				}
+				if(clients[u].fd >= 0 && FD_ISSET(clients[u].fd, &readfds)){
 					//handle client data
 					if (!recv_data(&config, clients + u, u)) {
-						client_close(config.log, clients + u, u, false);
+						client_close(&config, clients + u, u, false);
 						continue;
 					}
-					client_data(&config, clients + u, u);
+				}
+				if(client_pending(clients + u)){
+					if (!client_data(&config, clients + u, u)) {
+						continue;
+					}
+				}
+				if(clients[u].ring && (FD_ISSET(clients[u].ring->event_fd, &readfds) || !ring_empty(clients[u].ring))){
+					client_ring(&config, clients + u, u);
+				}
+			}
+			first_slot = (first_slot + 1) % MAX_CLIENTS;
+
+			// effects of clients that just attached or whose output buffer was full
+			for(u = 0; u < MAX_CLIENTS; u++){
+				if(clients[u].effects_pending){
+					client_effects(&config, clients + u, u);
 				}
 			}
 
 			for (u = 0; u < MAX_WAITING_CLIENTS; u++) {
-				if (FD_ISSET(waiting_clients[u].fd, &readfds)) {
+				if (waiting_clients[u].fd >= 0 && FD_ISSET(waiting_clients[u].fd, &writefds)) {
+					if (!client_flush(config.log, waiting_clients + u, u)) {
+						waiting_close(&config, waiting_clients + u);
+						continue;
+					}
+				}
+				if (waiting_clients[u].fd >= 0 && FD_ISSET(waiting_clients[u].fd, &readfds)) {
 					//handle waiting clients
 					if (!recv_data(&config, waiting_clients + u, -u)) {
-						close(waiting_clients[u].fd);
-						waiting_clients[u].fd = -1;
+						waiting_close(&config, waiting_clients + u);
 						continue;
 					}
-					if (!client_hello(&config, waiting_clients + u, u)) {
-						waiting_clients[u].bytes_available = 0;
-						waiting_clients[u].scan_offset = 0;
-					}
+					// a failed handshake has closed the connection already
+					client_hello(&config, waiting_clients + u, u);
 				}
 			}
 		}
 	}
 
 	for(u = 0; u < MAX_CLIENTS; u++){
-		client_close(config.log, clients + u, u, true);
+		client_close(&config, clients + u, u, true);
+		free(clients[u].osc);
 	}
+	for(u = 0; u < MAX_WAITING_CLIENTS; u++){
+		waiting_close(&config, waiting_clients + u);
+	}
+	if(config.osc_fd >= 0){
+		if(config.osc_unknown){
+			logprintf(config.log, LOG_INFO, "Ignored %llu unmapped OSC messages\n", (unsigned long long) config.osc_unknown);
+		}
+		close(config.osc_fd);
+	}
+	osc_mapping_free(&config.osc);
+	reload_wakeup_fd = -1;
+	acl_reload_close(&config.acl);
+	free(config.acl_active);
+	remap_close(&config.remap);
+	timer_wheel_close(&config.timers);
 	close(listen_fd);
+	if(local_fd >= 0){
+		close(local_fd);
+		unlink(config.socket_path);
+	}
 	return EXIT_SUCCESS;
 }
@@ -4,9 +4,24 @@
 #include <linux/input.h>
 
 #include "../common/protocol.h"
+#include "../common/recording.h"
+#include "../common/osc.h"
+#include "../common/ring.h"
 
 #include "../libs/logger.h"
 
+#include "timer.h"
+#include "acl.h"
+#include "remap.h"
+
+// replies and feedback waiting for a slow peer, a connection exceeding this is dropped.
+// Has to hold a full batch of feedback messages (FEEDBACK_BUFFER_SIZE)
+#define OUTPUT_BUFFER_SIZE 1024
+// upper bound for a run of DATA messages decoded in one pass
+#define DATA_BATCH_EVENTS (INPUT_BUFFER_SIZE / sizeof(DataMessage))
+// recorded events buffered before they are written out
+#define RECORD_BUFFER_EVENTS 64
+
 struct enabled_event {
 	unsigned long type;
 	unsigned long code;
@@ -20,14 +35,46 @@ struct device_meta {
 	struct input_absinfo absinfo[ABS_CNT];
 };
 
-typedef struct /*_GAMEPAD_CLIENT*/ {
+typedef struct gamepad_client {
 	int fd;
+	// connection a slot opened with OPEN is multiplexed over, its fd stays -1
+	struct gamepad_client* owner;
+	// connected on the UNIX socket: every datagram holds complete messages, no password is asked
+	bool local;
+	// descriptors received with the last datagram and the event ring they were attached to
+	int ring_fds[2];
+	input_ring* ring;
 	int ev_fd;
 	struct device_meta meta;
 	uint8_t status;
 	size_t scan_offset;
 	uint8_t input_buffer[INPUT_BUFFER_SIZE];
 	ssize_t bytes_available;
+	uint8_t output_buffer[OUTPUT_BUFFER_SIZE];
+	size_t output_bytes;
+	wheel_timer timer;
+	uint64_t events_written;
+	uint64_t events_dropped;
+	uint64_t events_denied;
+	// force feedback and LED requests forwarded to the client, latency from the request to forwarding
+	uint64_t feedback_events;
+	uint64_t feedback_dropped;
+	uint64_t feedback_latency_total;
+	uint64_t feedback_latency_max;
+	// effects uploaded on the device, kept for clients attaching later. msg_type is 0 for
+	// free effect ids, ids whose upload or erasure the client has not been sent are set in effects_pending
+	FFUploadMessage effects[FF_EFFECTS_MAX];
+	uint32_t effects_pending;
+	// type/code pairs of the device allowed by the active ACL, checked for every DATA event
+	event_bitmap event_map;
+	// compiled remapping profile of the slot, NULL passes events through unchanged
+	remap_table* remap;
+	// events of the OSC controls routed to the slot, NULL for slots of network clients
+	osc_frame* osc;
+	int record_fd;
+	uint64_t record_epoch;
+	size_t record_length;
+	recording_event record_buffer[RECORD_BUFFER_EVENTS];
 } gamepad_client;
 
 typedef struct {
@@ -36,5 +83,21 @@ typedef struct {
 	char* bindhost;
 	char* port;
 	char* password;
-	int whitelist[EV_MAX][KEY_MAX];
+	// SOCK_SEQPACKET listener for clients on this host, access is controlled by the socket mode
+	char* socket_path;
+	char* socket_mode;
+	char* output;
+	char* record_prefix;
+	unsigned handshake_timeout;
+	unsigned device_lease;
+	timer_wheel timers;
+	acl_config acl;
+	acl_table* acl_active;
+	remap_config remap;
+	// OSC controls fed straight into their slots, the socket is -1 without --osc
+	char* osc_port;
+	char* osc_profile;
+	int osc_fd;
+	osc_mapping osc;
+	uint64_t osc_unknown;
 } Config;
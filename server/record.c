@@ -0,0 +1,144 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../libs/logger.h"
+#include "record.h"
+
+static uint64_t clock_ns(clockid_t clock){
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool record_flush(LOGGER log, gamepad_client* client){
+	size_t bytes = client->record_length * sizeof(recording_event);
+
+	if(client->record_length && write(client->record_fd, client->record_buffer, bytes) != bytes){
+		logprintf(log, LOG_ERROR, "Failed to write recording: %s\n", strerror(errno));
+		client->record_length = 0;
+		return false;
+	}
+	client->record_length = 0;
+	return true;
+}
+
+/**
+ * Creates a new recording for the device of a client, named <prefix>-<slot>-<unix time>.rec
+ * or <prefix>-<slot>-<unix time>.<n>.rec if that exists already, existing recordings are never
+ * overwritten. meta describes the device as created, after remapping.
+ */
+bool record_start(LOGGER log, gamepad_client* client, struct device_meta* meta, char* prefix, uint8_t slot){
+	char path[PATH_MAX];
+	unsigned long long seconds;
+	unsigned attempt;
+	size_t u, header_length = recording_header_length(meta->enabled_events_length);
+	recording_header* header = calloc(header_length, 1);
+	recording_capability* caps = (recording_capability*) (header + 1);
+
+	if(!header){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		return false;
+	}
+
+	//a device set up again starts a new recording
+	record_stop(log, client);
+
+	memcpy(header->magic, RECORDING_MAGIC, sizeof(header->magic));
+	header->version = RECORDING_VERSION;
+	header->header_length = header_length;
+	header->start_time = clock_ns(CLOCK_REALTIME);
+	header->id = meta->id;
+	header->num_capabilities = meta->enabled_events_length;
+	if(meta->name){
+		strncpy(header->name, meta->name, UINPUT_MAX_NAME_SIZE - 1);
+	}
+	memcpy(header->absinfo, meta->absinfo, sizeof(header->absinfo));
+	for(u = 0; u < meta->enabled_events_length; u++){
+		caps[u].type = meta->enabled_events[u].type;
+		caps[u].code = meta->enabled_events[u].code;
+	}
+
+	seconds = header->start_time / 1000000000ULL;
+	client->record_fd = -1;
+	for(attempt = 0; attempt < RECORD_NAME_ATTEMPTS && client->record_fd < 0; attempt++){
+		if(attempt){
+			snprintf(path, sizeof(path), "%s-%d-%llu.%u.rec", prefix, slot, seconds, attempt);
+		} else {
+			snprintf(path, sizeof(path), "%s-%d-%llu.rec", prefix, slot, seconds);
+		}
+		client->record_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+		if(client->record_fd < 0 && errno != EEXIST){
+			break;
+		}
+	}
+	if(client->record_fd < 0){
+		logprintf(log, LOG_ERROR, "[%d] Failed to create recording %s: %s\n", slot, path, strerror(errno));
+		free(header);
+		return false;
+	}
+
+	if(write(client->record_fd, header, header_length) != header_length){
+		logprintf(log, LOG_ERROR, "[%d] Failed to write recording header: %s\n", slot, strerror(errno));
+		close(client->record_fd);
+		client->record_fd = -1;
+		free(header);
+		return false;
+	}
+
+	logprintf(log, LOG_INFO, "[%d] Recording to %s\n", slot, path);
+	client->record_epoch = clock_ns(CLOCK_MONOTONIC);
+	client->record_length = 0;
+	free(header);
+	return true;
+}
+
+/**
+ * Appends events to the recording. Records are buffered and written
+ * whenever the buffer is full or a frame is completed.
+ */
+bool record_events(LOGGER log, gamepad_client* client, struct input_event* events, size_t count){
+	uint64_t now;
+	size_t u;
+	bool sync = false;
+
+	if(client->record_fd < 0){
+		return true;
+	}
+
+	now = clock_ns(CLOCK_MONOTONIC) - client->record_epoch;
+	for(u = 0; u < count; u++){
+		client->record_buffer[client->record_length].time = now;
+		client->record_buffer[client->record_length].type = events[u].type;
+		client->record_buffer[client->record_length].code = events[u].code;
+		client->record_buffer[client->record_length].value = events[u].value;
+		client->record_length++;
+		sync = (events[u].type == EV_SYN);
+
+		if(client->record_length == RECORD_BUFFER_EVENTS && !record_flush(log, client)){
+			record_stop(log, client);
+			return false;
+		}
+	}
+
+	if(sync && !record_flush(log, client)){
+		record_stop(log, client);
+		return false;
+	}
+	return true;
+}
+
+void record_stop(LOGGER log, gamepad_client* client){
+	if(client->record_fd < 0){
+		return;
+	}
+
+	record_flush(log, client);
+	close(client->record_fd);
+	client->record_fd = -1;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <stdbool.h>
+#include <linux/input.h>
+
+#include "../libs/logger.h"
+#include "../common/recording.h"
+
+#include "input-server.h"
+
+// recordings started within the same second get a numbered suffix, up to this many
+#define RECORD_NAME_ATTEMPTS 100
+
+bool record_start(LOGGER log, gamepad_client* client, struct device_meta* meta, char* prefix, uint8_t slot);
+bool record_events(LOGGER log, gamepad_client* client, struct input_event* events, size_t count);
+void record_stop(LOGGER log, gamepad_client* client);
@@ -0,0 +1,477 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libevdev/libevdev.h>
+
+#include "../libs/logger.h"
+#include "input-server.h"
+#include "remap.h"
+
+// resolves a type.code pair by name
+static bool remap_event_name(char* name, uint16_t* type, uint16_t* code){
+	char* separator = strchr(name, '.');
+	int itype, icode;
+
+	if(!separator){
+		return false;
+	}
+	*separator = 0;
+
+	itype = libevdev_event_type_from_name(name);
+	if(itype <= EV_SYN || itype >= EV_CNT){
+		return false;
+	}
+
+	icode = libevdev_event_code_from_name(itype, separator + 1);
+	if(icode < 0 || icode >= KEY_CNT){
+		return false;
+	}
+
+	*type = itype;
+	*code = icode;
+	return true;
+}
+
+// selects the section started by a [*], [slot N] or [name <device name>] header
+static remap_profile* remap_section(LOGGER log, remap_config* config, char* header){
+	remap_profile* profile;
+	char* end = strrchr(header, ']');
+	char* name = NULL;
+	int slot = -1;
+	size_t u;
+
+	if(!end){
+		return NULL;
+	}
+	*end = 0;
+
+	if(!strncmp(header, "slot ", 5)){
+		//sections name slots like the protocol does, starting at 1
+		slot = strtol(header + 5, &end, 10) - 1;
+		if(*end || slot < 0){
+			return NULL;
+		}
+	}
+	else if(!strncmp(header, "name ", 5)){
+		name = header + 5;
+	}
+	else if(strcmp(header, "*")){
+		return NULL;
+	}
+
+	//repeated headers continue the same profile
+	for(u = 0; u < config->num_profiles; u++){
+		profile = config->profiles + u;
+		if(profile->slot == slot && ((!profile->name && !name) || (profile->name && name && !strcmp(profile->name, name)))){
+			return profile;
+		}
+	}
+
+	profile = realloc(config->profiles, (config->num_profiles + 1) * sizeof(remap_profile));
+	if(!profile){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		return NULL;
+	}
+	config->profiles = profile;
+	profile += config->num_profiles;
+	memset(profile, 0, sizeof(remap_profile));
+	profile->slot = slot;
+	if(name){
+		profile->name = strdup(name);
+	}
+	config->num_profiles++;
+	return profile;
+}
+
+// returns the rule for an event, rules for the same event accumulate
+static remap_rule* remap_profile_rule(LOGGER log, remap_profile* profile, uint16_t type, uint16_t code){
+	remap_rule* rule;
+	size_t u;
+
+	for(u = 0; u < profile->num_rules; u++){
+		if(profile->rules[u].type == type && profile->rules[u].code == code){
+			return profile->rules + u;
+		}
+	}
+
+	rule = realloc(profile->rules, (profile->num_rules + 1) * sizeof(remap_rule));
+	if(!rule){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		return NULL;
+	}
+	profile->rules = rule;
+	rule += profile->num_rules;
+	*rule = (remap_rule) {
+		.type = type,
+		.code = code,
+		.target_type = type,
+		.target_code = code,
+		.scale = 1.0,
+		.curve = 1.0
+	};
+	profile->num_rules++;
+	return rule;
+}
+
+// applies one rule line of the form type.code <action> [argument]
+static char* remap_line(LOGGER log, remap_profile* profile, char* line){
+	char* source = strtok(line, " \t");
+	char* action = strtok(NULL, " \t");
+	char* argument = strtok(NULL, " \t");
+	char* end = NULL;
+	uint16_t type, code;
+	remap_rule* rule;
+
+	if(!source || !action){
+		return "Format is type.code <action> [argument]";
+	}
+
+	if(!remap_event_name(source, &type, &code)){
+		return "Source event is not valid";
+	}
+
+	if(!(rule = remap_profile_rule(log, profile, type, code))){
+		return "Failed to allocate memory";
+	}
+
+	if(!strcmp(action, "invert")){
+		if(type != EV_KEY && type != EV_ABS && type != EV_REL){
+			return "Only key, absolute and relative events can be inverted";
+		}
+		rule->invert = true;
+		return NULL;
+	}
+
+	if(!argument){
+		return "Missing argument";
+	}
+
+	if(!strcmp(action, "=") || !strcmp(action, "map")){
+		if(!remap_event_name(argument, &rule->target_type, &rule->target_code)){
+			return "Target event is not valid";
+		}
+		if(rule->target_type != type){
+			return "Mapping between event types is not supported";
+		}
+		return NULL;
+	}
+
+	if(type != EV_ABS && type != EV_REL){
+		return "Only absolute and relative events can be scaled";
+	}
+
+	if(!strcmp(action, "scale")){
+		rule->scale = strtod(argument, &end);
+	}
+	else if(!strcmp(action, "deadzone")){
+		rule->deadzone = strtol(argument, &end, 10);
+		if(rule->deadzone < 0){
+			return "Deadzone must not be negative";
+		}
+	}
+	else if(!strcmp(action, "curve")){
+		rule->curve = strtod(argument, &end);
+		if(rule->curve <= 0){
+			return "Curve exponent must be positive";
+		}
+	}
+	else{
+		return "Unknown action";
+	}
+
+	return (*end) ? "Argument is not a number" : NULL;
+}
+
+/**
+ * Reads a remapping profile file. Rules before the first section header apply to all
+ * devices, like rules in a [*] section.
+ */
+bool remap_load(LOGGER log, remap_config* config, char* file){
+	FILE* f = fopen(file, "r");
+	remap_profile* profile = NULL;
+	char any[] = "*]";
+	char* line = NULL;
+	char* error;
+	size_t len = 0, line_num = 0;
+	bool status = true;
+
+	if(!f){
+		logprintf(log, LOG_ERROR, "Cannot open file %s: %s\n", file, strerror(errno));
+		return false;
+	}
+
+	while(getline(&line, &len, f) != -1){
+		line_num++;
+		line[strcspn(line, "\r\n")] = 0;
+		if(line[0] == '#' || line[0] == 0){
+			continue;
+		}
+
+		if(line[0] == '['){
+			profile = remap_section(log, config, line + 1);
+			if(!profile){
+				logprintf(log, LOG_ERROR, "%s:%zu: Section is not valid. Format is [*], [slot N] or [name <device name>]\n", file, line_num);
+				status = false;
+				break;
+			}
+			continue;
+		}
+
+		if(!profile && !(profile = remap_section(log, config, any))){
+			status = false;
+			break;
+		}
+
+		error = remap_line(log, profile, line);
+		if(error){
+			logprintf(log, LOG_ERROR, "%s:%zu: %s\n", file, line_num, error);
+			status = false;
+			break;
+		}
+	}
+
+	fclose(f);
+	free(line);
+	return status;
+}
+
+/**
+ * Computes the output value of an event. Absolute axes with a range are transformed
+ * relative to their center and clamped to the range, other values relative to 0.
+ */
+int32_t remap_value(remap_rule* rule, struct input_absinfo* absinfo, int32_t value){
+	double center = 0, range, offset;
+
+	if(rule->type == EV_KEY){
+		//key repeats (2) keep their value
+		return (rule->invert && value < 2) ? !value : value;
+	}
+
+	if(absinfo && absinfo->maximum > absinfo->minimum){
+		center = ((double) absinfo->minimum + absinfo->maximum) / 2;
+		range = ((double) absinfo->maximum - absinfo->minimum) / 2;
+
+		offset = fabs(value - center) - rule->deadzone;
+		offset = (offset > 0 && range > rule->deadzone) ? fmin(offset / (range - rule->deadzone), 1.0) : 0;
+		offset = pow(offset, rule->curve) * range * rule->scale;
+	}
+	else{
+		offset = fabs((double) value) - rule->deadzone;
+		offset = (offset > 0) ? pow(offset, rule->curve) * rule->scale : 0;
+	}
+
+	if((value < center) != rule->invert){
+		offset = -offset;
+	}
+
+	offset = round(center + offset);
+	if(absinfo && absinfo->maximum > absinfo->minimum){
+		offset = fmax(fmin(offset, absinfo->maximum), absinfo->minimum);
+	}
+	return fmax(fmin(offset, INT32_MAX), INT32_MIN);
+}
+
+// precomputes the output values of a rule over the value range of its event
+static bool remap_lut(remap_entry* entry){
+	int64_t min, max, value;
+
+	switch(entry->rule->type){
+		case EV_KEY:
+			min = 0;
+			max = 2;
+			break;
+		case EV_ABS:
+			if(entry->absinfo && entry->absinfo->maximum > entry->absinfo->minimum
+					&& (int64_t) entry->absinfo->maximum - entry->absinfo->minimum < REMAP_LUT_MAX){
+				min = entry->absinfo->minimum;
+				max = entry->absinfo->maximum;
+				break;
+			}
+			//fall through
+		default:
+			min = -REMAP_REL_RANGE;
+			max = REMAP_REL_RANGE;
+			break;
+	}
+
+	entry->lut = calloc(max - min + 1, sizeof(int32_t));
+	if(!entry->lut){
+		return false;
+	}
+
+	entry->lut_min = min;
+	entry->lut_size = max - min + 1;
+	for(value = min; value <= max; value++){
+		entry->lut[value - min] = remap_value(entry->rule, entry->absinfo, value);
+	}
+	return true;
+}
+
+static remap_profile* remap_select(remap_config* config, struct device_meta* meta, int slot){
+	remap_profile* any = NULL;
+	remap_profile* named = NULL;
+	size_t u;
+
+	for(u = 0; u < config->num_profiles; u++){
+		if(config->profiles[u].slot == slot){
+			return config->profiles + u;
+		}
+		if(config->profiles[u].name){
+			if(!named && meta->name && !strcmp(config->profiles[u].name, meta->name)){
+				named = config->profiles + u;
+			}
+		}
+		else if(config->profiles[u].slot < 0){
+			any = config->profiles + u;
+		}
+	}
+	return named ? named : any;
+}
+
+// adds the device capabilities after remapping to output, removing duplicates
+static bool remap_capabilities(remap_table* table, struct device_meta* meta, struct device_meta* output){
+	event_bitmap seen = {
+		0
+	};
+	remap_entry* entry;
+	uint16_t type, code, source;
+	size_t u;
+
+	output->enabled_events = calloc(meta->enabled_events_length, sizeof(struct enabled_event));
+	if(!output->enabled_events){
+		return false;
+	}
+
+	for(u = 0; u < meta->enabled_events_length; u++){
+		type = meta->enabled_events[u].type;
+		code = source = meta->enabled_events[u].code;
+		if(type < EV_CNT && code < KEY_CNT && table->types[type]){
+			entry = table->types[type] + code;
+			type = entry->type;
+			code = entry->code;
+		}
+
+		if(type >= EV_CNT || code >= KEY_CNT){
+			//invalid requests are rejected by the backend
+			output->enabled_events[output->enabled_events_length++] = meta->enabled_events[u];
+			continue;
+		}
+
+		if(event_bitmap_test(seen, type, code)){
+			continue;
+		}
+		event_bitmap_set(seen, type, code);
+
+		output->enabled_events[output->enabled_events_length].type = type;
+		output->enabled_events[output->enabled_events_length].code = code;
+		output->enabled_events_length++;
+
+		if(type == EV_ABS && code < ABS_CNT && source < ABS_CNT){
+			output->absinfo[code] = meta->absinfo[source];
+		}
+	}
+	return true;
+}
+
+/**
+ * Compiles the profile matching a slot into per-event lookup tables. A [slot N] section
+ * takes precedence over a [name ...] section, which takes precedence over [*].
+ * output receives the device description after remapping, its enabled_events have to be
+ * freed by the caller. Returns NULL if no profile applies or on failure, events then
+ * pass through unchanged.
+ */
+remap_table* remap_compile(LOGGER log, remap_config* config, struct device_meta* meta, int slot, struct device_meta* output){
+	remap_profile* profile = remap_select(config, meta, slot);
+	remap_table* table;
+	remap_entry* entry;
+	remap_rule* rule;
+	size_t u, code;
+
+	if(!profile || !profile->num_rules){
+		return NULL;
+	}
+
+	table = calloc(1, sizeof(remap_table));
+	if(!table){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		return NULL;
+	}
+	memcpy(table->absinfo, meta->absinfo, sizeof(table->absinfo));
+
+	for(u = 0; u < profile->num_rules; u++){
+		rule = profile->rules + u;
+		if(!table->types[rule->type]){
+			table->types[rule->type] = calloc(KEY_CNT, sizeof(remap_entry));
+			if(!table->types[rule->type]){
+				logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+				remap_free(table);
+				return NULL;
+			}
+			for(code = 0; code < KEY_CNT; code++){
+				table->types[rule->type][code].type = rule->type;
+				table->types[rule->type][code].code = code;
+			}
+		}
+
+		entry = table->types[rule->type] + rule->code;
+		entry->type = rule->target_type;
+		entry->code = rule->target_code;
+		if(rule->type == EV_ABS && rule->code < ABS_CNT){
+			entry->absinfo = table->absinfo + rule->code;
+		}
+
+		if(rule->invert || rule->scale != 1.0 || rule->deadzone || rule->curve != 1.0){
+			entry->rule = rule;
+			if(!remap_lut(entry)){
+				logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+				remap_free(table);
+				return NULL;
+			}
+		}
+	}
+
+	*output = *meta;
+	output->enabled_events = NULL;
+	output->enabled_events_length = 0;
+	memset(output->absinfo, 0, sizeof(output->absinfo));
+	if(!remap_capabilities(table, meta, output)){
+		logprintf(log, LOG_ERROR, "Failed to allocate memory\n");
+		remap_free(table);
+		return NULL;
+	}
+
+	logprintf(log, LOG_INFO, "[%d] Applying remapping profile with %zu rules\n", slot, profile->num_rules);
+	return table;
+}
+
+void remap_free(remap_table* table){
+	size_t type, code;
+
+	if(!table){
+		return;
+	}
+
+	for(type = 0; type < EV_CNT; type++){
+		if(table->types[type]){
+			for(code = 0; code < KEY_CNT; code++){
+				free(table->types[type][code].lut);
+			}
+			free(table->types[type]);
+		}
+	}
+	free(table);
+}
+
+void remap_close(remap_config* config){
+	size_t u;
+
+	for(u = 0; u < config->num_profiles; u++){
+		free(config->profiles[u].name);
+		free(config->profiles[u].rules);
+	}
+	free(config->profiles);
+	config->profiles = NULL;
+	config->num_profiles = 0;
+}
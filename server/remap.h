@@ -0,0 +1,86 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+#include "../libs/logger.h"
+
+// absolute axes with at most this many values get a value lookup table
+#define REMAP_LUT_MAX 65536
+// relative values in [-REMAP_REL_RANGE, REMAP_REL_RANGE] are transformed by table lookup
+#define REMAP_REL_RANGE 1024
+
+typedef struct {
+	uint16_t type;
+	uint16_t code;
+	uint16_t target_type;
+	uint16_t target_code;
+	bool invert;
+	double scale;
+	int32_t deadzone;
+	double curve;
+} remap_rule;
+
+// rules of one section of the profile file
+typedef struct {
+	// index of the slot ([slot N] selects index N - 1), -1 matches any slot
+	int slot;
+	// device name to match, NULL matches any device
+	char* name;
+	remap_rule* rules;
+	size_t num_rules;
+} remap_profile;
+
+typedef struct {
+	remap_profile* profiles;
+	size_t num_profiles;
+} remap_config;
+
+typedef struct {
+	uint16_t type;
+	uint16_t code;
+	// NULL if only type and code change. Values in [lut_min, lut_min + lut_size)
+	// are looked up, others are computed from the rule
+	remap_rule* rule;
+	int32_t* lut;
+	int32_t lut_min;
+	uint32_t lut_size;
+	struct input_absinfo* absinfo;
+} remap_entry;
+
+// compiled profile of a slot, event types without rules pass through
+typedef struct {
+	remap_entry* types[EV_CNT];
+	// axis ranges of the source device
+	struct input_absinfo absinfo[ABS_CNT];
+} remap_table;
+
+int32_t remap_value(remap_rule* rule, struct input_absinfo* absinfo, int32_t value);
+
+/**
+ * Translates an event in place. Type and code have to be in range (as
+ * guaranteed by the event map of the slot).
+ */
+static inline void remap_event(remap_table* table, struct input_event* event) {
+	remap_entry* entry;
+	uint32_t index;
+
+	if (!table->types[event->type]) {
+		return;
+	}
+
+	entry = table->types[event->type] + event->code;
+	event->type = entry->type;
+	event->code = entry->code;
+	if (entry->rule) {
+		index = (uint32_t) event->value - (uint32_t) entry->lut_min;
+		event->value = (index < entry->lut_size) ? entry->lut[index] : remap_value(entry->rule, entry->absinfo, event->value);
+	}
+}
+
+bool remap_load(LOGGER log, remap_config* config, char* file);
+void remap_close(remap_config* config);
+
+struct device_meta;
+remap_table* remap_compile(LOGGER log, remap_config* config, struct device_meta* meta, int slot, struct device_meta* output);
+void remap_free(remap_table* table);
@@ -0,0 +1,160 @@
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "../libs/logger.h"
+#include "timer.h"
+
+// the timerfd only ticks while at least one timer is armed
+static bool timer_wheel_run(timer_wheel* wheel, bool run){
+	struct itimerspec spec = {
+		0
+	};
+
+	if(run){
+		spec.it_interval.tv_sec = TIMER_TICK_MS / 1000;
+		spec.it_interval.tv_nsec = (TIMER_TICK_MS % 1000) * 1000000;
+		spec.it_value = spec.it_interval;
+	}
+
+	return timerfd_settime(wheel->fd, 0, &spec, NULL) == 0;
+}
+
+bool timer_wheel_init(LOGGER log, timer_wheel* wheel){
+	size_t u;
+
+	wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(wheel->fd < 0){
+		logprintf(log, LOG_ERROR, "Failed to create timer: %s\n", strerror(errno));
+		return false;
+	}
+
+	wheel->tick = 0;
+	wheel->pending_ticks = 0;
+	wheel->active = 0;
+	for(u = 0; u < TIMER_WHEEL_SLOTS; u++){
+		wheel->buckets[u].next = wheel->buckets + u;
+		wheel->buckets[u].prev = wheel->buckets + u;
+	}
+	return true;
+}
+
+void timer_wheel_close(timer_wheel* wheel){
+	if(wheel->fd >= 0){
+		close(wheel->fd);
+		wheel->fd = -1;
+	}
+}
+
+bool timer_armed(wheel_timer* timer){
+	return timer->next != NULL;
+}
+
+void timer_disarm(timer_wheel* wheel, wheel_timer* timer){
+	if(!timer_armed(timer)){
+		return;
+	}
+
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+
+	wheel->active--;
+	if(!wheel->active){
+		timer_wheel_run(wheel, false);
+		wheel->pending_ticks = 0;
+	}
+}
+
+static void timer_link(timer_wheel* wheel, wheel_timer* timer, unsigned kind, uint64_t expires){
+	wheel_timer* bucket;
+
+	timer->kind = kind;
+	timer->expires = expires;
+
+	bucket = wheel->buckets + (timer->expires % TIMER_WHEEL_SLOTS);
+	timer->next = bucket->next;
+	timer->prev = bucket;
+	bucket->next->prev = timer;
+	bucket->next = timer;
+
+	if(!wheel->active){
+		timer_wheel_run(wheel, true);
+	}
+	wheel->active++;
+}
+
+void timer_arm(timer_wheel* wheel, wheel_timer* timer, unsigned kind, unsigned ms){
+	uint64_t ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+
+	timer_disarm(wheel, timer);
+	timer_link(wheel, timer, kind, wheel->tick + (ticks ? ticks : 1));
+}
+
+/**
+ * Hands the deadline of from over to to, e.g. when a connection moves to another slot.
+ * to is only disarmed if from is not armed.
+ */
+void timer_move(timer_wheel* wheel, wheel_timer* from, wheel_timer* to, unsigned kind){
+	timer_disarm(wheel, to);
+	if(!timer_armed(from)){
+		return;
+	}
+
+	// a deadline that passed before its expiry was processed is handled with the current tick
+	timer_link(wheel, to, kind, (from->expires > wheel->tick) ? from->expires : wheel->tick);
+	timer_disarm(wheel, from);
+}
+
+/**
+ * Reads the number of elapsed ticks from the timerfd.
+ * Call timer_wheel_expired afterwards to fetch the timers that ran out.
+ */
+bool timer_wheel_read(LOGGER log, timer_wheel* wheel){
+	uint64_t ticks;
+
+	if(read(wheel->fd, &ticks, sizeof(ticks)) != sizeof(ticks)){
+		if(errno == EAGAIN || errno == EINTR){
+			return true;
+		}
+		logprintf(log, LOG_ERROR, "Failed to read timer: %s\n", strerror(errno));
+		return false;
+	}
+
+	wheel->pending_ticks += ticks;
+	return true;
+}
+
+/**
+ * Returns the next expired timer (which is disarmed before returning it), or NULL
+ * when all elapsed ticks have been processed. Every tick only inspects a single bucket.
+ */
+wheel_timer* timer_wheel_expired(timer_wheel* wheel){
+	wheel_timer* bucket;
+	wheel_timer* timer;
+
+	// after a full revolution every bucket has been visited anyway
+	if(wheel->pending_ticks > TIMER_WHEEL_SLOTS){
+		wheel->tick += wheel->pending_ticks - TIMER_WHEEL_SLOTS;
+		wheel->pending_ticks = TIMER_WHEEL_SLOTS;
+	}
+
+	while(true){
+		bucket = wheel->buckets + (wheel->tick % TIMER_WHEEL_SLOTS);
+		for(timer = bucket->next; timer != bucket; timer = timer->next){
+			if(timer->expires <= wheel->tick){
+				timer_disarm(wheel, timer);
+				return timer;
+			}
+		}
+
+		if(!wheel->pending_ticks){
+			return NULL;
+		}
+		wheel->pending_ticks--;
+		wheel->tick++;
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../libs/logger.h"
+
+// resolution of the timer wheel
+#define TIMER_TICK_MS 250
+// number of buckets, timers further out than one revolution stay in their bucket for multiple rounds
+#define TIMER_WHEEL_SLOTS 64
+
+typedef struct wheel_timer {
+	struct wheel_timer* next;
+	struct wheel_timer* prev;
+	uint64_t expires;
+	unsigned kind;
+} wheel_timer;
+
+typedef struct {
+	int fd;
+	uint64_t tick;
+	uint64_t pending_ticks;
+	size_t active;
+	wheel_timer buckets[TIMER_WHEEL_SLOTS];
+} timer_wheel;
+
+bool timer_wheel_init(LOGGER log, timer_wheel* wheel);
+void timer_wheel_close(timer_wheel* wheel);
+bool timer_wheel_read(LOGGER log, timer_wheel* wheel);
+wheel_timer* timer_wheel_expired(timer_wheel* wheel);
+
+void timer_arm(timer_wheel* wheel, wheel_timer* timer, unsigned kind, unsigned ms);
+void timer_move(timer_wheel* wheel, wheel_timer* from, wheel_timer* to, unsigned kind);
+void timer_disarm(timer_wheel* wheel, wheel_timer* timer);
+bool timer_armed(wheel_timer* timer);
@@ -6,9 +6,18 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <endian.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 #include "../libs/logger.h"
 #include "uinput.h"
+#include "record.h"
+
+static char* output_path = NULL;
 
 struct {
 	unsigned long event;
@@ -19,6 +28,8 @@ struct {
 	{EV_REL, UI_SET_RELBIT},
 	{EV_ABS, UI_SET_ABSBIT},
 	{EV_MSC, UI_SET_MSCBIT},
+	{EV_LED, UI_SET_LEDBIT},
+	{EV_FF, UI_SET_FFBIT},
 	{0, 0}
 };
 
@@ -60,9 +71,10 @@ static bool enable_events(LOGGER log, int fd, struct device_meta* meta){
 	return true;
 }
 
-bool create_device(LOGGER log, gamepad_client* client, struct device_meta* meta) {
+static bool uinput_create(LOGGER log, gamepad_client* client, struct device_meta* meta, uint8_t slot) {
 	size_t u;
-	int uinput_version, uinput_fd = open(UINPUT_PATH, O_WRONLY | O_NONBLOCK);
+	//read access delivers force feedback requests and LED changes
+	int uinput_version, uinput_fd = open(UINPUT_PATH, O_RDWR | O_NONBLOCK);
 	struct uinput_setup ui_setup = {
 		.id = meta->id
 	};
@@ -78,6 +90,14 @@ bool create_device(LOGGER log, gamepad_client* client, struct device_meta* meta)
 		return false;
 	}
 
+	for(u = 0; u < meta->enabled_events_length; u++){
+		if(meta->enabled_events[u].type == EV_FF){
+			ui_setup.ff_effects_max = FF_EFFECTS_MAX;
+			ui_dev.ff_effects_max = FF_EFFECTS_MAX;
+			break;
+		}
+	}
+
 	if(ioctl(uinput_fd, UI_GET_VERSION, &uinput_version)){
 		logprintf(log, LOG_ERROR, "Failed to query uinput version\n");
 		close(uinput_fd);
@@ -143,6 +163,282 @@ bool create_device(LOGGER log, gamepad_client* client, struct device_meta* meta)
 	return true;
 }
 
+static bool uinput_write(LOGGER log, gamepad_client* client, struct input_event* events, size_t count, uint8_t slot) {
+	if(write(client->ev_fd, events, count * sizeof(struct input_event)) < 0){
+		logprintf(log, LOG_ERROR, "[%d] Failed to write event: %s\n", slot, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static void feedback_latency(gamepad_client* client, struct input_event* event) {
+	struct timespec now;
+	uint64_t latency;
+
+	//uinput stamps its requests with the monotonic clock
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	latency = (now.tv_sec - event->input_event_sec) * 1000000000LL + now.tv_nsec - event->input_event_usec * 1000LL;
+	client->feedback_events++;
+	client->feedback_latency_total += latency;
+	if(latency > client->feedback_latency_max){
+		client->feedback_latency_max = latency;
+	}
+}
+
+/**
+ * Handles the requests queued on a uinput device. Effect uploads and erasures are acknowledged
+ * right away, without a round trip to the client, so games are not blocked by the network.
+ * Effects are kept with the device and marked pending for the client, playback and LED
+ * changes are encoded as messages into buffer.
+ */
+static ssize_t uinput_feedback(LOGGER log, gamepad_client* client, uint8_t* buffer, uint8_t slot) {
+	struct input_event events[FEEDBACK_BATCH];
+	struct uinput_ff_upload upload;
+	struct uinput_ff_erase erase;
+	FeedbackMessage* feedback;
+	ssize_t bytes = read(client->ev_fd, events, sizeof(events));
+	size_t u, offset = 0;
+
+	if(bytes < 0){
+		if(errno == EAGAIN || errno == EINTR){
+			return 0;
+		}
+		logprintf(log, LOG_ERROR, "[%d] Failed to read from uinput: %s\n", slot, strerror(errno));
+		return -1;
+	}
+
+	for(u = 0; u < bytes / sizeof(struct input_event); u++){
+		if(events[u].type == EV_UINPUT && events[u].code == UI_FF_UPLOAD){
+			memset(&upload, 0, sizeof(upload));
+			upload.request_id = events[u].value;
+			if(ioctl(client->ev_fd, UI_BEGIN_FF_UPLOAD, &upload)){
+				logprintf(log, LOG_WARNING, "[%d] Failed to fetch effect upload: %s\n", slot, strerror(errno));
+				continue;
+			}
+
+			upload.retval = 0;
+			if(upload.effect.id < 0 || upload.effect.id >= FF_EFFECTS_MAX){
+				logprintf(log, LOG_WARNING, "[%d] Effect id %d out of range\n", slot, upload.effect.id);
+				upload.retval = -EINVAL;
+			}
+			else{
+				encode_ff_effect(client->effects + upload.effect.id, &upload.effect);
+				client->effects_pending |= 1u << upload.effect.id;
+			}
+
+			if(ioctl(client->ev_fd, UI_END_FF_UPLOAD, &upload)){
+				logprintf(log, LOG_WARNING, "[%d] Failed to complete effect upload: %s\n", slot, strerror(errno));
+			}
+			feedback_latency(client, events + u);
+		}
+		else if(events[u].type == EV_UINPUT && events[u].code == UI_FF_ERASE){
+			memset(&erase, 0, sizeof(erase));
+			erase.request_id = events[u].value;
+			if(ioctl(client->ev_fd, UI_BEGIN_FF_ERASE, &erase)){
+				logprintf(log, LOG_WARNING, "[%d] Failed to fetch effect erasure: %s\n", slot, strerror(errno));
+				continue;
+			}
+
+			if(erase.effect_id < FF_EFFECTS_MAX){
+				memset(client->effects + erase.effect_id, 0, sizeof(FFUploadMessage));
+				client->effects_pending |= 1u << erase.effect_id;
+			}
+
+			erase.retval = 0;
+			if(ioctl(client->ev_fd, UI_END_FF_ERASE, &erase)){
+				logprintf(log, LOG_WARNING, "[%d] Failed to complete effect erasure: %s\n", slot, strerror(errno));
+			}
+			feedback_latency(client, events + u);
+		}
+		else if(events[u].type == EV_FF || events[u].type == EV_LED){
+			feedback = (FeedbackMessage*) (buffer + offset);
+			feedback->msg_type = MESSAGE_FEEDBACK;
+			feedback->type = htobe16(events[u].type);
+			feedback->code = htobe16(events[u].code);
+			feedback->value = htobe32(events[u].value);
+			offset += sizeof(FeedbackMessage);
+			feedback_latency(client, events + u);
+		}
+	}
+
+	return offset;
+}
+
+static bool uinput_destroy(LOGGER log, gamepad_client* client) {
+	if(ioctl(client->ev_fd, UI_DEV_DESTROY)){
+		logprintf(log, LOG_ERROR, "Failed to destroy uinput device: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+// the null backend only counts the events, the descriptor just marks the device as present
+static bool null_create(LOGGER log, gamepad_client* client, struct device_meta* meta, uint8_t slot) {
+	client->ev_fd = open("/dev/null", O_WRONLY);
+	if(client->ev_fd < 0){
+		logprintf(log, LOG_ERROR, "Failed to open /dev/null: %s\n", strerror(errno));
+		return false;
+	}
+	logprintf(log, LOG_INFO, "[%d] Created null device %s\n", slot, meta->name);
+	return true;
+}
+
+static bool null_write(LOGGER log, gamepad_client* client, struct input_event* events, size_t count, uint8_t slot) {
+	return true;
+}
+
+static bool null_destroy(LOGGER log, gamepad_client* client) {
+	return true;
+}
+
+// batches up to PIPE_BUF bytes are written to a pipe as a whole or not at all, lines are never torn
+_Static_assert(FILE_OUTPUT_BUFFER <= PIPE_BUF, "file output batches must be atomic on pipes");
+
+// the file backend appends one line per event to a file or named pipe
+static bool file_create(LOGGER log, gamepad_client* client, struct device_meta* meta, uint8_t slot) {
+	char header[UINPUT_MAX_NAME_SIZE + 64];
+	int length;
+
+	//O_NONBLOCK keeps a fifo whose reader falls behind from stalling the server
+	client->ev_fd = open(output_path, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK, 0644);
+	if(client->ev_fd < 0 && errno == ENXIO){
+		//a fifo without reader can only be opened for writing together with a read end,
+		//events are buffered in the pipe (and dropped once it is full) until a reader attaches
+		logprintf(log, LOG_INFO, "[%d] No reader on %s yet\n", slot, output_path);
+		client->ev_fd = open(output_path, O_RDWR | O_NONBLOCK);
+	}
+	if(client->ev_fd < 0){
+		logprintf(log, LOG_ERROR, "Failed to open output file %s: %s\n", output_path, strerror(errno));
+		return false;
+	}
+
+	length = snprintf(header, sizeof(header), "# %d device %.*s\n", slot, UINPUT_MAX_NAME_SIZE, meta->name ? meta->name : "");
+	if(write(client->ev_fd, header, length) < 0){
+		logprintf(log, LOG_WARNING, "[%d] Failed to write device header: %s\n", slot, strerror(errno));
+	}
+	return true;
+}
+
+/**
+ * Writes one batch of lines. Returns 1 when it was written, 0 when a pipe
+ * was full and -1 on failure. Short writes (only seen on regular files,
+ * batches are atomic on pipes) are completed.
+ */
+static int file_flush(int fd, char* buffer, size_t length) {
+	ssize_t bytes;
+	size_t offset = 0;
+
+	while(offset < length){
+		bytes = write(fd, buffer + offset, length - offset);
+		if(bytes < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			//a slow reader on a pipe should not disconnect the client
+			return (errno == EAGAIN && !offset) ? 0 : -1;
+		}
+		offset += bytes;
+	}
+	return 1;
+}
+
+static bool file_write(LOGGER log, gamepad_client* client, struct input_event* events, size_t count, uint8_t slot) {
+	char buffer[FILE_OUTPUT_BUFFER];
+	struct timeval now;
+	size_t u, first = 0, length = 0;
+	int status;
+
+	gettimeofday(&now, NULL);
+	for(u = 0; u < count; u++){
+		length += snprintf(buffer + length, sizeof(buffer) - length, "%d %ld.%06ld %d %d %d\n",
+				slot, (long) now.tv_sec, (long) now.tv_usec, events[u].type, events[u].code, events[u].value);
+
+		if(length > sizeof(buffer) - FILE_OUTPUT_LINE || u == count - 1){
+			status = file_flush(client->ev_fd, buffer, length);
+			if(!status){
+				client->events_dropped += count - first;
+				return true;
+			}
+			if(status < 0){
+				logprintf(log, LOG_ERROR, "[%d] Failed to write event: %s\n", slot, strerror(errno));
+				return false;
+			}
+			length = 0;
+			first = u + 1;
+		}
+	}
+	return true;
+}
+
+static output_backend backends[] = {
+	{"uinput", uinput_create, uinput_write, uinput_destroy, uinput_feedback},
+	{"null", null_create, null_write, null_destroy, NULL},
+	{"file", file_create, file_write, null_destroy, NULL},
+	{NULL}
+};
+
+static output_backend* backend = backends;
+
+/**
+ * Selects the output backend from a specification of the form <backend>[:<path>].
+ */
+bool output_select(LOGGER log, char* spec) {
+	size_t u, length = strcspn(spec, ":");
+
+	for(u = 0; backends[u].name; u++){
+		if(strlen(backends[u].name) == length && !strncmp(backends[u].name, spec, length)){
+			break;
+		}
+	}
+
+	if(!backends[u].name){
+		logprintf(log, LOG_ERROR, "Unknown output backend %s\n", spec);
+		return false;
+	}
+
+	output_path = spec[length] ? spec + length + 1 : NULL;
+	if(backends[u].create == file_create && (!output_path || !*output_path)){
+		logprintf(log, LOG_ERROR, "The file backend requires a path (file:<path>)\n");
+		return false;
+	}
+
+	backend = backends + u;
+	return true;
+}
+
+bool create_device(LOGGER log, gamepad_client* client, struct device_meta* meta, uint8_t slot) {
+	memset(client->effects, 0, sizeof(client->effects));
+	client->effects_pending = 0;
+	client->feedback_events = 0;
+	client->feedback_dropped = 0;
+	client->feedback_latency_total = 0;
+	client->feedback_latency_max = 0;
+	client->events_written = 0;
+	client->events_dropped = 0;
+	client->events_denied = 0;
+	return backend->create(log, client, meta, slot);
+}
+
+bool output_feedback(void) {
+	return backend->feedback != NULL;
+}
+
+/**
+ * Collects force feedback and LED messages for the client of a device into buffer
+ * (FEEDBACK_BUFFER_SIZE bytes). Returns the number of bytes stored or -1 on failure.
+ */
+ssize_t read_feedback(LOGGER log, gamepad_client* client, uint8_t* buffer, uint8_t slot) {
+	if(!backend->feedback || client->ev_fd < 0){
+		return 0;
+	}
+	return backend->feedback(log, client, buffer, slot);
+}
+
+bool write_events(LOGGER log, gamepad_client* client, struct input_event* events, size_t count, uint8_t slot) {
+	client->events_written += count;
+	return backend->write(log, client, events, count, slot);
+}
+
 bool cleanup_device(LOGGER log, gamepad_client* client) {
 	struct device_meta empty = {
 		0
@@ -151,10 +447,21 @@ bool cleanup_device(LOGGER log, gamepad_client* client) {
 		return true;
 	}
 
-	if(ioctl(client->ev_fd, UI_DEV_DESTROY)){
-		logprintf(log, LOG_ERROR, "Failed to destroy uinput device: %s\n", strerror(errno));
+	if(!backend->destroy(log, client)){
 		return false;
 	}
+	record_stop(log, client);
+	remap_free(client->remap);
+	client->remap = NULL;
+
+	logprintf(log, LOG_INFO, "Removed %s device after %llu events (%llu dropped, %llu denied)\n", backend->name,
+			(unsigned long long) client->events_written, (unsigned long long) client->events_dropped,
+			(unsigned long long) client->events_denied);
+	if(client->feedback_events){
+		logprintf(log, LOG_INFO, "Forwarded %llu feedback requests (%llu dropped), latency %.1f us average, %.1f us maximum\n",
+				(unsigned long long) client->feedback_events, (unsigned long long) client->feedback_dropped,
+				client->feedback_latency_total / 1000.0 / client->feedback_events, client->feedback_latency_max / 1000.0);
+	}
 
 	close(client->ev_fd);
 	client->ev_fd = -1;
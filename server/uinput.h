@@ -7,6 +7,25 @@
 #include "input-server.h"
 
 #define UINPUT_PATH "/dev/uinput"
+// batch buffer of the file backend and the maximum length of one event line
+#define FILE_OUTPUT_BUFFER 4096
+#define FILE_OUTPUT_LINE 64
+// uinput requests handled per read, bounds the feedback messages queued at once
+#define FEEDBACK_BATCH 16
+#define FEEDBACK_BUFFER_SIZE (FEEDBACK_BATCH * sizeof(FeedbackMessage))
 
-bool create_device(LOGGER log, gamepad_client* client, struct device_meta* meta);
+typedef struct /*_OUTPUT_BACKEND*/ {
+	char* name;
+	bool (*create)(LOGGER log, gamepad_client* client, struct device_meta* meta, uint8_t slot);
+	bool (*write)(LOGGER log, gamepad_client* client, struct input_event* events, size_t count, uint8_t slot);
+	bool (*destroy)(LOGGER log, gamepad_client* client);
+	// optional, services force feedback and LED requests of the device
+	ssize_t (*feedback)(LOGGER log, gamepad_client* client, uint8_t* buffer, uint8_t slot);
+} output_backend;
+
+bool output_select(LOGGER log, char* spec);
+bool create_device(LOGGER log, gamepad_client* client, struct device_meta* meta, uint8_t slot);
+bool output_feedback(void);
+ssize_t read_feedback(LOGGER log, gamepad_client* client, uint8_t* buffer, uint8_t slot);
+bool write_events(LOGGER log, gamepad_client* client, struct input_event* events, size_t count, uint8_t slot);
 bool cleanup_device(LOGGER log, gamepad_client* client);
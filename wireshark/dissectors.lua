@@ -55,7 +55,14 @@ local msgtype = {
 	DEVICE                 = 0x04,
 	SETUP_END              = 0x05,
 	REQUEST_EVENT          = 0x06,
+	PING                   = 0x07,
+	RING                   = 0x08,
+	OPEN                   = 0x09,
 	DATA                   = 0x10,
+	FEEDBACK               = 0x11,
+	FF_UPLOAD              = 0x12,
+	FF_ERASE               = 0x13,
+	SLOT                   = 0x20,
 	SUCCESS                = 0xF0,
 	VERSION_MISMATCH       = 0xF1,
 	INVALID_PASSWORD       = 0xF2,
@@ -66,7 +73,8 @@ local msgtype = {
 	CLIENT_SLOT_IN_USE     = 0xF7,
 	CLIENT_SLOTS_EXHAUSTED = 0xF8,
 	QUIT                   = 0xF9,
-	DEVICE_NOT_ALLOWED     = 0xFA
+	PONG                   = 0xFA,
+	EVENT_MASK             = 0xFB
 }
 
 local axismap = {
@@ -120,7 +128,10 @@ local hdr_fields = {
 	event_code = ProtoField.uint16("ng.event.code", "Code", base.HEX),
 	event_value= ProtoField.int32("ng.event.value", "Value", base.DEC),
 	request_code = ProtoField.uint16("ng.code", "Code", base.HEX),
-	request_type = ProtoField.uint16("ng.type", "Type", base.HEX)
+	request_type = ProtoField.uint16("ng.type", "Type", base.HEX),
+	effect_id    = ProtoField.int16("ng.ff.id", "Effect ID", base.DEC),
+	effect_type  = ProtoField.uint16("ng.ff.type", "Effect Type", base.HEX),
+	ring_size    = ProtoField.uint32("ng.ring.size", "Ring Size", base.DEC)
 }
 
 ngamepads_proto.fields = hdr_fields
@@ -227,10 +238,43 @@ dissectNGamepads = function(tvbuf, pktinfo, root, offset)
 	elseif msg_type_val == msgtype.REQUEST_EVENT then
 		tree:add(hdr_fields.request_type, tvbuf:range(offset + 1, 2))
 		tree:add(hdr_fields.request_code, tvbuf:range(offset + 3, 2))
-	elseif msg_type_val == msgtype.DATA then
+	elseif msg_type_val == msgtype.EVENT_MASK then
+		local len = tvbuf:range(offset + 1, 1)
+		tree:add(hdr_fields.length, len)
+		local pos = offset + 2
+		while pos + 2 <= offset + 2 + len:uint() do
+			local bytes = tvbuf:range(pos + 1, 1):uint()
+			tree:add(tvbuf:range(pos, 2 + bytes), "Mask for event type " .. tvbuf:range(pos, 1):uint())
+			pos = pos + 2 + bytes
+		end
+	elseif msg_type_val == msgtype.DATA or msg_type_val == msgtype.FEEDBACK then
 		tree:add(hdr_fields.event_type, tvbuf:range(offset + 1, 2))
 		tree:add(hdr_fields.event_code, tvbuf:range(offset + 3, 2))
 		tree:add(hdr_fields.event_value, tvbuf:range(offset + 5, 4))
+	elseif msg_type_val == msgtype.FF_UPLOAD then
+		tree:add(hdr_fields.effect_type, tvbuf:range(offset + 1, 2))
+		tree:add(hdr_fields.effect_id, tvbuf:range(offset + 3, 2))
+		tree:add(tvbuf:range(offset + 5, 10), "Direction, trigger and replay")
+		tree:add(tvbuf:range(offset + 15, 24), "Effect parameters")
+	elseif msg_type_val == msgtype.FF_ERASE then
+		tree:add(hdr_fields.effect_id, tvbuf:range(offset + 1, 2))
+	elseif msg_type_val == msgtype.RING then
+		tree:add(hdr_fields.ring_size, tvbuf:range(offset + 1, 4))
+	elseif msg_type_val == msgtype.OPEN then
+		tree:add(hdr_fields.slot, tvbuf:range(offset + 1, 1))
+	elseif msg_type_val == msgtype.SLOT then
+		local len = tvbuf:range(offset + 1, 1)
+		tree:add(hdr_fields.length, len)
+		tree:add(hdr_fields.slot, tvbuf:range(offset + 2, 1))
+		-- the enveloped messages of the slot
+		local pos = offset + 3
+		while pos < offset + 3 + len:uint() do
+			local inner = dissectNGamepads(tvbuf, pktinfo, tree, pos)
+			if inner <= 0 then
+				break
+			end
+			pos = pos + inner
+		end
 	end
 
 	return length_val
@@ -271,8 +315,20 @@ checkNGamepadsLength = function(tvbuf, offset)
 		end
 	elseif msgtype_val == msgtype.REQUEST_EVENT then
 		return 5
-	elseif msgtype_val == msgtype.DATA then
+	elseif msgtype_val == msgtype.DATA or msgtype_val == msgtype.FEEDBACK then
 		return 9
+	elseif msgtype_val == msgtype.FF_UPLOAD then
+		return 39
+	elseif msgtype_val == msgtype.FF_ERASE then
+		return 3
+	elseif msgtype_val == msgtype.OPEN then
+		return 2
+	elseif msgtype_val == msgtype.SLOT then
+		if msglen < 2 then
+			return -DESEGMENT_ONE_MORE_SEGMENT
+		else
+			return tvbuf:range(offset + 1, 1):uint() + 3
+		end
 	elseif msgtype_val == msgtype.VERSION_MISMATCH then
 		return 2
 	elseif msgtype_val == msgtype.SUCCESS then
@@ -289,6 +345,14 @@ checkNGamepadsLength = function(tvbuf, offset)
 		return 1
 	elseif msgtype_val == msgtype.QUIT then
 		return 1
+	elseif msgtype_val == msgtype.PING or msgtype_val == msgtype.PONG or msgtype_val == msgtype.RING then
+		return 5
+	elseif msgtype_val == msgtype.EVENT_MASK then
+		if msglen < 2 then
+			return -DESEGMENT_ONE_MORE_SEGMENT
+		else
+			return tvbuf:range(offset + 1, 1):uint() + 2
+		end
 	else
 		dprint2("unknown msg_type")
 		return 0
@@ -9,6 +9,12 @@ int main() {
 	printf("ABSInfo: %zd\n", sizeof(ABSInfoMessage));
 	printf("DEVICE: %zd\n", sizeof(DeviceMessage));
 	printf("DATA: %zd\n", sizeof(DataMessage));
+	printf("RING: %zd\n", sizeof(RingMessage));
+	printf("OPEN: %zd\n", sizeof(OpenMessage));
+	printf("SLOT: %zd\n", sizeof(SlotMessage));
+	printf("FEEDBACK: %zd\n", sizeof(FeedbackMessage));
+	printf("FF_UPLOAD: %zd\n", sizeof(FFUploadMessage));
+	printf("FF_ERASE: %zd\n", sizeof(FFEraseMessage));
 	printf("VERSION_MISMATCH: %zd\n", sizeof(VersionMismatchMessage));
 	printf("SUCCESS: %zd\n", sizeof(SuccessMessage));
 